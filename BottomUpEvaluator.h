@@ -0,0 +1,181 @@
+
+#pragma once
+
+#include <atomic> // for std::atomic
+#include <cstddef> // for std::size_t
+#include <cstdint> // for std::uint32_t
+#include <stdexcept> // for std::runtime_error
+#include <type_traits> // for std::is_same
+#include <vector> // for std::vector
+
+#include "GenericTree.h"
+#include "TreeLayout.h"
+#include "TreeThreadPool.h"
+
+// -------------------------------------------------------------------
+// Bottom-up (postorder) dynamic programming over a tree
+// -------------------------------------------------------------------
+
+// Many tree computations produce one value per node from the values of its
+// children: subtree sizes, heights, best scores, and so on. That is usually
+// written as a postorder recursion, which can overflow the call stack on a
+// deep tree. BottomUpEvaluator works out an order where every node comes
+// after all of its children once, and then runs your function over that
+// order as many times as you like, with no recursion at all.
+//
+// Your function is called as f(node, children) and returns the value for the
+// node, where "children" lets you loop over the values already computed for
+// the node's (non-null) children:
+//
+//   BottomUpEvaluator<int> evaluator(tree);
+//   auto heights = evaluator.evaluate<int>(
+//     [](const GenericTree<int>::TreeNode& node, const BottomUpEvaluator<int>::ChildResults<int>& children) {
+//       int height = 0;
+//       for (int childHeight : children) height = std::max(height, childHeight + 1);
+//       return height;
+//     });
+//   int rootHeight = heights[evaluator.indexOf(tree.getRootPtr())];
+//
+// The results come back in a vector indexed by each node's preorder number,
+// which indexOf looks up.
+
+template <typename T>
+class BottomUpEvaluator {
+public:
+  using TreeNode = typename GenericTree<T>::TreeNode;
+
+  // A view of the values computed for one node's children.
+  template <typename R>
+  class ChildResults {
+  public:
+    class const_iterator {
+    public:
+      const_iterator(const ChildResults* owner, std::size_t index) : owner(owner), index(index) {}
+      const R& operator*() const { return (*owner->results)[index]; }
+      // In preorder, each next sibling comes right after the previous
+      // sibling's whole subtree.
+      const_iterator& operator++() { index += owner->layout->subtreeSizes[index]; return *this; }
+      bool operator!=(const const_iterator& other) const { return index != other.index; }
+      bool operator==(const const_iterator& other) const { return index == other.index; }
+    private:
+      const ChildResults* owner;
+      std::size_t index;
+    };
+
+    ChildResults(const std::vector<R>* results, const TreeLayout<T>* layout, std::size_t nodeIndex)
+      : results(results), layout(layout),
+        firstChild(nodeIndex + 1), endChild(nodeIndex + layout->subtreeSizes[nodeIndex]) {}
+
+    const_iterator begin() const { return const_iterator(this, firstChild); }
+    const_iterator end() const { return const_iterator(this, endChild); }
+    bool empty() const { return firstChild == endChild; }
+
+  private:
+    const std::vector<R>* results;
+    const TreeLayout<T>* layout;
+    std::size_t firstChild;
+    std::size_t endChild;
+  };
+
+  explicit BottomUpEvaluator(GenericTree<T>& tree) : tree(tree), builtVersion(0), isBuilt(false) {}
+
+  // Run f over the tree on this thread, children before parents.
+  template <typename R, typename F>
+  std::vector<R> evaluate(F f);
+
+  // Run f over the tree on the thread pool. A node is evaluated as soon as
+  // all of its children are done, so independent subtrees proceed in
+  // parallel. f may be called from several threads at once.
+  template <typename R, typename F>
+  std::vector<R> evaluateParallel(F f, TreeThreadPool& pool = TreeThreadPool::shared());
+
+  // The position of a node's value in the results.
+  std::size_t indexOf(const TreeNode* node) {
+    refresh();
+    std::size_t index = layout.indexOf(node);
+    if (TreeLayout<T>::NO_INDEX == index) {
+      throw std::runtime_error("BottomUpEvaluator was given a node that isn't in its tree");
+    }
+    return index;
+  }
+
+  // Rebuild the schedule now if the tree has changed since it was built.
+  void refresh() {
+    if (!isBuilt || builtVersion != tree.structureVersion()) {
+      layout.rebuild(tree);
+      leaves.clear();
+      for (std::size_t i = 0; i < layout.size(); i++) {
+        if (1 == layout.subtreeSizes[i]) {
+          leaves.push_back(i);
+        }
+      }
+      builtVersion = tree.structureVersion();
+      isBuilt = true;
+    }
+  }
+
+private:
+  GenericTree<T>& tree;
+  std::size_t builtVersion;
+  bool isBuilt;
+  TreeLayout<T> layout;
+  std::vector<std::size_t> leaves;
+};
+
+template <typename T>
+template <typename R, typename F>
+std::vector<R> BottomUpEvaluator<T>::evaluate(F f) {
+  refresh();
+  std::vector<R> results(layout.size());
+
+  // Reverse preorder visits every child before its parent.
+  for (std::size_t i = layout.size(); i > 0; i--) {
+    std::size_t index = i - 1;
+    results[index] = f(static_cast<const TreeNode&>(*layout.nodes[index]),
+      ChildResults<R>(&results, &layout, index));
+  }
+  return results;
+}
+
+template <typename T>
+template <typename R, typename F>
+std::vector<R> BottomUpEvaluator<T>::evaluateParallel(F f, TreeThreadPool& pool) {
+
+  // std::vector<bool> packs values into shared bytes, so different threads
+  // can't safely write neighboring results.
+  static_assert(!std::is_same<R, bool>::value, "Use a wider type than bool for parallel results");
+
+  refresh();
+  const std::size_t n = layout.size();
+  std::vector<R> results(n);
+
+  // Each node counts how many of its children are still unfinished.
+  std::vector< std::atomic<std::uint32_t> > pendingChildren(n);
+  for (std::size_t i = 0; i < n; i++) {
+    pendingChildren[i].store(0, std::memory_order_relaxed);
+  }
+  for (std::size_t i = 1; i < n; i++) {
+    pendingChildren[layout.parents[i]].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Start one climb from every leaf. After finishing a node, the climb
+  // moves on to its parent only if it was the last child to finish there;
+  // otherwise some other climb will get to the parent later. The
+  // acquire/release ordering on the counters makes all of the children's
+  // results visible to whichever thread evaluates the parent.
+  pool.parallelFor(leaves.size(), [&](std::size_t begin, std::size_t end) {
+    for (std::size_t leaf = begin; leaf < end; leaf++) {
+      std::size_t index = leaves[leaf];
+      while (true) {
+        results[index] = f(static_cast<const TreeNode&>(*layout.nodes[index]),
+          ChildResults<R>(&results, &layout, index));
+        std::size_t parent = layout.parents[index];
+        if (TreeLayout<T>::NO_INDEX == parent) break;
+        if (1 != pendingChildren[parent].fetch_sub(1, std::memory_order_acq_rel)) break;
+        index = parent;
+      }
+    }
+  });
+
+  return results;
+}
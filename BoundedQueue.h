@@ -0,0 +1,233 @@
+
+#pragma once
+
+#include <atomic> // for std::atomic
+#include <condition_variable> // for std::condition_variable
+#include <cstddef> // for std::size_t
+#include <memory> // for std::unique_ptr
+#include <mutex> // for std::mutex, std::unique_lock
+#include <thread> // for std::this_thread::yield
+#include <utility> // for std::move
+
+// BoundedQueue: A fixed-capacity queue that any number of threads can push
+// to and pop from at the same time, without locks. It's meant for passing
+// work between the stages of a pipeline: because the capacity is fixed, a
+// fast producer can only get so far ahead of a slow consumer.
+//
+// This is the classic array-based design by Dmitry Vyukov. Every cell has a
+// sequence number saying whose turn it is: a producer may fill the cell at
+// position p when its sequence is p, and the consumer of position p may
+// empty it when its sequence is p + 1. Claiming a position is one
+// compare-and-swap on the shared enqueue or dequeue counter, and handing the
+// cell over is one store to its sequence number.
+//
+// Besides the non-blocking tryPush and tryPop, there are blocking push and
+// pop for pipeline stages. Those first wait by yielding the processor for a
+// few rounds, which suits a pipeline that is kept busy, and then go to
+// sleep until the other side makes a change. The mutex they sleep on is
+// only touched while some thread is asleep, so a busy queue stays
+// lock-free. Once every producer is done, close() the queue, so that pop
+// reports the end of the stream after the last item.
+template <typename T>
+class BoundedQueue {
+public:
+
+  // Constructor: The capacity is rounded up to a power of two.
+  explicit BoundedQueue(std::size_t requestedCapacity) : closed(false), cancelled(false), sleepers(0) {
+    capacity = 2;
+    while (capacity < requestedCapacity) {
+      capacity *= 2;
+    }
+    mask = capacity - 1;
+    cells.reset(new Cell[capacity]);
+    for (std::size_t i = 0; i < capacity; i++) {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    enqueuePosition.store(0, std::memory_order_relaxed);
+    dequeuePosition.store(0, std::memory_order_relaxed);
+  }
+
+  BoundedQueue(const BoundedQueue& other) = delete;
+  BoundedQueue& operator=(const BoundedQueue& other) = delete;
+
+  // Add an item if there's room. Returns false (leaving the item alone) if
+  // the queue is full.
+  bool tryPush(T& item) {
+    if (!claimAndPush(item)) return false;
+    wakeSleepers();
+    return true;
+  }
+
+  // Remove the oldest item if there is one. Returns false if the queue is
+  // empty.
+  bool tryPop(T& item) {
+    if (!claimAndPop(item)) return false;
+    wakeSleepers();
+    return true;
+  }
+
+  // Add an item, waiting while the queue is full. Returns false, without
+  // adding it, if the queue was cancelled meanwhile.
+  bool push(T& item) {
+    for (std::size_t round = 0; !tryPush(item); round++) {
+      if (cancelled.load(std::memory_order_acquire)) return false;
+      if (round < SPIN_ROUNDS) {
+        std::this_thread::yield();
+        continue;
+      }
+      bool pushed = false;
+      sleepUntil([&]() {
+        pushed = claimAndPush(item);
+        return pushed || cancelled.load(std::memory_order_acquire);
+      });
+      if (!pushed) return false;
+      wakeSleepers();
+      return true;
+    }
+    return true;
+  }
+
+  // Remove the oldest item, waiting while the queue is empty. Returns false
+  // once the queue is closed and empty, or cancelled.
+  bool pop(T& item) {
+    for (std::size_t round = 0; !tryPop(item); round++) {
+      if (cancelled.load(std::memory_order_acquire)) return false;
+      if (closed.load(std::memory_order_acquire)) {
+        // Everything pushed before close() is visible now, so one more try
+        // settles whether anything is left.
+        return tryPop(item);
+      }
+      if (round < SPIN_ROUNDS) {
+        std::this_thread::yield();
+        continue;
+      }
+      bool popped = false;
+      sleepUntil([&]() {
+        popped = claimAndPop(item);
+        return popped || cancelled.load(std::memory_order_acquire) || closed.load(std::memory_order_acquire);
+      });
+      if (popped) {
+        wakeSleepers();
+        return true;
+      }
+    }
+    return true;
+  }
+
+  // Say that no more items will be pushed.
+  void close() {
+    closed.store(true, std::memory_order_release);
+    wakeSleepers();
+  }
+
+  // Make every waiting or future push and pop give up, for shutting a
+  // pipeline down early.
+  void cancel() {
+    cancelled.store(true, std::memory_order_release);
+    wakeSleepers();
+  }
+
+  std::size_t maxSize() const {
+    return capacity;
+  }
+
+private:
+  // How many times push and pop yield before going to sleep.
+  static constexpr std::size_t SPIN_ROUNDS = 64;
+
+  // tryPush without waking anyone.
+  bool claimAndPush(T& item) {
+    std::size_t position = enqueuePosition.load(std::memory_order_relaxed);
+    while (true) {
+      Cell& cell = cells[position & mask];
+      std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      if (sequence == position) {
+        if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          cell.item = std::move(item);
+          cell.sequence.store(position + 1, std::memory_order_release);
+          return true;
+        }
+        // Another producer got this position first; position now holds the
+        // current counter, so try again from there.
+      }
+      else if (sequence < position) {
+        // The consumer hasn't emptied this cell from the last lap yet.
+        return false;
+      }
+      else {
+        position = enqueuePosition.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // tryPop without waking anyone.
+  bool claimAndPop(T& item) {
+    std::size_t position = dequeuePosition.load(std::memory_order_relaxed);
+    while (true) {
+      Cell& cell = cells[position & mask];
+      std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      if (sequence == position + 1) {
+        if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          item = std::move(cell.item);
+          cell.sequence.store(position + capacity, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (sequence < position + 1) {
+        return false;
+      }
+      else {
+        position = dequeuePosition.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Sleep until ready() is true. The sleeper announces itself before its
+  // last check, and every change checks for sleepers after making the
+  // change. Both sides do that with a read-modify-write of sleepers, and
+  // those are ordered one after the other, so either the last check sees
+  // the change or the change sees the sleeper and wakes it.
+  template <typename Ready>
+  void sleepUntil(Ready ready) {
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    sleepers.fetch_add(1);
+    while (!ready()) {
+      changed.wait(lock);
+    }
+    sleepers.fetch_sub(1);
+  }
+
+  void wakeSleepers() {
+    // Adding 0 reads the count in the same order as the sleepers' updates
+    // (a plain load could be done before the change is visible).
+    if (0 == sleepers.fetch_add(0)) return;
+    // Taking the lock means a sleeper is either still before its check or
+    // already waiting, so the notification can't slip in between.
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    changed.notify_all();
+  }
+
+  struct Cell {
+    std::atomic<std::size_t> sequence;
+    T item;
+  };
+
+  // The counters are padded apart so that producers and consumers don't
+  // slow each other down by writing to the same cache line.
+  static constexpr std::size_t CACHE_LINE = 64;
+  std::atomic<std::size_t> enqueuePosition;
+  char enqueuePadding[CACHE_LINE];
+  std::atomic<std::size_t> dequeuePosition;
+  char dequeuePadding[CACHE_LINE];
+  std::atomic<bool> closed;
+  std::atomic<bool> cancelled;
+  std::atomic<std::size_t> sleepers;
+  std::mutex sleepMutex;
+  std::condition_variable changed;
+  std::size_t capacity;
+  std::size_t mask;
+  std::unique_ptr<Cell[]> cells;
+};
+
+template <typename T>
+constexpr std::size_t BoundedQueue<T>::SPIN_ROUNDS;
@@ -0,0 +1,276 @@
+
+#pragma once
+
+#include <cstddef> // for std::size_t
+#include <limits> // for std::numeric_limits
+#include <ostream> // for std::ostream
+#include <queue> // for std::queue
+#include <stack> // for std::stack
+#include <string> // for std::string
+#include <vector> // for std::vector
+
+#include "GenericTree.h"
+
+// ChainCompressedTree: A read-only copy of a GenericTree where every chain
+// of single-child nodes is collapsed into one "chain" entry, in the style of
+// a radix (patricia) tree.
+//
+// For example, in the tree from treeFactory the nodes 8 -> 16 -> 42 don't
+// form a chain (8 has two children), but 16 -> 42 does: 16 has exactly one
+// child slot. So the compressed tree stores 16 and 42 together as one chain
+// with the payloads {16, 42}. On a tree with long spines of single children,
+// that removes a TreeNode and a one-element vector per link, and walking
+// down the spine reads consecutive payloads instead of chasing a pointer for
+// every hop.
+//
+// All of the chains live in one array, and so do all of the payloads and all
+// of the child links. A chain's payloads are a contiguous run of the payload
+// array, top node first, and the child slots of its bottom node are a
+// contiguous run of the child link array.
+//
+// Printing and level-order traversal expand the chains again, so they give
+// exactly the same output as for the original GenericTree.
+template <typename T>
+class ChainCompressedTree {
+public:
+  using TreeNode = typename GenericTree<T>::TreeNode;
+
+  // The child link recorded for a null child slot.
+  static constexpr std::size_t NO_CHAIN = std::numeric_limits<std::size_t>::max();
+
+  struct Chain {
+    // Where this chain's payloads are in the payload array, and how many.
+    std::size_t payloadBegin;
+    std::size_t payloadCount;
+    // Where the bottom node's child slots are in the child link array, and
+    // how many. Each link is a chain index, or NO_CHAIN for a null slot.
+    std::size_t childBegin;
+    std::size_t childCount;
+  };
+
+  // Default constructor: An empty tree.
+  ChainCompressedTree() {}
+
+  // Constructor: Builds a compressed copy of the given tree.
+  explicit ChainCompressedTree(const GenericTree<T>& source) {
+    rebuild(source);
+  }
+
+  // Replace the contents with a compressed copy of the given tree. Any
+  // placeholders in it are loaded, since the copy has to include them.
+  void rebuild(const GenericTree<T>& source);
+
+  // The number of (uncompressed) nodes.
+  std::size_t size() const {
+    return payloads.size();
+  }
+
+  // The number of chains the nodes were collapsed into.
+  std::size_t chainCount() const {
+    return chains.size();
+  }
+
+  bool empty() const {
+    return chains.empty();
+  }
+
+  // The root chain is always chain 0.
+  const Chain& chain(std::size_t index) const {
+    return chains[index];
+  }
+
+  // A chain's payloads, top node first.
+  const T* chainPayloads(std::size_t index) const {
+    return payloads.data() + chains[index].payloadBegin;
+  }
+
+  // The chain that the child in the given slot of a chain's bottom node
+  // starts, or NO_CHAIN for a null slot.
+  std::size_t childChain(std::size_t index, std::size_t slot) const {
+    return childLinks[chains[index].childBegin + slot];
+  }
+
+  // Print the tree in the same vertical text format as GenericTree::Print.
+  std::ostream& Print(std::ostream& os) const;
+
+private:
+  std::vector<Chain> chains;
+  std::vector<T> payloads;
+  std::vector<std::size_t> childLinks;
+};
+
+template <typename T>
+constexpr std::size_t ChainCompressedTree<T>::NO_CHAIN;
+
+template <typename T>
+std::ostream& operator<<(std::ostream& os, const ChainCompressedTree<T>& tree) {
+  return tree.Print(os);
+}
+
+template <typename T>
+void ChainCompressedTree<T>::rebuild(const GenericTree<T>& source) {
+
+  chains.clear();
+  payloads.clear();
+  childLinks.clear();
+
+  const TreeNode* rootNodePtr = source.getRootPtr();
+  if (!rootNodePtr) return;
+
+  // Each entry is the top node of a chain still to be built, along with the
+  // child link that should point to it once it has an index (or NO_CHAIN
+  // for the root, which has no link).
+  struct PendingChain {
+    const TreeNode* top;
+    std::size_t linkSlot;
+  };
+  std::stack<PendingChain> chainsToBuild;
+  chainsToBuild.push(PendingChain{rootNodePtr, NO_CHAIN});
+
+  while (!chainsToBuild.empty()) {
+    PendingChain cur = chainsToBuild.top();
+    chainsToBuild.pop();
+
+    std::size_t index = chains.size();
+    if (NO_CHAIN != cur.linkSlot) {
+      childLinks[cur.linkSlot] = index;
+    }
+
+    // Follow single children down as far as they go.
+    Chain chain;
+    chain.payloadBegin = payloads.size();
+    const TreeNode* bottom = cur.top;
+    payloads.push_back(bottom->data);
+    while (1 == source.childrenOf(bottom).size() && bottom->childrenPtrs[0]) {
+      bottom = bottom->childrenPtrs[0];
+      payloads.push_back(bottom->data);
+    }
+    chain.payloadCount = payloads.size() - chain.payloadBegin;
+
+    // Reserve the bottom node's child links now. Each child chain fills in
+    // its own link when it gets built.
+    chain.childBegin = childLinks.size();
+    chain.childCount = source.childrenOf(bottom).size();
+    childLinks.resize(childLinks.size() + chain.childCount, NO_CHAIN);
+    chains.push_back(chain);
+
+    // Push in reverse so that the leftmost child is built first.
+    for (std::size_t i = chain.childCount; i > 0; i--) {
+      const TreeNode* child = bottom->childrenPtrs[i-1];
+      if (child) {
+        chainsToBuild.push(PendingChain{child, chain.childBegin + i - 1});
+      }
+    }
+  }
+}
+
+template <typename T>
+std::ostream& ChainCompressedTree<T>::Print(std::ostream& os) const {
+
+  if (chains.empty()) {
+    return os << "[empty tree]" << std::endl;
+  }
+
+  // Flush the buffer when it grows past this many bytes.
+  constexpr std::size_t FLUSH_SIZE = 1 << 20;
+
+  // The same walk as renderTreeLines, except that each chain is displayed
+  // as a run of nodes where each one is the only (so also the last) child
+  // of the one above it.
+  struct PendingChain {
+    std::size_t chain;
+    std::size_t prefixLength;
+    bool isLast;
+    bool isRoot;
+  };
+
+  std::string buffer;
+  std::string prefix;
+  std::stack<PendingChain> chainsToExplore;
+  chainsToExplore.push(PendingChain{0, 0, true, true});
+
+  while (!chainsToExplore.empty()) {
+
+    PendingChain cur = chainsToExplore.top();
+    chainsToExplore.pop();
+    prefix.resize(cur.prefixLength);
+
+    if (NO_CHAIN == cur.chain) {
+      appendTreeNodeLines<T>(buffer, prefix, false, nullptr);
+      continue;
+    }
+
+    const Chain& chain = chains[cur.chain];
+    const T* chainData = payloads.data() + chain.payloadBegin;
+    bool isLast = cur.isLast;
+    bool isRoot = cur.isRoot;
+    for (std::size_t i = 0; i < chain.payloadCount; i++) {
+      if (i > 0) {
+        if (!isRoot) {
+          prefix += isLast ? "   " : "|  ";
+        }
+        isLast = true;
+        isRoot = false;
+      }
+      appendTreeNodeLines(buffer, prefix, isRoot, &chainData[i]);
+    }
+
+    if (buffer.size() >= FLUSH_SIZE) {
+      os.write(buffer.data(), buffer.size());
+      buffer.clear();
+    }
+
+    if (0 == chain.childCount) continue;
+    if (!isRoot) {
+      prefix += isLast ? "   " : "|  ";
+    }
+    for (std::size_t i = chain.childCount; i > 0; i--) {
+      chainsToExplore.push(PendingChain{childLinks[chain.childBegin + i - 1], prefix.size(),
+        i == chain.childCount, false});
+    }
+  }
+
+  os.write(buffer.data(), buffer.size());
+  return os;
+}
+
+// traverseLevels: The level-order traversal from GenericTreeExercises.h,
+// for a ChainCompressedTree. Returns copies of the data in level order, the
+// same as for the uncompressed tree.
+template <typename T>
+std::vector<T> traverseLevels(const ChainCompressedTree<T>& tree) {
+  std::vector<T> results;
+  if (tree.empty()) return results;
+  results.reserve(tree.size());
+
+  // Each entry is one logical node: a chain and a position within it.
+  struct NodeRef {
+    std::size_t chain;
+    std::size_t offset;
+  };
+  std::queue<NodeRef> nodesToExplore;
+  nodesToExplore.push(NodeRef{0, 0});
+
+  while (!nodesToExplore.empty()) {
+    NodeRef cur = nodesToExplore.front();
+    nodesToExplore.pop();
+
+    const auto& chain = tree.chain(cur.chain);
+    results.push_back(tree.chainPayloads(cur.chain)[cur.offset]);
+
+    // Inside a chain, the only child is the next payload. At the bottom of
+    // the chain, the children are the chains it links to.
+    if (cur.offset + 1 < chain.payloadCount) {
+      nodesToExplore.push(NodeRef{cur.chain, cur.offset + 1});
+      continue;
+    }
+    for (std::size_t slot = 0; slot < chain.childCount; slot++) {
+      std::size_t child = tree.childChain(cur.chain, slot);
+      if (ChainCompressedTree<T>::NO_CHAIN != child) {
+        nodesToExplore.push(NodeRef{child, 0});
+      }
+    }
+  }
+
+  return results;
+}
@@ -1,13 +1,39 @@
 
 #pragma once
 
+#include <exception> // for std::exception_ptr
 #include <stdexcept> // for std::runtime_error
 #include <stack> // for std::stack
 #include <queue> // for std::queue
 #include <vector> // for std::vector
 #include <iostream> // for std::cerr, std::cout
 #include <ostream> // for std::ostream
+#include <string> // for std::string
+#include <algorithm> // for std::remove, std::sort
+#include <atomic> // for std::atomic
+#include <cstdint> // for std::uint64_t
+#include <functional> // for std::function
+#include <unordered_map> // for std::unordered_map
+#include <utility> // for std::move_if_noexcept, std::forward
+#include <memory> // for std::allocator
+#include <new> // for placement new
+#include <shared_mutex> // for std::shared_timed_mutex, std::shared_lock
+#include <mutex> // for std::mutex, std::unique_lock, std::lock_guard
+
+#include "TreeFormat.h"
+#include "TreeThreadPool.h"
+
+
+// The orders that a tree's nodes can be laid out in (see defragment).
+enum class TreeOrder {
+  // Level by level, left to right.
+  BREADTH_FIRST,
+  // Preorder: each node followed by its subtrees, left to right.
+  DEPTH_FIRST
+};
 
+template <typename T>
+class SubtreeBuilder;
 
 template <typename T>
 class GenericTree {
@@ -31,12 +57,20 @@ public:
     // Returns a pointer to the new child node.
     TreeNode* addChild(const T& childData);
 
+    // Same, but moving the data into the new child instead of copying it.
+    TreeNode* addChild(T&& childData);
+
     // Default constructor: Indicate that there is no parent.
-    TreeNode() : parentPtr(nullptr) {}
+    TreeNode() : parentPtr(nullptr), arenaOwned(false), childrenPending(false), lazyLoaded(false) {}
 
     // Constructor based on data argument:
     // Specifies no parent, but does copy in the data member by value.
-    TreeNode(const T& dataArg) : parentPtr(nullptr), data(dataArg) {}
+    TreeNode(const T& dataArg) : parentPtr(nullptr), data(dataArg),
+      arenaOwned(false), childrenPending(false), lazyLoaded(false) {}
+
+    // Constructor that moves the data in instead of copying it.
+    TreeNode(T&& dataArg) : parentPtr(nullptr), data(std::move(dataArg)),
+      arenaOwned(false), childrenPending(false), lazyLoaded(false) {}
 
     TreeNode(const TreeNode& other) = delete;
 
@@ -48,12 +82,117 @@ public:
     // automatically called afterward.
     ~TreeNode() {}
 
+    // Whether this node is a placeholder whose children haven't been loaded
+    // yet (see GenericTree::makePlaceholder).
+    bool hasPendingChildren() const {
+      return childrenPending;
+    }
+
+  private:
+    friend class GenericTree;
+
+    // Whether this node lives in one of the tree's bulk-allocated node
+    // blocks (see fromLevelOrder) rather than being allocated by itself with
+    // "new". Such a node must be destroyed in place, not deleted.
+    bool arenaOwned;
+
+    // Whether the children still have to be loaded, and whether they were
+    // loaded lazily (so they can be evicted again).
+    bool childrenPending;
+    bool lazyLoaded;
+
   };
 
+  // A function that loads the children of a placeholder node, given the key
+  // the placeholder was made with (see setChildLoader).
+  using ChildLoader = std::function<void(TreeNode* node, std::uint64_t key)>;
+
 private:
 
   TreeNode* rootNodePtr;
 
+  // Nodes can also be allocated many at a time, in one contiguous block.
+  // That is much faster than calling "new" once per node, and the nodes end
+  // up next to each other in memory. Deleting a subtree destroys its block
+  // nodes, but the blocks themselves are only freed when the whole tree is
+  // cleared.
+  struct NodeBlock {
+    TreeNode* nodes;
+    std::size_t count;
+  };
+  std::vector<NodeBlock> nodeBlocks;
+
+  // Get uninitialized memory for count nodes, as a new block.
+  TreeNode* allocateNodeBlock(std::size_t count) {
+    nodeBlocks.reserve(nodeBlocks.size() + 1);
+    TreeNode* nodes = std::allocator<TreeNode>().allocate(count);
+    nodeBlocks.push_back(NodeBlock{nodes, count});
+    return nodes;
+  }
+
+  // Construct a node, with the given data, in a slot of a node block.
+  template <typename Data>
+  static TreeNode* constructBlockNode(TreeNode* slot, Data&& nodeData) {
+    TreeNode* node = new (slot) TreeNode(std::forward<Data>(nodeData));
+    node->arenaOwned = true;
+    return node;
+  }
+
+  // Destroy a subtree that isn't linked into any parent, forgetting the
+  // lazy loading state of its nodes. Unlike deleteSubtree, this doesn't
+  // check which tree the nodes are in.
+  void destroyUnlinkedSubtree(TreeNode* subtreeRoot);
+
+  // Free the memory of every node block. The nodes in them must already
+  // have been destroyed.
+  void releaseNodeBlocks() {
+    for (const NodeBlock& block : nodeBlocks) {
+      std::allocator<TreeNode>().deallocate(block.nodes, block.count);
+    }
+    nodeBlocks.clear();
+  }
+
+  // The body of both fromLevelOrder overloads, where valueAt(i) gives the
+  // data of the i-th of n nodes.
+  template <typename ValueAt, typename Count>
+  void buildFromLevelOrder(std::size_t n, ValueAt valueAt, const std::vector<Count>& degrees);
+
+  // Counts structural changes made through this class (see structureVersion).
+  // Loading children on demand changes the structure even through a const
+  // tree, so this can change in const functions too.
+  mutable std::size_t structureVersionCount;
+
+  // Lazy loading state: the loader, the key of every placeholder, and the
+  // key and last use of every node whose children were loaded lazily. The
+  // use stamps are atomic because childrenOf updates them through a const
+  // tree, which several threads may be walking at once.
+  struct LoadedRecord {
+    std::uint64_t key;
+    mutable std::atomic<std::uint64_t> lastUse;
+
+    LoadedRecord(std::uint64_t key, std::uint64_t lastUse) : key(key), lastUse(lastUse) {}
+    LoadedRecord(const LoadedRecord& other) : key(other.key), lastUse(other.lastUse.load()) {}
+    LoadedRecord& operator=(const LoadedRecord& other) {
+      key = other.key;
+      lastUse = other.lastUse.load();
+      return *this;
+    }
+  };
+  ChildLoader childLoader;
+  mutable std::unordered_map<const TreeNode*, std::uint64_t> pendingKeys;
+  mutable std::unordered_map<const TreeNode*, LoadedRecord> loadedRecords;
+  mutable std::atomic<std::uint64_t> useClock;
+
+  // Readers hold this shared, and compressConcurrent holds it exclusively
+  // while it swaps in child arrays (see ReadSection). New readers pass
+  // through publishGate first, which compressConcurrent closes while it
+  // waits for the current readers to leave.
+  mutable std::shared_timed_mutex readersMutex;
+  mutable std::mutex publishGate;
+
+  // SubtreeBuilder fills node blocks of its own and hands them over.
+  friend class SubtreeBuilder<T>;
+
 public:
   TreeNode* createRoot(const T& rootData);
 
@@ -62,13 +201,128 @@ public:
     return rootNodePtr;
   }
 
+  // Read-only access to the root node, for functions that take a const tree.
+  const TreeNode* getRootPtr() const {
+    return rootNodePtr;
+  }
+
   void deleteSubtree(TreeNode* targetRoot);
 
+  // Make newRoot the root of the tree, by reversing the links along the
+  // path from it up to the old root: each node on the path becomes a child
+  // of the node that used to be its child, added as its rightmost child.
+  // Every other link stays as it is, so this takes time proportional to the
+  // path, counting the children of the nodes on it, not the whole tree.
+  //   Node pointers stay valid. Indices built on the tree are invalidated
+  // through structureVersion(). (TopKIndex::reroot updates its cached
+  // maxima in place instead.)
+  void reroot(TreeNode* newRoot);
+
+  // Replace the tree's contents with a tree given in level order: values
+  // lists the node data in the order traverseLevels would return it, and
+  // degrees[i] is the number of children of the i-th node. (That is the
+  // inverse of traverseLevels. Null child slots aren't represented, so they
+  // don't survive the round trip.)
+  //   The nodes are all allocated in one block and every childrenPtrs
+  // vector is sized exactly once, so this runs in a single linear pass.
+  // Throws std::runtime_error, leaving the tree empty, if the degrees don't
+  // describe a tree with values.size() nodes.
+  template <typename Count>
+  void fromLevelOrder(const std::vector<T>& values, const std::vector<Count>& degrees);
+
+  // The same, but taking pointers to the data, so that the payloads and
+  // childCounts recorded by traverseLevelsDetailed on another tree can be
+  // passed straight back in. The data is copied from the pointers after
+  // this tree is cleared, so they mustn't point into this tree.
+  template <typename Count>
+  void fromLevelOrder(const std::vector<const T*>& payloads, const std::vector<Count>& degrees);
+
+  // Move every node into one fresh contiguous block, laid out in the given
+  // order, and free the old nodes. After a long run of addChild and
+  // deleteSubtree calls the nodes end up scattered around the heap, and
+  // this restores the memory locality that traversals depend on. The
+  // tree's contents, including null child slots, stay the same.
+  //   compactChildArrays: also give every node a freshly allocated,
+  // exactly sized childrenPtrs array, allocated in the same order as the
+  // nodes. Otherwise the existing arrays are kept as they are.
+  //   remap: called as remap(oldNode, newNode) for every node before the
+  // old node is destroyed, so that code holding on to node pointers can
+  // update them. (The old node's data has already been moved out by then.)
+  // Every node pointer into the tree is invalid afterward.
+  template <typename Remap>
+  void defragment(TreeOrder order, bool compactChildArrays, Remap remap);
+
+  void defragment(TreeOrder order = TreeOrder::BREADTH_FIRST, bool compactChildArrays = true) {
+    defragment(order, compactChildArrays, [](const TreeNode*, TreeNode*) {});
+  }
+
+  // For moving nodes between trees without copying them (see mergeInto in
+  // TreeMerge.h): after subtrees of other have been relinked into this
+  // tree, and their old child slots in other set to null, call this to
+  // destroy whatever is left of other. The moved nodes stay valid: this
+  // tree takes over other's node blocks, so nodes that live in them keep
+  // their memory. Other is left empty.
+  //   A placeholder's key only means something to the child loader of the
+  // tree it came from, so moved placeholders are loaded here, with other's
+  // loader, along with any placeholders that appear while loading them.
+  // For the same reason, moved nodes whose children were loaded lazily
+  // become ordinary nodes that can't be evicted. If a load fails, the
+  // exception is passed on after the rest of the work is done, and the
+  // placeholders that couldn't be loaded are moved over as they are.
+  void absorbRemainsOf(GenericTree& other);
+
 
   void compress();
 
+  // Same result as compress(), but each level of the tree is compacted in
+  // parallel across the thread pool. Worth it for very large trees.
+  void compressParallel(TreeThreadPool& pool = TreeThreadPool::shared());
+
+  // Same result as compress(), but safe to run while other threads are
+  // reading the tree, as long as each reader holds a ReadSection (below)
+  // while it looks at the tree. (This is a reader/writer lock, not a
+  // lock-free publish: a reader that doesn't hold a section races with the
+  // swaps and can see a freed array.) The compacted child arrays are all
+  // built first, without blocking anyone, since building them only reads
+  // the tree. They are then swapped in batchSize nodes at a time: each batch
+  // waits for the current readers to leave and holds new ones off only for
+  // the swaps themselves, which just exchange array pointers. Once a batch
+  // is in, no reader can still be looking at the arrays it replaced, so
+  // those are freed right away.
+  //   A reader always sees a node's whole old child array or its whole new
+  // one, never a torn one. A section that starts between two batches may
+  // find some nodes compacted and others not yet, which is still the same
+  // tree. (Only one thread may change the tree at a time, as usual.)
+  void compressConcurrent(std::size_t batchSize = 1024);
+
+  // ReadSection: Hold one of these while reading the tree from one thread
+  // at the same time as another thread runs compressConcurrent. Any number
+  // of readers can hold one at once, but every thread that reads the tree
+  // during compressConcurrent must. Node pointers and child arrays read
+  // during the section are only valid until it ends; child arrays may be
+  // replaced between sections.
+  //   Sections can't be nested: a thread that opens a second section while
+  // it holds one deadlocks if compressConcurrent is waiting at the gate in
+  // between, since the writer waits for the first section to end and the
+  // second waits for the writer.
+  class ReadSection {
+  public:
+    explicit ReadSection(const GenericTree& tree) {
+      // Pass through the gate first, so that a waiting compressConcurrent
+      // isn't starved by a steady stream of new readers.
+      std::lock_guard<std::mutex> gate(tree.publishGate);
+      lock = std::shared_lock<std::shared_timed_mutex>(tree.readersMutex);
+    }
+  private:
+    std::shared_lock<std::shared_timed_mutex> lock;
+  };
+
+  ReadSection readSection() const {
+    return ReadSection(*this);
+  }
+
   // Default constructor: Indicate that there is no root (empty tree).
-  GenericTree() : showDebugMessages(false), rootNodePtr(nullptr) {}
+  GenericTree() : showDebugMessages(false), rootNodePtr(nullptr), structureVersionCount(0), useClock(0) {}
 
   // Parameter constructor: Creates an empty tree, then adds a root node
   // with the provided data.
@@ -91,6 +345,9 @@ public:
     if (rootNodePtr) {
       throw std::runtime_error("clear() detected that deleteSubtree() had not reset rootNodePtr");
     }
+
+    // Every node is gone now, including any that lived in node blocks.
+    releaseNodeBlocks();
   }
 
   // Destructor
@@ -101,6 +358,86 @@ public:
   // Print the tree to the output stream (for example, std::cout) in a vertical text format
   std::ostream& Print(std::ostream& os) const;
 
+  // A number that changes every time the tree's structure is changed by one
+  // of this class's member functions. Indices built on top of the tree
+  // remember the version they were built from, and rebuild themselves when
+  // it no longer matches.
+  //   TreeNode::addChild can't see the tree that owns the node, so it can't
+  // update the version. After adding nodes that way, call
+  // markStructureChanged() before using any index built on the tree.
+  std::size_t structureVersion() const {
+    return structureVersionCount;
+  }
+
+  void markStructureChanged() {
+    structureVersionCount++;
+  }
+
+  // -----------------------------------------------------------------
+  // Lazy loading
+  // -----------------------------------------------------------------
+
+  // A node can be a placeholder whose children are only loaded the first
+  // time something asks for them, for example from a file offset stored as
+  // the placeholder's key. That keeps huge trees cheap when only a few
+  // branches are ever visited.
+  //
+  // Code that walks the tree should get children through childrenOf(node)
+  // instead of reading node->childrenPtrs directly, since that's what loads
+  // them. Print, TreeLayout (and so all of the indices) and
+  // traverseLevelsDetailed do this already. Loading isn't thread-safe, so
+  // call materializeAll() first before walking the tree from several
+  // threads at once. After that, childrenOf only reads the tree and bumps
+  // an atomic use stamp (for evictColdSubtrees), so concurrent walks are
+  // safe as long as nothing changes the tree meanwhile.
+
+  // Set the function that loads a placeholder's children. It should add
+  // them to the node (with addChild), and may make some of them
+  // placeholders in turn.
+  void setChildLoader(ChildLoader loader) {
+    childLoader = loader;
+  }
+
+  // Turn a node with no children into a placeholder, whose children will
+  // be loaded using the given key.
+  void makePlaceholder(TreeNode* node, std::uint64_t key) {
+    if (!node->childrenPtrs.empty()) {
+      throw std::runtime_error("Only a node with no children can become a placeholder");
+    }
+    node->childrenPending = true;
+    pendingKeys[node] = key;
+    markStructureChanged();
+  }
+
+  // Load a placeholder's children now, if it is one. A node whose children
+  // were loaded lazily is marked as used, for evictColdSubtrees. (This is
+  // const because it doesn't change the tree's logical contents.)
+  void materialize(const TreeNode* node) const;
+
+  // A node's children, loading them first if the node is a placeholder.
+  const std::vector<TreeNode*>& childrenOf(const TreeNode* node) const {
+    materialize(node);
+    return node->childrenPtrs;
+  }
+
+  // Load every placeholder in the tree, including ones that appear while
+  // loading.
+  void materializeAll() const;
+
+  // Drop the children of a lazily loaded node, turning it back into a
+  // placeholder with its original key.
+  void evict(TreeNode* node);
+
+  // Evict the least recently used lazily loaded nodes until at most
+  // keepCount remain loaded, for use under memory pressure. Returns how
+  // many nodes were evicted.
+  std::size_t evictColdSubtrees(std::size_t keepCount);
+
+  // The number of nodes whose children are currently loaded lazily.
+  std::size_t lazilyLoadedCount() const {
+    return loadedRecords.size();
+  }
+
 };
 
 // Operator overload that allows stream output syntax
@@ -111,6 +448,110 @@ std::ostream& operator<<(std::ostream& os, const GenericTree<T>& tree) {
 
 
 
+// -------------------------------------------------------------------
+// Text rendering helpers shared by Print and the other tree printers
+// -------------------------------------------------------------------
+
+// Every node in the vertical text format is displayed as two rows. For
+// example, a node with data "X" whose margin has a running stem on the
+// left would look like this:
+//
+//   |  |
+//   |  |_ X
+//
+// The part of the margin to the left of the node's own stem only depends on
+// the node's ancestors: each ancestor that still has siblings coming below
+// it leaves a "|  " running down, and each last child leaves "   " instead.
+// So we can keep that part of the margin as a plain string prefix, which
+// grows by three characters per level as we descend. (The root is the one
+// exception: it is displayed as a single row with no margin at all.)
+
+// The data items themselves are formatted with appendTreeData, which is
+// customizable per data type (see TreeFormatter in TreeFormat.h).
+
+// appendTreeNodeLines: Appends the rows that display one node, given the
+// margin prefix inherited from its ancestors. A null dataPtr displays a
+// null child slot.
+template <typename T>
+void appendTreeNodeLines(std::string& out, const std::string& linePrefix, bool isTreeRoot, const T* dataPtr) {
+  if (!isTreeRoot) {
+    out += linePrefix;
+    out += "|\n";
+    out += linePrefix;
+    out += "|_ ";
+  }
+  if (dataPtr) {
+    appendTreeData(out, *dataPtr);
+  }
+  else {
+    out += "[null]";
+  }
+  out += '\n';
+}
+
+// renderTreeLines: Appends the display text for the whole subtree rooted at
+// subtreeRoot to the buffer, in the same format as GenericTree::Print.
+//   linePrefix: the margin inherited from the subtree root's ancestors.
+//   isTreeRoot: whether subtreeRoot is the root of the entire tree.
+//   isLastChild: whether subtreeRoot is the rightmost child of its parent.
+//   flushTo: if not null, the buffer is written out to this stream and
+//     emptied whenever it gets large, so that huge trees don't have to fit
+//     in memory as text.
+// The node type N only needs "data" and an indexable "childrenPtrs", so the
+// same function works for other tree representations too.
+template <typename N>
+void renderTreeLines(std::string& out, N* subtreeRoot, const std::string& linePrefix,
+  bool isTreeRoot, bool isLastChild, std::ostream* flushTo) {
+
+  // Flush the buffer when it grows past this many bytes.
+  constexpr std::size_t FLUSH_SIZE = 1 << 20;
+
+  // Each entry to explore remembers how long the margin prefix should be for
+  // it. Because this is a depth-first walk, shortening the shared prefix
+  // string back to that length always restores the right ancestor margin.
+  struct PendingNode {
+    N* node;
+    std::size_t prefixLength;
+    bool isLast;
+    bool isRoot;
+  };
+
+  std::string prefix = linePrefix;
+  std::stack<PendingNode> nodesToExplore;
+  nodesToExplore.push(PendingNode{subtreeRoot, prefix.size(), isLastChild, isTreeRoot});
+
+  while (!nodesToExplore.empty()) {
+
+    PendingNode cur = nodesToExplore.top();
+    nodesToExplore.pop();
+
+    prefix.resize(cur.prefixLength);
+    appendTreeNodeLines(out, prefix, cur.isRoot, cur.node ? &cur.node->data : nullptr);
+
+    if (flushTo && out.size() >= FLUSH_SIZE) {
+      flushTo->write(out.data(), out.size());
+      out.clear();
+    }
+
+    if (!cur.node) continue;
+
+    const auto& children = cur.node->childrenPtrs;
+    std::size_t childCount = children.size();
+    if (0 == childCount) continue;
+
+    // The children's margin is this node's margin plus the stem that trails
+    // below this node (blank if this node is the last child).
+    if (!cur.isRoot) {
+      prefix += cur.isLast ? "   " : "|  ";
+    }
+
+    // Push in reverse so that the leftmost child is explored first.
+    for (std::size_t i = childCount; i > 0; i--) {
+      nodesToExplore.push(PendingNode{children[i-1], prefix.size(), i == childCount, false});
+    }
+  }
+}
+
 template <typename T>
 typename GenericTree<T>::TreeNode* GenericTree<T>::createRoot(const T& rootData) {
   
@@ -129,6 +570,7 @@ typename GenericTree<T>::TreeNode* GenericTree<T>::createRoot(const T& rootData)
   }
 
   rootNodePtr = new TreeNode(rootData);
+  markStructureChanged();
 
   // Return a copy of the root node pointer.
   return rootNodePtr;
@@ -149,6 +591,14 @@ typename GenericTree<T>::TreeNode* GenericTree<T>::TreeNode::addChild(const T& c
   return newChildPtr;
 }
 
+template <typename T>
+typename GenericTree<T>::TreeNode* GenericTree<T>::TreeNode::addChild(T&& childData) {
+  TreeNode* newChildPtr = new TreeNode(std::move(childData));
+  newChildPtr->parentPtr = this;
+  childrenPtrs.push_back(newChildPtr);
+  return newChildPtr;
+}
+
 template <typename T>
 void GenericTree<T>::deleteSubtree(TreeNode* targetRoot) {
 
@@ -229,7 +679,7 @@ void GenericTree<T>::deleteSubtree(TreeNode* targetRoot) {
       std::cerr << "Exploring node: ";
       if (curNode) {
         // if curNode isn't null, we can show what it contains
-        std::cerr << curNode->data << std::endl;
+        writeTreeData(std::cerr, curNode->data) << std::endl;
       }
       else {
         std::cerr << "[null]" << std::endl;
@@ -269,15 +719,29 @@ void GenericTree<T>::deleteSubtree(TreeNode* targetRoot) {
       std::cerr << "Deleting node: ";
       if (curNode) {
         // if curNode isn't null, we can show what it contains
-        std::cerr << curNode->data << std::endl;
+        writeTreeData(std::cerr, curNode->data) << std::endl;
       }
       else {
         std::cerr << "[null]" << std::endl;
       }
     }
 
-    // Delete the current node pointer.
-    delete curNode;
+    // Forget any lazy loading state for the node.
+    if (curNode->childrenPending) {
+      pendingKeys.erase(curNode);
+    }
+    if (curNode->lazyLoaded) {
+      loadedRecords.erase(curNode);
+    }
+
+    // Delete the current node pointer. A node from a node block is only
+    // destroyed here; its memory goes back when the block is released.
+    if (curNode->arenaOwned) {
+      curNode->~TreeNode();
+    }
+    else {
+      delete curNode;
+    }
 
     curNode = nullptr;
 
@@ -290,9 +754,66 @@ void GenericTree<T>::deleteSubtree(TreeNode* targetRoot) {
     rootNodePtr = nullptr;
   }
 
+  markStructureChanged();
+
   return;
 }
 
+template <typename T>
+void GenericTree<T>::reroot(TreeNode* newRoot) {
+
+  if (!newRoot) {
+    throw std::runtime_error("Tried to reroot at a null node");
+  }
+
+  // The path from the new root up to the old one.
+  std::vector<TreeNode*> path;
+  for (TreeNode* cur = newRoot; cur; cur = cur->parentPtr) {
+    path.push_back(cur);
+  }
+  if (path.back() != rootNodePtr) {
+    throw std::runtime_error("Tried to reroot at a node from a different tree");
+  }
+  if (1 == path.size()) return;
+
+  // Find where each path node is listed under its parent before changing
+  // anything, so a malformed tree is reported with the tree untouched.
+  std::vector<std::size_t> slots(path.size());
+  for (std::size_t i = 1; i < path.size(); i++) {
+    const std::vector<TreeNode*>& siblings = path[i]->childrenPtrs;
+    slots[i] = std::find(siblings.begin(), siblings.end(), path[i-1]) - siblings.begin();
+    if (slots[i] == siblings.size()) {
+      throw std::runtime_error("Node on the reroot path was not listed as a child of its parent");
+    }
+  }
+
+  // The new root gains a child, so a placeholder has to be loaded first.
+  // The nodes on the path no longer have the children that were loaded for
+  // them, so they stop being evictable.
+  materialize(newRoot);
+  for (TreeNode* node : path) {
+    if (node->lazyLoaded) {
+      loadedRecords.erase(node);
+      node->lazyLoaded = false;
+    }
+  }
+
+  // Only the new root ends up with an extra child; every other path node
+  // loses one child before gaining one. So once there's room here, nothing
+  // below can throw.
+  newRoot->childrenPtrs.reserve(newRoot->childrenPtrs.size() + 1);
+  for (std::size_t i = 1; i < path.size(); i++) {
+    std::vector<TreeNode*>& siblings = path[i]->childrenPtrs;
+    siblings.erase(siblings.begin() + slots[i]);
+    path[i-1]->childrenPtrs.push_back(path[i]);
+    path[i]->parentPtr = path[i-1];
+  }
+  newRoot->parentPtr = nullptr;
+  rootNodePtr = newRoot;
+
+  markStructureChanged();
+}
+
 template <typename T>
 void GenericTree<T>::compress() {
 
@@ -334,164 +855,555 @@ void GenericTree<T>::compress() {
     frontNode->childrenPtrs.swap(compressedChildrenPtrs);
   }
 
+  markStructureChanged();
 }
 
 template <typename T>
-std::ostream& GenericTree<T>::Print(std::ostream& os) const {
+void GenericTree<T>::compressParallel(TreeThreadPool& pool) {
 
+  if (!rootNodePtr) return;
 
-  const TreeNode* rootNodePtr = this->rootNodePtr;
+  // Below this many nodes in a level, it's cheaper to just do the work here.
+  constexpr std::size_t SERIAL_LEVEL_LIMIT = 4096;
+  // How many frontier nodes each parallel chunk handles.
+  constexpr std::size_t CHUNK_SIZE = 1024;
 
-  // Now that the pointer is const, if we tried to do this, the compiler
-  // would give an error and stop us:
-  // rootNodePtr->data = "This won't compile";
+  // We process the tree one BFS level at a time. The frontier holds all of
+  // the (non-null) nodes at the current depth.
+  std::vector<TreeNode*> frontier;
+  frontier.push_back(rootNodePtr);
 
-  // Base case: When the tree is empty
-  if (nullptr == rootNodePtr) {
-    return os << "[empty tree]" << std::endl;
+  while (!frontier.empty()) {
+
+    if (frontier.size() < SERIAL_LEVEL_LIMIT) {
+      std::vector<TreeNode*> nextFrontier;
+      for (TreeNode* node : frontier) {
+        auto& kids = node->childrenPtrs;
+        kids.erase(std::remove(kids.begin(), kids.end(), nullptr), kids.end());
+        nextFrontier.insert(nextFrontier.end(), kids.begin(), kids.end());
+      }
+      frontier.swap(nextFrontier);
+      continue;
+    }
+
+    // Each chunk compacts its own nodes' child arrays (no two chunks touch
+    // the same node) and collects the children it found, in order.
+    std::size_t chunkCount = (frontier.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    std::vector< std::vector<TreeNode*> > chunkChildren(chunkCount);
+
+    pool.parallelFor(frontier.size(), [&](std::size_t begin, std::size_t end) {
+      std::vector<TreeNode*>& found = chunkChildren[begin / CHUNK_SIZE];
+      for (std::size_t i = begin; i < end; i++) {
+        auto& kids = frontier[i]->childrenPtrs;
+        kids.erase(std::remove(kids.begin(), kids.end(), nullptr), kids.end());
+        found.insert(found.end(), kids.begin(), kids.end());
+      }
+    }, CHUNK_SIZE);
+
+    // Stitch the chunks back together so the next level stays in BFS order.
+    std::size_t nextSize = 0;
+    for (const auto& found : chunkChildren) {
+      nextSize += found.size();
+    }
+    std::vector<TreeNode*> nextFrontier;
+    nextFrontier.reserve(nextSize);
+    for (const auto& found : chunkChildren) {
+      nextFrontier.insert(nextFrontier.end(), found.begin(), found.end());
+    }
+    frontier.swap(nextFrontier);
   }
 
-  // Our stack of nodes that still need to be explored and printed
-  std::stack<const TreeNode*> nodesToExplore;
+  markStructureChanged();
+}
+
+template <typename T>
+void GenericTree<T>::compressConcurrent(std::size_t batchSize) {
+
+  if (!rootNodePtr) return;
+  if (0 == batchSize) batchSize = 1;
+
+  // Build the compacted arrays. Readers only read, so this needs no lock.
+  // Nodes without a null child slot are already compact and are skipped.
+  struct Replacement {
+    TreeNode* node;
+    std::vector<TreeNode*> childrenPtrs;
+  };
+  std::vector<Replacement> replacements;
+  std::queue<TreeNode*> nodesToExplore;
   nodesToExplore.push(rootNodePtr);
+  while (!nodesToExplore.empty()) {
+    TreeNode* frontNode = nodesToExplore.front();
+    nodesToExplore.pop();
+    std::size_t liveCount = 0;
+    for (TreeNode* childPtr : frontNode->childrenPtrs) {
+      if (childPtr) {
+        nodesToExplore.push(childPtr);
+        liveCount++;
+      }
+    }
+    if (liveCount != frontNode->childrenPtrs.size()) {
+      std::vector<TreeNode*> compressedChildrenPtrs;
+      compressedChildrenPtrs.reserve(liveCount);
+      for (TreeNode* childPtr : frontNode->childrenPtrs) {
+        if (childPtr) compressedChildrenPtrs.push_back(childPtr);
+      }
+      replacements.push_back(Replacement{frontNode, std::move(compressedChildrenPtrs)});
+    }
+  }
 
-  // We'll have a depth number associated with every node we find.
-  // Begin tracking the current depth at 0.
-  std::stack<int> depthStack;
-  depthStack.push(0);
+  // Publish them a batch at a time. Taking the lock exclusively waits out
+  // every reader that might still be using the old arrays, and after the
+  // swap each replacement holds its node's old array, which is freed when
+  // the batch's replacements are cleared, outside the lock.
+  for (std::size_t begin = 0; begin < replacements.size(); begin += batchSize) {
+    std::size_t end = std::min(begin + batchSize, replacements.size());
+    {
+      std::lock_guard<std::mutex> gate(publishGate);
+      std::unique_lock<std::shared_timed_mutex> lock(readersMutex);
+      for (std::size_t i = begin; i < end; i++) {
+        replacements[i].node->childrenPtrs.swap(replacements[i].childrenPtrs);
+      }
+    }
+    for (std::size_t i = begin; i < end; i++) {
+      std::vector<TreeNode*>().swap(replacements[i].childrenPtrs);
+    }
+  }
 
-  std::stack< std::vector<bool> > curMarginStack;
-  // Begin with no margin for depth 0.
-  curMarginStack.push( std::vector<bool>() );
-  // Each node's margin graphics will be based on the trailing lines that
-  // are still running parallel in the margin.
-  std::stack< std::vector<bool> > trailingMarginStack;
-  trailingMarginStack.push( std::vector<bool>() );
+  std::lock_guard<std::mutex> gate(publishGate);
+  std::unique_lock<std::shared_timed_mutex> lock(readersMutex);
+  markStructureChanged();
+}
 
- 
+template <typename T>
+template <typename Count>
+void GenericTree<T>::fromLevelOrder(const std::vector<T>& values, const std::vector<Count>& degrees) {
+  buildFromLevelOrder(values.size(), [&values](std::size_t i) -> const T& { return values[i]; }, degrees);
+}
 
-  while (!nodesToExplore.empty()) {
+template <typename T>
+template <typename Count>
+void GenericTree<T>::fromLevelOrder(const std::vector<const T*>& payloads, const std::vector<Count>& degrees) {
+  buildFromLevelOrder(payloads.size(), [&payloads](std::size_t i) -> const T& { return *payloads[i]; }, degrees);
+}
 
-    // Get a copy of the top pointer on the explore stack.
-    const TreeNode* curNode = nodesToExplore.top();
+template <typename T>
+template <typename ValueAt, typename Count>
+void GenericTree<T>::buildFromLevelOrder(std::size_t n, ValueAt valueAt, const std::vector<Count>& degrees) {
 
-    // Now that we've retrieved the top pointer, we can pop it from the explore stack.
-    nodesToExplore.pop();
+  clear();
+  if (degrees.size() != n) {
+    throw std::runtime_error("fromLevelOrder needs exactly one degree per value");
+  }
+  if (0 == n) {
+    markStructureChanged();
+    return;
+  }
 
-    // Pop the current depth for the node being explored.
-    int curDepth = depthStack.top();
-    depthStack.pop();
+  // Check the shape before allocating anything. In level order, node i's
+  // children are the next degrees[i] nodes not yet claimed by an earlier
+  // node, so every node must have been claimed before its own turn comes,
+  // and the children must run out exactly at the end.
+  std::size_t nextChild = 1;
+  for (std::size_t i = 0; i < n; i++) {
+    if (i >= nextChild) {
+      throw std::runtime_error("fromLevelOrder was given degrees that leave a node without a parent");
+    }
+    if (static_cast<std::size_t>(degrees[i]) > n - nextChild) {
+      throw std::runtime_error("fromLevelOrder was given degrees that need more nodes than there are values");
+    }
+    nextChild += static_cast<std::size_t>(degrees[i]);
+  }
+  if (nextChild != n) {
+    throw std::runtime_error("fromLevelOrder was given degrees that don't use every value");
+  }
 
-    // Pop the current and trailing margin graphic flags for this node.
-    std::vector<bool> curMargin = curMarginStack.top();
-    curMarginStack.pop();
-    std::vector<bool> trailingMargin = trailingMarginStack.top();
-    trailingMarginStack.pop();
+  // Construct the nodes in place, and link each node to its children,
+  // which are a contiguous run of the block. If anything throws partway,
+  // the nodes made so far are destroyed again before passing the error on.
+  TreeNode* nodes = allocateNodeBlock(n);
+  std::size_t constructed = 0;
+  try {
+    for (; constructed < n; constructed++) {
+      new (&nodes[constructed]) TreeNode(valueAt(constructed));
+      nodes[constructed].arenaOwned = true;
+    }
 
-    if (showDebugMessages) {
-      // Simplified numerical output for debugging.
-      os << "Depth: " << curDepth;
-      std::cerr << " Data: ";
-      if (curNode) {
-        // if curNode isn't null, we can show what it contains
-        std::cerr << curNode->data << std::endl;
-      }
-      else {
-        std::cerr << "[null]" << std::endl;
+    nextChild = 1;
+    for (std::size_t i = 0; i < n; i++) {
+      std::size_t degree = static_cast<std::size_t>(degrees[i]);
+      auto& children = nodes[i].childrenPtrs;
+      children.resize(degree);
+      for (std::size_t k = 0; k < degree; k++) {
+        TreeNode* child = &nodes[nextChild++];
+        child->parentPtr = &nodes[i];
+        children[k] = child;
       }
     }
-    else {
+  }
+  catch (...) {
+    while (constructed > 0) {
+      nodes[--constructed].~TreeNode();
+    }
+    releaseNodeBlocks();
+    throw;
+  }
 
+  rootNodePtr = &nodes[0];
+  markStructureChanged();
+}
+
+template <typename T>
+template <typename Remap>
+void GenericTree<T>::defragment(TreeOrder order, bool compactChildArrays, Remap remap) {
 
-      constexpr int LAST_ROW = 2;
-
-      for (int row = 1; row<=LAST_ROW; row++) {
-        // Iterate forward through the margin display flags to fill in the margin.
-        for (auto stemIt = curMargin.begin(); stemIt != curMargin.end(); stemIt++) {
-
-          bool showStem = *stemIt;
-          std::string stemSymbol = "|";
-          if (!showStem) {
-            stemSymbol = " ";
-          }
-
-          bool isLastCol = false;
-          if (stemIt + 1 == curMargin.end()) {
-            isLastCol = true;
-          }
-
-          if (isLastCol) {
-            if (LAST_ROW==row) {
-              // The stem before the data item should always be "|_ " in effect:
-              os << stemSymbol << "_ ";
-            }
-            else if (showStem) {
-              // Display a stem and a newline
-              os << stemSymbol << std::endl;
-            }
-            else {
-              // Don't bother displaying trailing spaces before the newline
-              os << std::endl;
-            }
-          }
-          else {
-            // Display a stem (or a blank) and some padding spaces
-            os << stemSymbol << "  ";
-          }
-
-          // Bottom of loop for margin stems
-        }
-
-        // Bottom of loop for multi-row display
+  if (!rootNodePtr) return;
+
+  // List the nodes in their new order.
+  std::vector<TreeNode*> oldNodes;
+  if (TreeOrder::BREADTH_FIRST == order) {
+    // The list doubles as the queue.
+    oldNodes.push_back(rootNodePtr);
+    for (std::size_t next = 0; next < oldNodes.size(); next++) {
+      for (TreeNode* childPtr : oldNodes[next]->childrenPtrs) {
+        if (childPtr) oldNodes.push_back(childPtr);
+      }
+    }
+  }
+  else {
+    std::stack<TreeNode*> nodesToExplore;
+    nodesToExplore.push(rootNodePtr);
+    while (!nodesToExplore.empty()) {
+      TreeNode* curNode = nodesToExplore.top();
+      nodesToExplore.pop();
+      oldNodes.push_back(curNode);
+      for (auto it = curNode->childrenPtrs.rbegin(); it != curNode->childrenPtrs.rend(); it++) {
+        if (*it) nodesToExplore.push(*it);
+      }
+    }
+  }
+  const std::size_t n = oldNodes.size();
+
+  // Do everything that can fail before the old tree is touched: allocate
+  // the block, the new child arrays and the lazy loading entries for the
+  // new nodes, and then construct the new nodes. The data is only moved if
+  // moving it can't throw, and otherwise it's copied, so if anything fails,
+  // what was made so far is thrown away and the tree is left as it was.
+  nodeBlocks.reserve(nodeBlocks.size() + 1);
+  std::vector< std::vector<TreeNode*> > newChildArrays(compactChildArrays ? n : 0);
+  for (std::size_t i = 0; i < newChildArrays.size(); i++) {
+    newChildArrays[i].reserve(oldNodes[i]->childrenPtrs.size());
+  }
+  TreeNode* nodes = std::allocator<TreeNode>().allocate(n);
+  std::size_t constructed = 0;
+  try {
+    for (std::size_t i = 0; i < n; i++) {
+      if (oldNodes[i]->childrenPending) {
+        pendingKeys.emplace(&nodes[i], pendingKeys.at(oldNodes[i]));
+      }
+      if (oldNodes[i]->lazyLoaded) {
+        loadedRecords.emplace(&nodes[i], loadedRecords.at(oldNodes[i]));
       }
+    }
+    for (; constructed < n; constructed++) {
+      new (&nodes[constructed]) TreeNode(std::move_if_noexcept(oldNodes[constructed]->data));
+    }
+  }
+  catch (...) {
+    while (constructed > 0) {
+      nodes[--constructed].~TreeNode();
+    }
+    for (std::size_t i = 0; i < n; i++) {
+      pendingKeys.erase(&nodes[i]);
+      loadedRecords.erase(&nodes[i]);
+    }
+    std::allocator<TreeNode>().deallocate(nodes, n);
+    throw;
+  }
 
-      if (curNode) {
-        os << curNode->data << std::endl;
+  // Nothing below can throw (except remap).
+  for (std::size_t i = 0; i < n; i++) {
+    nodes[i].arenaOwned = true;
+    nodes[i].childrenPending = oldNodes[i]->childrenPending;
+    nodes[i].lazyLoaded = oldNodes[i]->lazyLoaded;
+  }
+
+  // Each old node's parentPtr isn't needed anymore, so it's reused to point
+  // forward to the node's new home. Then each new node can translate its
+  // old children's addresses by reading their forwarding pointers.
+  for (std::size_t i = 0; i < n; i++) {
+    oldNodes[i]->parentPtr = &nodes[i];
+  }
+  for (std::size_t i = 0; i < n; i++) {
+    auto& oldChildren = oldNodes[i]->childrenPtrs;
+    auto& newChildren = nodes[i].childrenPtrs;
+    if (compactChildArrays) {
+      // The array has room for every child already.
+      newChildren.swap(newChildArrays[i]);
+      for (TreeNode* childPtr : oldChildren) {
+        newChildren.push_back(childPtr ? childPtr->parentPtr : nullptr);
       }
-      else {
-        os << "[null]" << std::endl;;
+    }
+    else {
+      newChildren.swap(oldChildren);
+      for (TreeNode*& childPtr : newChildren) {
+        if (childPtr) childPtr = childPtr->parentPtr;
       }
+    }
+    for (TreeNode* childPtr : newChildren) {
+      if (childPtr) childPtr->parentPtr = &nodes[i];
+    }
+  }
+
+  for (std::size_t i = 0; i < n; i++) {
+    remap(static_cast<const TreeNode*>(oldNodes[i]), &nodes[i]);
+  }
 
+  // The new nodes' lazy loading entries are already in place.
+  for (std::size_t i = 0; i < n; i++) {
+    pendingKeys.erase(oldNodes[i]);
+    loadedRecords.erase(oldNodes[i]);
+  }
+
+  // Free the old nodes. Every node that was still alive has been moved, so
+  // all of the old node blocks can go too.
+  for (TreeNode* oldNode : oldNodes) {
+    if (oldNode->arenaOwned) {
+      oldNode->~TreeNode();
     }
+    else {
+      delete oldNode;
+    }
+  }
+  releaseNodeBlocks();
+  nodeBlocks.push_back(NodeBlock{nodes, n});
 
-    // If this node is non-null and has any children...
-    if (curNode && curNode->childrenPtrs.size() > 0) {
+  rootNodePtr = &nodes[0];
+  markStructureChanged();
+}
 
- 
-      for (auto it = curNode->childrenPtrs.rbegin(); it != curNode->childrenPtrs.rend(); it++) {
-        
-     
-        const TreeNode* childPtr = *it;
+template <typename T>
+void GenericTree<T>::absorbRemainsOf(GenericTree& other) {
 
-        // Now, push the child pointer onto the stack of children to explore.
-        nodesToExplore.push(childPtr);
-        
-        // Record the depth that corresponds to the child node.
-        depthStack.push(curDepth+1);
-        
-        // Prepare a working copy of the margin for the node we're pushing.
-        auto nextMargin = trailingMargin;
-        // All nodes get an extra stem glyph next to their printout.
-        nextMargin.push_back(true);
-        curMarginStack.push(nextMargin);
-        
-        // But for the trailing margin, we need to leave the rightmost child
-        // with a blank trailing in the margin, because it's displayed lowest.
-        auto nextTrailingMargin = trailingMargin;
-        if (curNode->childrenPtrs.rbegin() == it) {
-          // This is the rightmost child. Leave a blank trailing.
-          nextTrailingMargin.push_back(false);
-        }
-        else {
-          // Other children leave a vertical stem symbol trailing in the margin.
-          nextTrailingMargin.push_back(true);
-        }
-        trailingMarginStack.push(nextTrailingMargin);
+  if (&other == this) {
+    throw std::runtime_error("A tree can't absorb itself");
+  }
 
+  // Take the blocks first, so that clearing other only destroys its
+  // remaining block nodes without freeing the memory under the moved ones.
+  nodeBlocks.insert(nodeBlocks.end(), other.nodeBlocks.begin(), other.nodeBlocks.end());
+  other.nodeBlocks.clear();
+  other.clear();
+  markStructureChanged();
+
+  // Clearing forgot the lazy loading state of every node it destroyed, so
+  // whatever is left belongs to moved nodes. Load the moved placeholders
+  // while other's loader is still at hand.
+  std::exception_ptr loadError;
+  try {
+    while (!other.pendingKeys.empty()) {
+      other.materialize(other.pendingKeys.begin()->first);
+    }
+  }
+  catch (...) {
+    loadError = std::current_exception();
+  }
+  pendingKeys.insert(other.pendingKeys.begin(), other.pendingKeys.end());
+  other.pendingKeys.clear();
+
+  for (const auto& entry : other.loadedRecords) {
+    const_cast<TreeNode*>(entry.first)->lazyLoaded = false;
+  }
+  other.loadedRecords.clear();
+
+  if (loadError) {
+    std::rethrow_exception(loadError);
+  }
+}
+
+template <typename T>
+void GenericTree<T>::materialize(const TreeNode* node) const {
+
+  if (!node->childrenPending) {
+    if (node->lazyLoaded) {
+      // Only a lookup and an atomic store, so this doesn't race with
+      // other threads doing the same.
+      loadedRecords.find(node)->second.lastUse.store(++useClock, std::memory_order_relaxed);
+    }
+    return;
+  }
+  if (!childLoader) {
+    throw std::runtime_error("Tried to load a placeholder's children with no child loader set");
+  }
+
+  // The loader adds children, which is a change to the node but not to
+  // what the tree logically contains.
+  TreeNode* target = const_cast<TreeNode*>(node);
+  GenericTree* self = const_cast<GenericTree*>(this);
+  std::uint64_t key = pendingKeys[node];
+  pendingKeys.erase(node);
+  target->childrenPending = false;
+
+  try {
+    childLoader(target, key);
+  }
+  catch (...) {
+    // Undo a partial load, so the node is a placeholder again. The node
+    // may have been moved into another tree by now (see absorbRemainsOf),
+    // so its children are destroyed directly rather than with
+    // deleteSubtree, which would refuse them.
+    for (TreeNode* childPtr : target->childrenPtrs) {
+      self->destroyUnlinkedSubtree(childPtr);
+    }
+    target->childrenPtrs.clear();
+    target->childrenPending = true;
+    pendingKeys[node] = key;
+    throw;
+  }
+
+  target->lazyLoaded = true;
+  loadedRecords.emplace(node, LoadedRecord(key, ++useClock));
+  structureVersionCount++;
+}
+
+template <typename T>
+void GenericTree<T>::destroyUnlinkedSubtree(TreeNode* subtreeRoot) {
+  std::vector<TreeNode*> nodesToDestroy{subtreeRoot};
+  while (!nodesToDestroy.empty()) {
+    TreeNode* curNode = nodesToDestroy.back();
+    nodesToDestroy.pop_back();
+    if (!curNode) continue;
+    nodesToDestroy.insert(nodesToDestroy.end(), curNode->childrenPtrs.begin(), curNode->childrenPtrs.end());
+
+    if (curNode->childrenPending) {
+      pendingKeys.erase(curNode);
+    }
+    if (curNode->lazyLoaded) {
+      loadedRecords.erase(curNode);
+    }
+    if (curNode->arenaOwned) {
+      curNode->~TreeNode();
+    }
+    else {
+      delete curNode;
+    }
+  }
+}
+
+template <typename T>
+void GenericTree<T>::materializeAll() const {
+  if (!rootNodePtr || pendingKeys.empty()) return;
+  std::stack<const TreeNode*> nodesToExplore;
+  nodesToExplore.push(rootNodePtr);
+  while (!nodesToExplore.empty()) {
+    const TreeNode* curNode = nodesToExplore.top();
+    nodesToExplore.pop();
+    for (const TreeNode* childPtr : childrenOf(curNode)) {
+      if (childPtr) nodesToExplore.push(childPtr);
+    }
+  }
+}
+
+template <typename T>
+void GenericTree<T>::evict(TreeNode* node) {
+  if (!node->lazyLoaded) {
+    throw std::runtime_error("Tried to evict a node whose children weren't loaded lazily");
+  }
+  std::uint64_t key = loadedRecords.at(node).key;
+
+  // Deleting the children also forgets any lazy loading state below them.
+  for (TreeNode* childPtr : node->childrenPtrs) {
+    if (childPtr) deleteSubtree(childPtr);
+  }
+  node->childrenPtrs.clear();
+  node->childrenPtrs.shrink_to_fit();
+  node->lazyLoaded = false;
+  loadedRecords.erase(node);
+  makePlaceholder(node, key);
+}
+
+template <typename T>
+std::size_t GenericTree<T>::evictColdSubtrees(std::size_t keepCount) {
+  if (loadedRecords.size() <= keepCount) return 0;
+
+  // Oldest first.
+  std::vector< std::pair<std::uint64_t, const TreeNode*> > byLastUse;
+  byLastUse.reserve(loadedRecords.size());
+  for (const auto& entry : loadedRecords) {
+    byLastUse.push_back(std::make_pair(entry.second.lastUse.load(), entry.first));
+  }
+  std::sort(byLastUse.begin(), byLastUse.end());
+
+  std::size_t evicted = 0;
+  for (const auto& entry : byLastUse) {
+    if (loadedRecords.size() <= keepCount) break;
+    // Evicting an ancestor earlier may have deleted this node already.
+    if (!loadedRecords.count(entry.second)) continue;
+    evict(const_cast<TreeNode*>(entry.second));
+    evicted++;
+  }
+  return evicted;
+}
+
+template <typename T>
+std::ostream& GenericTree<T>::Print(std::ostream& os) const {
+
+
+  const TreeNode* rootNodePtr = this->rootNodePtr;
+
+  // Now that the pointer is const, if we tried to do this, the compiler
+  // would give an error and stop us:
+  // rootNodePtr->data = "This won't compile";
+
+  // Base case: When the tree is empty
+  if (nullptr == rootNodePtr) {
+    return os << "[empty tree]" << std::endl;
+  }
+
+  // Every node is displayed, so every placeholder has to be loaded first.
+  materializeAll();
+
+  if (showDebugMessages) {
+
+    // Simplified numerical output for debugging: a preorder walk that shows
+    // the depth of every node along with its data.
+    std::stack<const TreeNode*> nodesToExplore;
+    nodesToExplore.push(rootNodePtr);
+    std::stack<int> depthStack;
+    depthStack.push(0);
+
+    while (!nodesToExplore.empty()) {
+      const TreeNode* curNode = nodesToExplore.top();
+      nodesToExplore.pop();
+      int curDepth = depthStack.top();
+      depthStack.pop();
+
+      os << "Depth: " << curDepth;
+      std::cerr << " Data: ";
+      if (curNode) {
+        // if curNode isn't null, we can show what it contains
+        writeTreeData(std::cerr, curNode->data) << std::endl;
+      }
+      else {
+        std::cerr << "[null]" << std::endl;
+        continue;
+      }
+
+      // Push the children in reverse so the leftmost one is explored first.
+      for (auto it = curNode->childrenPtrs.rbegin(); it != curNode->childrenPtrs.rend(); it++) {
+        nodesToExplore.push(*it);
+        depthStack.push(curDepth+1);
       }
     }
 
+    return os;
   }
 
+  // The text is built up in a large character buffer and handed to the
+  // stream in big pieces, instead of making many small stream writes for
+  // every margin stem and every line.
+  std::string buffer;
+  renderTreeLines(buffer, rootNodePtr, std::string(), true, true, &os);
+  os.write(buffer.data(), buffer.size());
+
   return os;
 }
@@ -0,0 +1,231 @@
+
+#pragma once
+
+#include <algorithm> // for std::swap
+#include <cstddef> // for std::size_t
+#include <limits> // for std::numeric_limits
+#include <stack> // for std::stack
+#include <stdexcept> // for std::runtime_error
+#include <utility> // for std::pair
+#include <vector> // for std::vector
+
+#include "GenericTree.h"
+#include "TreeLayout.h"
+#include "TreeThreadPool.h"
+
+// -------------------------------------------------------------------
+// Path aggregate queries with heavy-light decomposition
+// -------------------------------------------------------------------
+
+// The ways to combine data along a path. A combine functor needs an
+// identity() value and a call operator that merges two values. The merge
+// must be associative and commutative, since the pieces of a path are
+// visited in no particular order.
+template <typename T>
+struct PathSum {
+  T identity() const { return T(); }
+  T operator()(const T& a, const T& b) const { return a + b; }
+};
+
+template <typename T>
+struct PathMax {
+  T identity() const { return std::numeric_limits<T>::lowest(); }
+  T operator()(const T& a, const T& b) const { return (a < b) ? b : a; }
+};
+
+// HeavyLightIndex: Answers "combine all of the data on the path between two
+// nodes" (for example a sum or a max) in O(log^2 n) time, instead of walking
+// parentPtr links one step at a time.
+//
+// The idea of heavy-light decomposition: at each node, call the child with
+// the biggest subtree the "heavy" child. Following heavy children splits the
+// tree into chains, and laying each chain out contiguously in an array lets
+// a segment tree combine any stretch of a chain in O(log n). Whenever a path
+// leaves a chain through a light child, the subtree size at least halves,
+// so any path crosses only O(log n) chains.
+//
+// The index reads the data values when it is built. Use update() to change a
+// node's data afterward, so that the index stays in sync. The index is
+// rebuilt automatically on the next use after the tree's structureVersion()
+// changes.
+template <typename T, typename Combine = PathSum<T> >
+class HeavyLightIndex {
+public:
+  using TreeNode = typename GenericTree<T>::TreeNode;
+
+  explicit HeavyLightIndex(GenericTree<T>& tree, Combine combine = Combine())
+    : tree(tree), combine(combine), builtVersion(0), isBuilt(false) {}
+
+  // Rebuild now if the tree has changed since the index was built.
+  void refresh() {
+    if (!isBuilt || builtVersion != tree.structureVersion()) {
+      rebuild();
+    }
+  }
+
+  // Rebuild the whole index from the current tree.
+  void rebuild();
+
+  // Combine the data of every node on the path from the root down to node
+  // (including both ends).
+  T rootPathQuery(const TreeNode* node) {
+    refresh();
+    return queryPath(tree.getRootPtr(), node);
+  }
+
+  // Combine the data of every node on the path between two nodes (including
+  // both ends).
+  T pathQuery(const TreeNode* a, const TreeNode* b) {
+    refresh();
+    return queryPath(a, b);
+  }
+
+  // Answer many path queries at once, spread across the thread pool.
+  std::vector<T> pathQueries(const std::vector< std::pair<const TreeNode*, const TreeNode*> >& paths,
+    TreeThreadPool& pool = TreeThreadPool::shared());
+
+  // Change one node's data, in both the tree and the index.
+  void update(TreeNode* node, const T& newData);
+
+private:
+
+  // pathQuery without the refresh, so that the threads of pathQueries only
+  // ever read the index.
+  T queryPath(const TreeNode* a, const TreeNode* b) const;
+
+  std::size_t indexOf(const TreeNode* node) const {
+    std::size_t index = layout.indexOf(node);
+    if (TreeLayout<T>::NO_INDEX == index) {
+      throw std::runtime_error("HeavyLightIndex was given a node that isn't in its tree");
+    }
+    return index;
+  }
+
+  // Combine the segment tree leaves in [begin, end).
+  T rangeQuery(std::size_t begin, std::size_t end) const;
+
+  GenericTree<T>& tree;
+  Combine combine;
+  std::size_t builtVersion;
+  bool isBuilt;
+  TreeLayout<T> layout;
+  // For each node (by preorder index): the top node of its chain, and its
+  // position in the chain-ordered array.
+  std::vector<std::size_t> chainHeads;
+  std::vector<std::size_t> positions;
+  // An iterative segment tree: leaves are stored at [n, 2n).
+  std::vector<T> segments;
+};
+
+template <typename T, typename Combine>
+void HeavyLightIndex<T, Combine>::rebuild() {
+
+  layout.rebuild(tree);
+  const std::size_t n = layout.size();
+  chainHeads.assign(n, 0);
+  positions.assign(n, 0);
+  segments.assign(2 * n, combine.identity());
+  builtVersion = tree.structureVersion();
+  isBuilt = true;
+  if (0 == n) return;
+
+  // Walk the tree again so that each heavy child is visited right after its
+  // parent. That puts every chain in one contiguous run of positions.
+  std::stack<std::size_t> nodesToExplore;
+  nodesToExplore.push(0);
+  chainHeads[0] = 0;
+  std::size_t nextPosition = 0;
+
+  while (!nodesToExplore.empty()) {
+    std::size_t cur = nodesToExplore.top();
+    nodesToExplore.pop();
+    positions[cur] = nextPosition++;
+
+    // In preorder, the first child is at cur + 1 and each next sibling comes
+    // right after the previous sibling's subtree.
+    std::size_t heavy = TreeLayout<T>::NO_INDEX;
+    std::size_t end = cur + layout.subtreeSizes[cur];
+    for (std::size_t child = cur + 1; child < end; child += layout.subtreeSizes[child]) {
+      if (TreeLayout<T>::NO_INDEX == heavy || layout.subtreeSizes[child] > layout.subtreeSizes[heavy]) {
+        heavy = child;
+      }
+    }
+    for (std::size_t child = cur + 1; child < end; child += layout.subtreeSizes[child]) {
+      if (child != heavy) {
+        chainHeads[child] = child;
+        nodesToExplore.push(child);
+      }
+    }
+    // Pushed last, so it's explored next.
+    if (TreeLayout<T>::NO_INDEX != heavy) {
+      chainHeads[heavy] = chainHeads[cur];
+      nodesToExplore.push(heavy);
+    }
+  }
+
+  for (std::size_t i = 0; i < n; i++) {
+    segments[n + positions[i]] = layout.nodes[i]->data;
+  }
+  for (std::size_t i = n - 1; i > 0; i--) {
+    segments[i] = combine(segments[2 * i], segments[2 * i + 1]);
+  }
+}
+
+template <typename T, typename Combine>
+T HeavyLightIndex<T, Combine>::rangeQuery(std::size_t begin, std::size_t end) const {
+  const std::size_t n = layout.size();
+  T result = combine.identity();
+  for (begin += n, end += n; begin < end; begin /= 2, end /= 2) {
+    if (begin & 1) result = combine(result, segments[begin++]);
+    if (end & 1) result = combine(result, segments[--end]);
+  }
+  return result;
+}
+
+template <typename T, typename Combine>
+T HeavyLightIndex<T, Combine>::queryPath(const TreeNode* a, const TreeNode* b) const {
+
+  std::size_t u = indexOf(a);
+  std::size_t v = indexOf(b);
+  T result = combine.identity();
+
+  // Climb chain by chain, always from whichever chain head is deeper, until
+  // both nodes are on the same chain.
+  while (chainHeads[u] != chainHeads[v]) {
+    if (layout.depths[chainHeads[u]] < layout.depths[chainHeads[v]]) {
+      std::swap(u, v);
+    }
+    result = combine(result, rangeQuery(positions[chainHeads[u]], positions[u] + 1));
+    u = layout.parents[chainHeads[u]];
+  }
+
+  std::size_t begin = positions[u];
+  std::size_t end = positions[v];
+  if (begin > end) std::swap(begin, end);
+  return combine(result, rangeQuery(begin, end + 1));
+}
+
+template <typename T, typename Combine>
+std::vector<T> HeavyLightIndex<T, Combine>::pathQueries(
+  const std::vector< std::pair<const TreeNode*, const TreeNode*> >& paths, TreeThreadPool& pool) {
+
+  refresh();
+  std::vector<T> results(paths.size());
+  pool.parallelFor(paths.size(), [&](std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; i++) {
+      results[i] = queryPath(paths[i].first, paths[i].second);
+    }
+  });
+  return results;
+}
+
+template <typename T, typename Combine>
+void HeavyLightIndex<T, Combine>::update(TreeNode* node, const T& newData) {
+  refresh();
+  std::size_t i = layout.size() + positions[indexOf(node)];
+  node->data = newData;
+  segments[i] = newData;
+  for (i /= 2; i > 0; i /= 2) {
+    segments[i] = combine(segments[2 * i], segments[2 * i + 1]);
+  }
+}
@@ -0,0 +1,106 @@
+
+#pragma once
+
+#include <algorithm> // for std::upper_bound
+#include <cstddef> // for std::size_t
+#include <stdexcept> // for std::runtime_error
+#include <vector> // for std::vector
+
+#include "GenericTree.h"
+#include "TreeLayout.h"
+
+// LevelAncestorIndex: Answers "which ancestor of this node is k levels up?"
+// in O(log n) time, instead of following parentPtr k times.
+//
+// The index keeps, for every depth, the list of nodes at that depth in
+// preorder. The ancestor of a node at some shallower depth is the last node
+// at that depth that comes before it in preorder: every node in between
+// belongs to that ancestor's subtree, because a subtree is one contiguous
+// run of the preorder. So each query is one binary search. Building the
+// index takes a single traversal.
+//
+// The index is rebuilt automatically on the next query after the tree's
+// structureVersion() changes.
+template <typename T>
+class LevelAncestorIndex {
+public:
+  using TreeNode = typename GenericTree<T>::TreeNode;
+
+  explicit LevelAncestorIndex(GenericTree<T>& tree) : tree(tree), builtVersion(0), isBuilt(false) {}
+
+  // Get the ancestor that is k levels above node (k = 0 gives the node
+  // itself), or nullptr if node isn't that deep.
+  TreeNode* kthAncestor(const TreeNode* node, std::size_t k) {
+    refresh();
+    std::size_t index = indexOf(node);
+    std::size_t depth = layout.depths[index];
+    if (k > depth) return nullptr;
+    return layout.nodes[ancestorIndexAtDepth(index, depth - k)];
+  }
+
+  // Get the ancestor of node that is at the given depth (the root has depth
+  // 0), or nullptr if node isn't that deep.
+  TreeNode* ancestorAtDepth(const TreeNode* node, std::size_t depth) {
+    refresh();
+    std::size_t index = indexOf(node);
+    if (depth > layout.depths[index]) return nullptr;
+    return layout.nodes[ancestorIndexAtDepth(index, depth)];
+  }
+
+  // Get the depth of a node.
+  std::size_t depthOf(const TreeNode* node) {
+    refresh();
+    return layout.depths[indexOf(node)];
+  }
+
+  // Rebuild now if the tree has changed since the index was built.
+  void refresh() {
+    if (!isBuilt || builtVersion != tree.structureVersion()) {
+      rebuild();
+    }
+  }
+
+  // Rebuild the index from scratch.
+  void rebuild();
+
+private:
+
+  std::size_t indexOf(const TreeNode* node) const {
+    std::size_t index = layout.indexOf(node);
+    if (TreeLayout<T>::NO_INDEX == index) {
+      throw std::runtime_error("LevelAncestorIndex was given a node that isn't in its tree");
+    }
+    return index;
+  }
+
+  // The preorder index of the node at the given depth that is the last one
+  // at or before preorder index "index".
+  std::size_t ancestorIndexAtDepth(std::size_t index, std::size_t depth) const {
+    const std::vector<std::size_t>& level = levels[depth];
+    auto after = std::upper_bound(level.begin(), level.end(), index);
+    return *(after - 1);
+  }
+
+  GenericTree<T>& tree;
+  std::size_t builtVersion;
+  bool isBuilt;
+  TreeLayout<T> layout;
+  // For each depth, the preorder indices of the nodes at that depth (sorted,
+  // since they are added in preorder).
+  std::vector< std::vector<std::size_t> > levels;
+};
+
+template <typename T>
+void LevelAncestorIndex<T>::rebuild() {
+  layout.rebuild(tree);
+  levels.clear();
+  for (std::size_t i = 0; i < layout.size(); i++) {
+    std::size_t depth = layout.depths[i];
+    if (depth >= levels.size()) {
+      levels.resize(depth + 1);
+    }
+    levels[depth].push_back(i);
+  }
+  builtVersion = tree.structureVersion();
+  isBuilt = true;
+}
@@ -0,0 +1,103 @@
+
+#pragma once
+
+#include <cstddef> // for std::size_t
+#include <limits> // for std::numeric_limits
+#include <vector> // for std::vector
+
+#include "GenericTree.h"
+
+// LevelOrderArrays: The result of a detailed level-order traversal, as
+// parallel arrays. Entry i of every array describes the i-th node in level
+// order, so the root is entry 0 and the nodes of each depth come in one
+// contiguous run, left to right.
+//
+// Keeping the fields in separate arrays (rather than one array of structs)
+// means code that only needs, say, the depths can stream through just that
+// array.
+template <typename T>
+struct LevelOrderArrays {
+  using TreeNode = typename GenericTree<T>::TreeNode;
+
+  // The parent index recorded for the root.
+  static constexpr std::size_t NO_PARENT = std::numeric_limits<std::size_t>::max();
+
+  // The nodes themselves.
+  std::vector<const TreeNode*> nodes;
+  // Pointers to each node's data (left empty if payloads were skipped).
+  std::vector<const T*> payloads;
+  // The depth of each node (the root has depth 0).
+  std::vector<std::size_t> depths;
+  // The level-order index of each node's parent (NO_PARENT for the root).
+  std::vector<std::size_t> parents;
+  // The number of non-null children of each node.
+  std::vector<std::size_t> childCounts;
+
+  // The number of nodes traversed.
+  std::size_t size() const {
+    return nodes.size();
+  }
+
+  // Empty every array, keeping the memory for reuse.
+  void clear() {
+    nodes.clear();
+    payloads.clear();
+    depths.clear();
+    parents.clear();
+    childCounts.clear();
+  }
+};
+
+template <typename T>
+constexpr std::size_t LevelOrderArrays<T>::NO_PARENT;
+
+// traverseLevelsDetailed: Like traverseLevels, but instead of copying the
+// data, records where each node's data is along with its depth, parent and
+// child count, all in a single breadth-first pass. Pass
+// includePayloads = false to skip the data pointers when only the shape of
+// the tree is wanted.
+//
+// The arrays are filled in place, so passing the same LevelOrderArrays to
+// repeated calls reuses their memory. The payload pointers stay valid until
+// the tree is changed.
+template <typename T>
+void traverseLevelsDetailed(const GenericTree<T>& tree, LevelOrderArrays<T>& out, bool includePayloads = true) {
+  using TreeNode = typename GenericTree<T>::TreeNode;
+  out.clear();
+
+  const TreeNode* rootNodePtr = tree.getRootPtr();
+  if (!rootNodePtr) return;
+
+  out.nodes.push_back(rootNodePtr);
+  out.depths.push_back(0);
+  out.parents.push_back(LevelOrderArrays<T>::NO_PARENT);
+
+  // The nodes array doubles as the queue: everything past "next" is still
+  // waiting to be explored, in the order it was discovered.
+  for (std::size_t next = 0; next < out.nodes.size(); next++) {
+    const TreeNode* currentNode = out.nodes[next];
+    if (includePayloads) {
+      out.payloads.push_back(&currentNode->data);
+    }
+
+    std::size_t childCount = 0;
+    for (const TreeNode* childPtr : tree.childrenOf(currentNode)) {
+      if (childPtr) {
+        out.nodes.push_back(childPtr);
+        out.depths.push_back(out.depths[next] + 1);
+        out.parents.push_back(next);
+        childCount++;
+      }
+    }
+    out.childCounts.push_back(childCount);
+  }
+}
+
+// traverseLevelsDetailed: Convenience version that returns a new set of
+// arrays.
+template <typename T>
+LevelOrderArrays<T> traverseLevelsDetailed(const GenericTree<T>& tree, bool includePayloads = true) {
+  LevelOrderArrays<T> out;
+  traverseLevelsDetailed(tree, out, includePayloads);
+  return out;
+}
@@ -0,0 +1,419 @@
+
+#pragma once
+
+#include <algorithm> // for std::max
+#include <cerrno> // for errno
+#include <cstdint> // for std::int64_t, std::uint64_t
+#include <cstdio> // for std::rename
+#include <cstdlib> // for mkstemp
+#include <cstring> // for std::memcmp, std::memcpy, std::strerror
+#include <new> // for placement new
+#include <ostream> // for std::ostream
+#include <queue> // for std::queue
+#include <stdexcept> // for std::runtime_error
+#include <string> // for std::string
+#include <type_traits> // for std::is_trivially_copyable
+#include <vector> // for std::vector
+
+#include <fcntl.h> // for open
+#include <sys/mman.h> // for mmap, munmap
+#include <sys/stat.h> // for fchmod, fstat
+#include <unistd.h> // for close, ftruncate, unlink
+
+#include "GenericTree.h"
+
+// -------------------------------------------------------------------
+// A tree that lives in a memory-mapped file
+// -------------------------------------------------------------------
+
+// SelfRelativePtr: A pointer that is stored as a byte offset from its own
+// address, instead of as an absolute address. If a whole block of memory is
+// mapped at a different address in another process, every self-relative
+// pointer inside the block still points to the right place, because the
+// pointer and its target move together. An offset of 0 means null.
+template <typename U>
+class SelfRelativePtr {
+public:
+  SelfRelativePtr() : offset(0) {}
+
+  SelfRelativePtr(const SelfRelativePtr& other) = delete;
+  SelfRelativePtr& operator=(const SelfRelativePtr& other) = delete;
+
+  const U* get() const {
+    if (0 == offset) return nullptr;
+    return reinterpret_cast<const U*>(reinterpret_cast<const char*>(this) + offset);
+  }
+
+  // Point at a target that lives in the same mapped block.
+  void set(const U* target) {
+    offset = target ? reinterpret_cast<const char*>(target) - reinterpret_cast<const char*>(this) : 0;
+  }
+
+  // Allow the pointer to be used like an ordinary (const) raw pointer.
+  operator const U*() const { return get(); }
+  const U* operator->() const { return get(); }
+
+private:
+  std::int64_t offset;
+};
+
+// SharedTree: A read-mostly copy of a GenericTree stored in a memory-mapped
+// file, such as a file under /dev/shm for POSIX shared memory. One process
+// creates the file from a GenericTree, and any number of other processes can
+// map it read-only, sharing the same physical memory with no copying or
+// deserialization at all.
+//
+// All links inside the file are SelfRelativePtr offsets, so the file can be
+// mapped at any address. The nodes offer the same members that code usually
+// uses on GenericTree<T>::TreeNode: "data", "parentPtr" and "childrenPtrs"
+// (which supports size(), [] and range-for loops, yielding node pointers or
+// nullptr for a null slot). That means templated helpers written for
+// TreeNode, like countNullChildrenIterative, work on SharedTree nodes too.
+//
+// The data type T must be trivially copyable, since its bytes are stored
+// directly in the file. (So GenericTree<int> works, but std::string would
+// need a different encoding.)
+//
+// Structural changes can't be made in place. To publish a new version,
+// create a new file with create(); it is written to a temporary name and
+// renamed over the old one at the end, so readers that open the path always
+// see a complete tree. Readers that already mapped the old version keep
+// using it until they reopen.
+template <typename T>
+class SharedTree {
+public:
+
+  static_assert(std::is_trivially_copyable<T>::value,
+    "SharedTree can only store trivially copyable data types");
+
+  class Node;
+
+  // The list of child slots of a node.
+  class ChildList {
+  public:
+    using Slot = SelfRelativePtr<Node>;
+
+    std::size_t size() const { return static_cast<std::size_t>(count); }
+    bool empty() const { return 0 == count; }
+
+    const Node* operator[](std::size_t i) const { return slots.get()[i].get(); }
+
+    class const_iterator {
+    public:
+      explicit const_iterator(const Slot* slotPtr) : slotPtr(slotPtr) {}
+      const Node* operator*() const { return slotPtr->get(); }
+      const_iterator& operator++() { slotPtr++; return *this; }
+      bool operator!=(const const_iterator& other) const { return slotPtr != other.slotPtr; }
+      bool operator==(const const_iterator& other) const { return slotPtr == other.slotPtr; }
+    private:
+      const Slot* slotPtr;
+    };
+
+    const_iterator begin() const { return const_iterator(slots.get()); }
+    const_iterator end() const { return const_iterator(slots.get() + count); }
+
+  private:
+    friend class SharedTree;
+    SelfRelativePtr<Slot> slots;
+    std::uint64_t count;
+  };
+
+  // A node in the mapped file.
+  class Node {
+  public:
+    // Pointer to the node's parent (null if there is no parent)
+    SelfRelativePtr<Node> parentPtr;
+
+    ChildList childrenPtrs;
+
+    T data;
+  };
+
+  // Create (or replace) the file at the given path with a copy of the
+  // source tree, and return a writable mapping of it. Placeholders in the
+  // source are loaded along the way.
+  static SharedTree create(const std::string& path, const GenericTree<T>& source);
+
+  // Map an existing file read-only.
+  static SharedTree openReadOnly(const std::string& path) {
+    return SharedTree(path, false);
+  }
+
+  // Map an existing file for writing, so that data values can be updated in
+  // place with updateData. Other processes see the updates directly.
+  static SharedTree openWritable(const std::string& path) {
+    return SharedTree(path, true);
+  }
+
+  SharedTree(SharedTree&& other) : mappedBase(other.mappedBase), mappedSize(other.mappedSize), writable(other.writable) {
+    other.mappedBase = nullptr;
+    other.mappedSize = 0;
+  }
+
+  SharedTree(const SharedTree& other) = delete;
+  SharedTree& operator=(const SharedTree& other) = delete;
+
+  ~SharedTree() {
+    if (mappedBase) {
+      munmap(mappedBase, mappedSize);
+    }
+  }
+
+  // Get a pointer to the root node (null for an empty tree).
+  const Node* getRootPtr() const {
+    return header()->rootPtr.get();
+  }
+
+  // The number of (non-null) nodes in the tree.
+  std::size_t size() const {
+    return static_cast<std::size_t>(header()->nodeCount);
+  }
+
+  // Overwrite the data of one node. Only allowed on a writable mapping.
+  void updateData(const Node* node, const T& newData) {
+    if (!writable) {
+      throw std::runtime_error("Tried to update a read-only SharedTree");
+    }
+    std::memcpy(const_cast<T*>(&node->data), &newData, sizeof(T));
+  }
+
+  // Print the tree in the same vertical text format as GenericTree::Print.
+  std::ostream& Print(std::ostream& os) const {
+    const Node* rootNodePtr = getRootPtr();
+    if (!rootNodePtr) {
+      return os << "[empty tree]" << std::endl;
+    }
+    std::string buffer;
+    renderTreeLines(buffer, rootNodePtr, std::string(), true, true, &os);
+    return os.write(buffer.data(), buffer.size());
+  }
+
+private:
+
+  // The file begins with this header.
+  struct Header {
+    char magic[8];
+    std::uint64_t dataSize;
+    std::uint64_t fileSize;
+    std::uint64_t nodeCount;
+    SelfRelativePtr<Node> rootPtr;
+  };
+
+  static constexpr char MAGIC[8] = "GTSHM01";
+
+  SharedTree() : mappedBase(nullptr), mappedSize(0), writable(false) {}
+
+  SharedTree(const std::string& path, bool writable);
+
+  // Map a whole open file descriptor, then close the descriptor.
+  void mapFile(int fd, std::size_t size, bool forWriting, const std::string& path);
+
+  const Header* header() const {
+    return reinterpret_cast<const Header*>(mappedBase);
+  }
+
+  static std::runtime_error systemError(const std::string& what, const std::string& path) {
+    return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+  }
+
+  void* mappedBase;
+  std::size_t mappedSize;
+  bool writable;
+};
+
+template <typename T>
+constexpr char SharedTree<T>::MAGIC[8];
+
+// Operator overload that allows stream output syntax
+template <typename T>
+std::ostream& operator<<(std::ostream& os, const SharedTree<T>& tree) {
+  return tree.Print(os);
+}
+
+template <typename T>
+void SharedTree<T>::mapFile(int fd, std::size_t size, bool forWriting, const std::string& path) {
+  int protection = forWriting ? (PROT_READ | PROT_WRITE) : PROT_READ;
+  void* base = mmap(nullptr, size, protection, MAP_SHARED, fd, 0);
+  if (MAP_FAILED == base) {
+    std::runtime_error error = systemError("Could not map", path);
+    close(fd);
+    throw error;
+  }
+  // The mapping stays valid after the descriptor is closed.
+  close(fd);
+  mappedBase = base;
+  mappedSize = size;
+}
+
+template <typename T>
+SharedTree<T>::SharedTree(const std::string& path, bool writable)
+  : mappedBase(nullptr), mappedSize(0), writable(writable) {
+
+  int fd = open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+  if (fd < 0) {
+    throw systemError("Could not open", path);
+  }
+
+  struct stat fileInfo;
+  if (fstat(fd, &fileInfo) != 0 || static_cast<std::size_t>(fileInfo.st_size) < sizeof(Header)) {
+    close(fd);
+    throw std::runtime_error("Not a SharedTree file: " + path);
+  }
+
+  mapFile(fd, static_cast<std::size_t>(fileInfo.st_size), writable, path);
+
+  // Check that the file really holds a tree of this data type before anyone
+  // follows the offsets inside it.
+  const Header* fileHeader = header();
+  if (0 != std::memcmp(fileHeader->magic, MAGIC, sizeof(MAGIC))
+    || fileHeader->dataSize != sizeof(T)
+    || fileHeader->fileSize != mappedSize) {
+    munmap(mappedBase, mappedSize);
+    mappedBase = nullptr;
+    throw std::runtime_error("Not a SharedTree file for this data type: " + path);
+  }
+}
+
+template <typename T>
+SharedTree<T> SharedTree<T>::create(const std::string& path, const GenericTree<T>& source) {
+
+  using TreeNode = typename GenericTree<T>::TreeNode;
+  using Slot = typename ChildList::Slot;
+
+  // First pass: count the nodes and child slots, so we know the file size.
+  std::size_t nodeCount = 0;
+  std::size_t slotCount = 0;
+  std::queue<const TreeNode*> nodesToExplore;
+  if (source.getRootPtr()) {
+    nodesToExplore.push(source.getRootPtr());
+  }
+  while (!nodesToExplore.empty()) {
+    const TreeNode* node = nodesToExplore.front();
+    nodesToExplore.pop();
+    nodeCount++;
+    // childrenOf loads placeholders, so the second pass sees them loaded.
+    const auto& children = source.childrenOf(node);
+    slotCount += children.size();
+    for (auto childPtr : children) {
+      if (childPtr) nodesToExplore.push(childPtr);
+    }
+  }
+
+  // Layout: the header, then all nodes in level order, then all of the
+  // child slot arrays. Each part starts at a multiple of the strictest
+  // alignment among them (the mapping itself starts on a page boundary), so
+  // a T that needs more than 8 bytes of alignment is still placed right.
+  const std::size_t alignment = std::max({alignof(Header), alignof(Node), alignof(Slot)});
+  auto roundUp = [alignment](std::size_t bytes) { return (bytes + alignment - 1) / alignment * alignment; };
+  const std::size_t nodesOffset = roundUp(sizeof(Header));
+  const std::size_t nodeStride = roundUp(sizeof(Node));
+  const std::size_t slotsOffset = nodesOffset + nodeCount * nodeStride;
+  const std::size_t fileSize = slotsOffset + slotCount * sizeof(Slot);
+
+  // Write to a temporary file next to the target, under a unique name so
+  // that two writers can't clobber each other's, and rename it into place
+  // at the end. The temporary file is removed again if anything fails.
+  std::string tempPath = path + ".XXXXXX";
+  int fd = mkstemp(&tempPath[0]);
+  if (fd < 0) {
+    throw systemError("Could not create a temporary file for", path);
+  }
+  if (fchmod(fd, 0644) != 0 || ftruncate(fd, static_cast<off_t>(fileSize)) != 0) {
+    std::runtime_error error = systemError("Could not resize", tempPath);
+    close(fd);
+    unlink(tempPath.c_str());
+    throw error;
+  }
+
+  SharedTree tree;
+  tree.writable = true;
+  // Everything from mapping to the rename runs under one try, so a throw
+  // from any of it - including reading child lists from the source - is
+  // covered.
+  try {
+    tree.mapFile(fd, fileSize, true, tempPath);
+
+    char* base = static_cast<char*>(tree.mappedBase);
+    Header* fileHeader = new (base) Header();
+    std::memcpy(fileHeader->magic, MAGIC, sizeof(MAGIC));
+    fileHeader->dataSize = sizeof(T);
+    fileHeader->fileSize = fileSize;
+    fileHeader->nodeCount = nodeCount;
+
+    auto nodeAt = [&](std::size_t index) {
+      return reinterpret_cast<Node*>(base + nodesOffset + index * nodeStride);
+    };
+    Slot* nextSlot = reinterpret_cast<Slot*>(base + slotsOffset);
+
+    // Second pass: the same level-order walk. Nodes are numbered in the order
+    // they are enqueued, so each child's final address is known as soon as we
+    // see it, and no lookup table is needed to link them up.
+    if (nodeCount > 0) {
+      std::queue< std::pair<const TreeNode*, Node*> > pending;
+      Node* rootNode = new (nodeAt(0)) Node();
+      pending.push(std::make_pair(source.getRootPtr(), rootNode));
+      fileHeader->rootPtr.set(rootNode);
+      std::size_t nextIndex = 1;
+
+      while (!pending.empty()) {
+        const TreeNode* sourceNode = pending.front().first;
+        Node* node = pending.front().second;
+        pending.pop();
+
+        std::memcpy(&node->data, &sourceNode->data, sizeof(T));
+
+        const auto& children = source.childrenOf(sourceNode);
+        node->childrenPtrs.count = children.size();
+        node->childrenPtrs.slots.set(children.empty() ? nullptr : nextSlot);
+
+        for (auto childPtr : children) {
+          Slot* slot = new (nextSlot++) Slot();
+          if (childPtr) {
+            Node* childNode = new (nodeAt(nextIndex++)) Node();
+            childNode->parentPtr.set(node);
+            slot->set(childNode);
+            pending.push(std::make_pair(childPtr, childNode));
+          }
+        }
+      }
+    }
+
+    if (msync(tree.mappedBase, fileSize, MS_SYNC) != 0 || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+      throw systemError("Could not publish", path);
+    }
+  }
+  catch (...) {
+    unlink(tempPath.c_str());
+    throw;
+  }
+
+  return tree;
+}
+
+// traverseLevels: The level-order traversal from GenericTreeExercises.h,
+// for a SharedTree. Returns copies of the data in level order.
+template <typename T>
+std::vector<T> traverseLevels(const SharedTree<T>& tree) {
+  using Node = typename SharedTree<T>::Node;
+  std::vector<T> results;
+
+  const Node* rootNodePtr = tree.getRootPtr();
+  if (!rootNodePtr) return results;
+  results.reserve(tree.size());
+
+  std::queue<const Node*> nodesToExplore;
+  nodesToExplore.push(rootNodePtr);
+
+  while (!nodesToExplore.empty()) {
+    const Node* currentNode = nodesToExplore.front();
+    nodesToExplore.pop();
+    results.push_back(currentNode->data);
+    for (auto childPtr : currentNode->childrenPtrs) {
+      if (childPtr) {
+        nodesToExplore.push(childPtr);
+      }
+    }
+  }
+
+  return results;
+}
@@ -0,0 +1,160 @@
+
+#pragma once
+
+#include <cstddef> // for std::size_t
+#include <stdexcept> // for std::runtime_error
+#include <utility> // for std::forward, std::move
+
+#include "GenericTree.h"
+
+// SubtreeBuilder: Builds one subtree on its own, to be attached to a
+// GenericTree afterward. The point is building a big tree from several
+// threads at once: give each thread its own builder for its part of the
+// tree, and the threads never touch anything shared while they build. Each
+// builder allocates its nodes from node blocks of its own, blockSize nodes
+// at a time, so the threads don't contend on the global allocator either,
+// and each subtree ends up compact in memory.
+//
+// Once the threads are done, attach each builder's subtree with attachTo,
+// which links the subtree's root under a parent in the tree and hands over
+// the builder's node blocks to the tree. That takes O(1) time per subtree,
+// however large it is. The builder is then empty and can be reused.
+//
+// The node pointers returned by createRoot and addChild are the handles
+// used to add further children, and they stay valid after attaching. A
+// builder whose subtree is never attached deletes it when it's destroyed.
+template <typename T>
+class SubtreeBuilder {
+public:
+  using TreeNode = typename GenericTree<T>::TreeNode;
+
+  static constexpr std::size_t DEFAULT_BLOCK_SIZE = 1024;
+
+  explicit SubtreeBuilder(std::size_t blockSize = DEFAULT_BLOCK_SIZE)
+    : blockSize(blockSize ? blockSize : 1), nextSlot(nullptr), slotsLeft(0), nodeCount(0) {}
+
+  SubtreeBuilder(const SubtreeBuilder& other) = delete;
+  SubtreeBuilder& operator=(const SubtreeBuilder& other) = delete;
+
+  // Start the subtree with a root node. Throws if it already has one.
+  TreeNode* createRoot(const T& rootData) {
+    return createRootNode(rootData);
+  }
+
+  TreeNode* createRoot(T&& rootData) {
+    return createRootNode(std::move(rootData));
+  }
+
+  // Add a rightmost child with the given data under parent, which must be a
+  // node of this builder's subtree.
+  TreeNode* addChild(TreeNode* parent, const T& childData) {
+    return addChildNode(parent, childData);
+  }
+
+  TreeNode* addChild(TreeNode* parent, T&& childData) {
+    return addChildNode(parent, std::move(childData));
+  }
+
+  TreeNode* getRootPtr() {
+    return staging.getRootPtr();
+  }
+
+  // The number of nodes added through this builder since it was created or
+  // last attached.
+  std::size_t size() const {
+    return nodeCount;
+  }
+
+  // Make the subtree the rightmost child of parent, a node of tree, or the
+  // tree's root if parent is null (which needs an empty tree). Returns the
+  // subtree's root, or null if the builder was empty.
+  //   Only one thread may change the tree at a time, so attach the
+  // builders one after another once they're all built.
+  TreeNode* attachTo(GenericTree<T>& tree, TreeNode* parent);
+
+private:
+
+  template <typename Data>
+  TreeNode* createRootNode(Data&& rootData) {
+    if (staging.rootNodePtr) {
+      throw std::runtime_error("Tried to createRoot when the builder's root already exists");
+    }
+    staging.rootNodePtr = newNode(std::forward<Data>(rootData));
+    return staging.rootNodePtr;
+  }
+
+  template <typename Data>
+  TreeNode* addChildNode(TreeNode* parent, Data&& childData) {
+    TreeNode* child = newNode(std::forward<Data>(childData));
+    try {
+      parent->childrenPtrs.push_back(child);
+    }
+    catch (...) {
+      // The slot just goes unused.
+      child->~TreeNode();
+      nodeCount--;
+      throw;
+    }
+    child->parentPtr = parent;
+    return child;
+  }
+
+  // Construct a node in the next free slot, starting a new block when the
+  // current one is full.
+  template <typename Data>
+  TreeNode* newNode(Data&& nodeData) {
+    if (0 == slotsLeft) {
+      nextSlot = staging.allocateNodeBlock(blockSize);
+      slotsLeft = blockSize;
+    }
+    TreeNode* node = GenericTree<T>::constructBlockNode(nextSlot, std::forward<Data>(nodeData));
+    nextSlot++;
+    slotsLeft--;
+    nodeCount++;
+    return node;
+  }
+
+  // The subtree is kept as the contents of a private tree, which owns its
+  // node blocks and cleans up after it if it's never attached.
+  GenericTree<T> staging;
+  std::size_t blockSize;
+  TreeNode* nextSlot;
+  std::size_t slotsLeft;
+  std::size_t nodeCount;
+};
+
+template <typename T>
+constexpr std::size_t SubtreeBuilder<T>::DEFAULT_BLOCK_SIZE;
+
+template <typename T>
+typename SubtreeBuilder<T>::TreeNode* SubtreeBuilder<T>::attachTo(GenericTree<T>& tree, TreeNode* parent) {
+
+  TreeNode* subtreeRoot = staging.rootNodePtr;
+  if (!subtreeRoot) return nullptr;
+  if (!parent && tree.rootNodePtr) {
+    throw std::runtime_error("Tried to attach a subtree as the root of a tree that already has one");
+  }
+
+  // Make room for the node blocks in the tree before linking anything, so
+  // that handing them over below can't fail. Otherwise the tree could
+  // point into blocks that the builder still owns and later frees.
+  tree.nodeBlocks.reserve(tree.nodeBlocks.size() + staging.nodeBlocks.size());
+
+  if (parent) {
+    parent->childrenPtrs.push_back(subtreeRoot);
+    subtreeRoot->parentPtr = parent;
+  }
+  else {
+    tree.rootNodePtr = subtreeRoot;
+  }
+
+  // The subtree now belongs to the tree. Handing over what's left of the
+  // staging tree moves its node blocks, including the unused rest of the
+  // current block, so the next node starts a fresh block.
+  staging.rootNodePtr = nullptr;
+  tree.absorbRemainsOf(staging);
+  nextSlot = nullptr;
+  slotsLeft = 0;
+  nodeCount = 0;
+  return subtreeRoot;
+}
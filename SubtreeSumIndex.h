@@ -0,0 +1,166 @@
+
+#pragma once
+
+#include <cstddef> // for std::size_t
+#include <stdexcept> // for std::runtime_error
+#include <utility> // for std::pair
+#include <vector> // for std::vector
+
+#include "GenericTree.h"
+#include "TreeLayout.h"
+
+// SubtreeSumIndex: Keeps running totals of numeric node data so that the
+// sum over any subtree can be asked for in O(log n) time, and a node's data
+// can be changed in O(log n) time too.
+//
+// The tree is flattened into its Euler tour order (preorder), where every
+// subtree is one contiguous range of positions. A subtree sum is then a
+// range sum over that array, which a Fenwick tree (binary indexed tree)
+// handles in O(log n) for both queries and point updates.
+//
+// Change node data through this index (add, set, or applyUpdates), not by
+// assigning to node->data directly, or the totals will go out of date. The
+// index rebuilds itself on the next use after the tree's
+// structureVersion() changes.
+template <typename T>
+class SubtreeSumIndex {
+public:
+  using TreeNode = typename GenericTree<T>::TreeNode;
+
+  explicit SubtreeSumIndex(GenericTree<T>& tree) : tree(tree), builtVersion(0), isBuilt(false) {}
+
+  // The sum of the data of every node in the subtree rooted at node.
+  T subtreeSum(const TreeNode* node) {
+    refresh();
+    std::size_t index = indexOf(node);
+    return prefixSum(index + layout.subtreeSizes[index]) - prefixSum(index);
+  }
+
+  // Add delta to one node's data.
+  void add(TreeNode* node, const T& delta) {
+    refresh();
+    std::size_t index = indexOf(node);
+    node->data += delta;
+    addAt(index, delta);
+  }
+
+  // Set one node's data to a new value.
+  void set(TreeNode* node, const T& newData) {
+    refresh();
+    std::size_t index = indexOf(node);
+    addAt(index, newData - node->data);
+    node->data = newData;
+  }
+
+  // Set the data of many nodes at once. For a big batch it's cheaper to
+  // write all of the values and rebuild the totals in one linear pass than
+  // to update them one at a time, so that is done automatically.
+  void applyUpdates(const std::vector< std::pair<TreeNode*, T> >& updates);
+
+  // Rebuild now if the tree has changed since the index was built.
+  void refresh() {
+    if (!isBuilt || builtVersion != tree.structureVersion()) {
+      rebuild();
+    }
+  }
+
+  // Rebuild the index from scratch, in O(n) time.
+  void rebuild();
+
+private:
+
+  std::size_t indexOf(const TreeNode* node) const {
+    std::size_t index = layout.indexOf(node);
+    if (TreeLayout<T>::NO_INDEX == index) {
+      throw std::runtime_error("SubtreeSumIndex was given a node that isn't in its tree");
+    }
+    return index;
+  }
+
+  // The Fenwick tree is 1-based: fenwick[i] holds the sum of the positions
+  // (i - lowbit(i), i], where lowbit(i) is the lowest set bit of i.
+  static std::size_t lowBit(std::size_t i) {
+    return i & (~i + 1);
+  }
+
+  // Sum of the data at preorder positions [0, end).
+  T prefixSum(std::size_t end) const {
+    T sum = T();
+    for (std::size_t i = end; i > 0; i -= lowBit(i)) {
+      sum += fenwick[i];
+    }
+    return sum;
+  }
+
+  // Recompute all of the Fenwick tree entries from the node data, in O(n).
+  void rebuildTotals();
+
+  void addAt(std::size_t index, const T& delta) {
+    for (std::size_t i = index + 1; i < fenwick.size(); i += lowBit(i)) {
+      fenwick[i] += delta;
+    }
+  }
+
+  GenericTree<T>& tree;
+  std::size_t builtVersion;
+  bool isBuilt;
+  TreeLayout<T> layout;
+  std::vector<T> fenwick;
+};
+
+template <typename T>
+void SubtreeSumIndex<T>::rebuild() {
+  layout.rebuild(tree);
+  rebuildTotals();
+  builtVersion = tree.structureVersion();
+  isBuilt = true;
+}
+
+template <typename T>
+void SubtreeSumIndex<T>::rebuildTotals() {
+  const std::size_t n = layout.size();
+  fenwick.assign(n + 1, T());
+
+  // Linear-time construction: put each value in place, then push each
+  // partial sum up to the one entry that covers it next.
+  for (std::size_t i = 1; i <= n; i++) {
+    fenwick[i] += layout.nodes[i-1]->data;
+    std::size_t parent = i + lowBit(i);
+    if (parent <= n) {
+      fenwick[parent] += fenwick[i];
+    }
+  }
+}
+
+template <typename T>
+void SubtreeSumIndex<T>::applyUpdates(const std::vector< std::pair<TreeNode*, T> >& updates) {
+  refresh();
+
+  // Check every node first, so that a bad one doesn't leave the batch
+  // half applied.
+  std::vector<std::size_t> indices;
+  indices.reserve(updates.size());
+  for (const auto& update : updates) {
+    indices.push_back(indexOf(update.first));
+  }
+
+  // Each single update costs about log2(n) steps, and a rebuild costs about
+  // 2n, so switch over when the batch is big enough.
+  std::size_t logSize = 1;
+  for (std::size_t n = layout.size(); n > 1; n /= 2) {
+    logSize++;
+  }
+
+  if (updates.size() * logSize < 2 * layout.size()) {
+    for (std::size_t i = 0; i < updates.size(); i++) {
+      addAt(indices[i], updates[i].second - updates[i].first->data);
+      updates[i].first->data = updates[i].second;
+    }
+    return;
+  }
+
+  for (const auto& update : updates) {
+    update.first->data = update.second;
+  }
+  rebuildTotals();
+}
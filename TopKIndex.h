@@ -0,0 +1,261 @@
+
+#pragma once
+
+#include <cstddef> // for std::size_t
+#include <functional> // for std::less
+#include <queue> // for std::priority_queue
+#include <stdexcept> // for std::runtime_error
+#include <unordered_map> // for std::unordered_map
+#include <vector> // for std::vector
+
+#include "GenericTree.h"
+#include "TreeLayout.h"
+
+// TopKIndex: Finds the k largest data values in the tree, or in any
+// subtree, without visiting the whole subtree.
+//
+// The index caches, for every node, the largest value anywhere in its
+// subtree. A query is then a best-first search: it keeps a heap of
+// candidates ordered by how large a value they could still produce, where a
+// candidate is either one node's own value or a whole subtree bounded by its
+// cached max. Popping a subtree replaces it with its root's own value and
+// its child subtrees; popping a single value emits it. The values come out
+// largest first, and the search stops after k of them, so any subtree whose
+// max can't beat the k-th result is never opened.
+//
+// "Largest" is according to Compare, which defaults to operator<. Add and
+// delete nodes through addChild and deleteSubtree here, change data
+// through update, and reroot through reroot, to keep the cached maxima
+// current in O(depth) time. Other changes to the tree's structure are
+// picked up by a full rebuild on the next query, through
+// structureVersion(). Changing node data directly needs an explicit
+// rebuild().
+template <typename T, typename Compare = std::less<T> >
+class TopKIndex {
+public:
+  using TreeNode = typename GenericTree<T>::TreeNode;
+
+  explicit TopKIndex(GenericTree<T>& tree, Compare compare = Compare())
+    : tree(tree), compare(compare), builtVersion(0), isBuilt(false) {}
+
+  // The nodes with the k largest values in the subtree rooted at
+  // subtreeRoot (the whole tree if null), largest first.
+  std::vector<TreeNode*> topK(std::size_t k, const TreeNode* subtreeRoot = nullptr);
+
+  // Add a rightmost child with the given data under parent.
+  TreeNode* addChild(TreeNode* parent, const T& childData);
+
+  // Delete the subtree rooted at targetRoot (as GenericTree::deleteSubtree).
+  void deleteSubtree(TreeNode* targetRoot);
+
+  // Change one node's data.
+  void update(TreeNode* node, const T& newData);
+
+  // Reroot the tree at newRoot (as GenericTree::reroot). Only the subtrees
+  // of the nodes on the old root path change, so only their maxima are
+  // recomputed.
+  void reroot(TreeNode* newRoot);
+
+  // Rebuild now if the tree has changed since the index was built.
+  void refresh() {
+    if (!isCurrent()) {
+      rebuild();
+    }
+  }
+
+  // Recompute every cached maximum from scratch, in O(n).
+  void rebuild();
+
+private:
+
+  bool isCurrent() const {
+    return isBuilt && builtVersion == tree.structureVersion();
+  }
+
+  // Recompute one node's cached max from its own data and its children's
+  // maxima. Returns whether it changed.
+  bool recomputeMax(const TreeNode* node);
+
+  // Recompute the cached maxima from node up toward the root, stopping as
+  // soon as one doesn't change.
+  void refreshUpward(TreeNode* node);
+
+  GenericTree<T>& tree;
+  Compare compare;
+  std::size_t builtVersion;
+  bool isBuilt;
+  std::unordered_map<const TreeNode*, T> subtreeMax;
+};
+
+template <typename T, typename Compare>
+void TopKIndex<T, Compare>::rebuild() {
+  subtreeMax.clear();
+  TreeLayout<T> layout(tree);
+  subtreeMax.reserve(layout.size());
+
+  // Reverse preorder reaches every child before its parent.
+  for (std::size_t i = layout.size(); i > 0; i--) {
+    const TreeNode* node = layout.nodes[i-1];
+    const T* best = &node->data;
+    for (const TreeNode* childPtr : node->childrenPtrs) {
+      if (childPtr) {
+        const T& childMax = subtreeMax.find(childPtr)->second;
+        if (compare(*best, childMax)) best = &childMax;
+      }
+    }
+    subtreeMax.emplace(node, *best);
+  }
+
+  builtVersion = tree.structureVersion();
+  isBuilt = true;
+}
+
+template <typename T, typename Compare>
+std::vector<typename TopKIndex<T, Compare>::TreeNode*> TopKIndex<T, Compare>::topK(std::size_t k,
+  const TreeNode* subtreeRoot) {
+
+  refresh();
+  std::vector<TreeNode*> results;
+  if (!subtreeRoot) subtreeRoot = tree.getRootPtr();
+  if (!subtreeRoot || 0 == k) return results;
+  if (!subtreeMax.count(subtreeRoot)) {
+    throw std::runtime_error("TopKIndex was given a node that isn't in its tree");
+  }
+
+  // A candidate is either a node's own value or its whole subtree, along
+  // with the largest value it could produce.
+  struct Candidate {
+    const TreeNode* node;
+    const T* bound;
+    bool wholeSubtree;
+  };
+  // Larger bounds come out first. On a tie, a single value comes out ahead
+  // of a subtree, so it's emitted without opening anything else.
+  auto comesLater = [this](const Candidate& a, const Candidate& b) {
+    if (compare(*a.bound, *b.bound)) return true;
+    if (compare(*b.bound, *a.bound)) return false;
+    return a.wholeSubtree && !b.wholeSubtree;
+  };
+  std::priority_queue<Candidate, std::vector<Candidate>, decltype(comesLater)> candidates(comesLater);
+  candidates.push(Candidate{subtreeRoot, &subtreeMax.find(subtreeRoot)->second, true});
+
+  while (!candidates.empty() && results.size() < k) {
+    Candidate best = candidates.top();
+    candidates.pop();
+
+    if (!best.wholeSubtree) {
+      results.push_back(const_cast<TreeNode*>(best.node));
+      continue;
+    }
+
+    candidates.push(Candidate{best.node, &best.node->data, false});
+    for (const TreeNode* childPtr : best.node->childrenPtrs) {
+      if (childPtr) {
+        candidates.push(Candidate{childPtr, &subtreeMax.find(childPtr)->second, true});
+      }
+    }
+  }
+
+  return results;
+}
+
+template <typename T, typename Compare>
+typename TopKIndex<T, Compare>::TreeNode* TopKIndex<T, Compare>::addChild(TreeNode* parent, const T& childData) {
+  bool wasCurrent = isCurrent();
+  // Check before changing anything, as update() does.
+  if (wasCurrent && !subtreeMax.count(parent)) {
+    throw std::runtime_error("TopKIndex was given a node that isn't in its tree");
+  }
+  TreeNode* child = parent->addChild(childData);
+  tree.markStructureChanged();
+  if (!wasCurrent) return child;
+
+  // The new value can only raise the maxima above it.
+  subtreeMax.emplace(child, childData);
+  for (TreeNode* cur = parent; cur; cur = cur->parentPtr) {
+    T& curMax = subtreeMax.find(cur)->second;
+    if (!compare(curMax, childData)) break;
+    curMax = childData;
+  }
+  builtVersion = tree.structureVersion();
+  return child;
+}
+
+template <typename T, typename Compare>
+void TopKIndex<T, Compare>::deleteSubtree(TreeNode* targetRoot) {
+  if (!targetRoot) return;
+  bool wasCurrent = isCurrent();
+  TreeNode* parent = targetRoot->parentPtr;
+
+  // Forget the cached maxima of every node about to be deleted.
+  if (wasCurrent) {
+    std::vector<const TreeNode*> nodesToForget{targetRoot};
+    while (!nodesToForget.empty()) {
+      const TreeNode* cur = nodesToForget.back();
+      nodesToForget.pop_back();
+      subtreeMax.erase(cur);
+      for (const TreeNode* childPtr : cur->childrenPtrs) {
+        if (childPtr) nodesToForget.push_back(childPtr);
+      }
+    }
+  }
+
+  tree.deleteSubtree(targetRoot);
+  if (!wasCurrent) return;
+
+  if (parent) {
+    refreshUpward(parent);
+  }
+  builtVersion = tree.structureVersion();
+}
+
+template <typename T, typename Compare>
+void TopKIndex<T, Compare>::update(TreeNode* node, const T& newData) {
+  refresh();
+  if (!subtreeMax.count(node)) {
+    throw std::runtime_error("TopKIndex was given a node that isn't in its tree");
+  }
+  node->data = newData;
+  refreshUpward(node);
+}
+
+template <typename T, typename Compare>
+void TopKIndex<T, Compare>::reroot(TreeNode* newRoot) {
+  bool wasCurrent = isCurrent();
+  std::vector<const TreeNode*> path;
+  for (const TreeNode* cur = newRoot; cur; cur = cur->parentPtr) {
+    path.push_back(cur);
+  }
+
+  tree.reroot(newRoot);
+  if (!wasCurrent) return;
+
+  // Each path node's new subtree holds the next one up the old path, so
+  // start from the old root.
+  for (std::size_t i = path.size(); i > 0; i--) {
+    recomputeMax(path[i-1]);
+  }
+  builtVersion = tree.structureVersion();
+}
+
+template <typename T, typename Compare>
+bool TopKIndex<T, Compare>::recomputeMax(const TreeNode* node) {
+  const T* best = &node->data;
+  for (const TreeNode* childPtr : node->childrenPtrs) {
+    if (childPtr) {
+      const T& childMax = subtreeMax.find(childPtr)->second;
+      if (compare(*best, childMax)) best = &childMax;
+    }
+  }
+  T& nodeMax = subtreeMax.find(node)->second;
+  if (!compare(nodeMax, *best) && !compare(*best, nodeMax)) return false;
+  nodeMax = *best;
+  return true;
+}
+
+template <typename T, typename Compare>
+void TopKIndex<T, Compare>::refreshUpward(TreeNode* node) {
+  for (TreeNode* cur = node; cur; cur = cur->parentPtr) {
+    if (!recomputeMax(cur)) break;
+  }
+}
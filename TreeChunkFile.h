@@ -0,0 +1,750 @@
+
+#pragma once
+
+#include <algorithm> // for std::equal, std::min, std::replace
+#include <atomic> // for std::atomic
+#include <cerrno> // for errno
+#include <cstddef> // for std::size_t
+#include <cstdint> // for std::uint8_t, std::uint32_t, std::uint64_t
+#include <cstdio> // for std::rename
+#include <cstdlib> // for mkstemp
+#include <cstring> // for std::memcmp, std::memcpy, std::strerror
+#include <fstream> // for std::ofstream
+#include <limits> // for std::numeric_limits
+#include <map> // for std::map
+#include <stack> // for std::stack
+#include <stdexcept> // for std::runtime_error
+#include <string> // for std::string
+#include <type_traits> // for std::is_trivially_copyable
+#include <unordered_map> // for std::unordered_map
+#include <unordered_set> // for std::unordered_set
+#include <utility> // for std::make_pair, std::move, std::pair
+#include <vector> // for std::vector
+
+#include <fcntl.h> // for open
+#include <sys/stat.h> // for fchmod, fstat
+#include <unistd.h> // for close, pread, unlink
+
+#include "GenericTree.h"
+#include "TreeThreadPool.h"
+
+// -------------------------------------------------------------------
+// A chunked file format that can load single subtrees
+// -------------------------------------------------------------------
+
+// TreeChunkCodec: How TreeChunkFile stores one data item as bytes. The
+// default stores the bytes of a trivially copyable type directly, and there
+// is a specialization for std::string. Other data types can specialize it
+// too, or a different codec can be passed to TreeChunkFile. A codec needs:
+//   static void encode(std::string& out, const T& value);
+//   static const char* decode(const char* cur, const char* end, T& value);
+// where decode returns the position just past the item, and throws
+// std::runtime_error if the bytes run out.
+template <typename T>
+struct TreeChunkCodec {
+  static_assert(std::is_trivially_copyable<T>::value,
+    "TreeChunkCodec needs a trivially copyable type, or a specialization");
+
+  static void encode(std::string& out, const T& value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  static const char* decode(const char* cur, const char* end, T& value) {
+    if (static_cast<std::size_t>(end - cur) < sizeof(T)) {
+      throw std::runtime_error("Tree chunk ended in the middle of a data item");
+    }
+    std::memcpy(&value, cur, sizeof(T));
+    return cur + sizeof(T);
+  }
+};
+
+template <>
+struct TreeChunkCodec<std::string> {
+  static void encode(std::string& out, const std::string& value) {
+    std::uint32_t length = static_cast<std::uint32_t>(value.size());
+    TreeChunkCodec<std::uint32_t>::encode(out, length);
+    out += value;
+  }
+
+  static const char* decode(const char* cur, const char* end, std::string& value) {
+    std::uint32_t length = 0;
+    cur = TreeChunkCodec<std::uint32_t>::decode(cur, end, length);
+    if (static_cast<std::size_t>(end - cur) < length) {
+      throw std::runtime_error("Tree chunk ended in the middle of a data item");
+    }
+    value.assign(cur, length);
+    return cur + length;
+  }
+};
+
+// TreeChunkFile: A file format for a GenericTree where the large subtrees
+// are stored as separate chunks, so that one subtree can be loaded without
+// reading the rest of the file.
+//
+// The chunks are cut by size. Working up from the leaves, a node's subtree
+// becomes a chunk of its own once it holds at least chunkNodes nodes that
+// aren't already in smaller chunks, and the root's chunk takes whatever is
+// left at the top. So every chunk except the root's has at least
+// chunkNodes nodes, and a tree of n nodes has at most n / chunkNodes + 1
+// chunks, however wide or deep it is. (A chunk can hold more than
+// chunkNodes nodes, since the children of a node are always in the node's
+// chunk or in chunks of their own.)
+//
+// The file starts with a small header, then come the chunks, and then an
+// index, which lists where each chunk is in the file along with the place
+// its root hangs from: the chunk it sits in and the childrenPtrs slot
+// numbers leading down to it from that chunk's root. The chunks are
+// numbered in preorder of their roots, so the root's chunk is chunk 0 and
+// every chunk comes after the one it sits in. Wherever a chunk reaches the
+// root of another chunk, it stores a reference to it instead.
+//
+// Inside a chunk the nodes are stored in preorder. Each entry is a one-byte
+// kind (null slot, node, or chunk reference), then for a node its encoded
+// data and its number of child slots, and for a reference the chunk number.
+// Numbers are stored in the machine's native byte order.
+//
+// Opening a file only reads the header and index. Loading a subtree reads
+// the chunk that contains its root and the chunks below that, so the I/O is
+// proportional to the subtree plus at most one chunk, rather than the file.
+// Chunks are independent of each other, so writing and loading both encode
+// or decode them in parallel, and writing streams them out a batch at a
+// time, so the whole encoded file is never in memory at once.
+template <typename T, typename Codec = TreeChunkCodec<T> >
+class TreeChunkFile {
+public:
+  using TreeNode = typename GenericTree<T>::TreeNode;
+
+  // A path from the root: the childrenPtrs index to follow at each level.
+  using Path = std::vector<std::uint32_t>;
+
+  static constexpr std::size_t DEFAULT_CHUNK_NODES = 4096;
+
+  // Write the tree to a file, cutting chunks of at least chunkNodes nodes
+  // (which must be at least 1). The file is written under a temporary name
+  // and renamed into place at the end.
+  static void write(const std::string& path, const GenericTree<T>& tree,
+    std::size_t chunkNodes = DEFAULT_CHUNK_NODES, TreeThreadPool& pool = TreeThreadPool::shared());
+
+  // Open a file, reading only its header and index. Throws
+  // std::runtime_error if they don't describe a well-formed file.
+  explicit TreeChunkFile(const std::string& path);
+
+  TreeChunkFile(const TreeChunkFile& other) = delete;
+  TreeChunkFile& operator=(const TreeChunkFile& other) = delete;
+
+  ~TreeChunkFile() {
+    close(fd);
+  }
+
+  // The chunk size the file was written with.
+  std::size_t chunkNodes() const {
+    return minChunkNodes;
+  }
+
+  std::size_t chunkCount() const {
+    return chunks.size();
+  }
+
+  // Replace the contents of out with the whole tree.
+  void loadTree(GenericTree<T>& out, TreeThreadPool& pool = TreeThreadPool::shared()) {
+    loadSubtree(Path(), out, pool);
+  }
+
+  // Replace the contents of out with a copy of the subtree at the given
+  // path. Throws std::runtime_error if there's no node at that path.
+  void loadSubtree(const Path& path, GenericTree<T>& out, TreeThreadPool& pool = TreeThreadPool::shared());
+
+  // The number of bytes read from the file by the most recent load.
+  std::uint64_t lastBytesRead() const {
+    return bytesRead.load();
+  }
+
+private:
+
+  static constexpr char MAGIC[9] = "TREECHK2";
+
+  // The kinds of entries in a chunk.
+  static constexpr std::uint8_t NULL_SLOT = 0;
+  static constexpr std::uint8_t NODE = 1;
+  static constexpr std::uint8_t CHUNK_REFERENCE = 2;
+
+  // The parent chunk recorded for the root's chunk.
+  static constexpr std::uint64_t NO_PARENT = std::numeric_limits<std::uint64_t>::max();
+
+  // How many chunks write encodes before writing them out.
+  static constexpr std::size_t WRITE_BATCH = 64;
+
+  struct Header {
+    char magic[8];
+    std::uint64_t chunkNodes;
+    std::uint64_t chunkCount;
+    std::uint64_t indexOffset;
+    std::uint64_t indexLength;
+  };
+
+  struct ChunkEntry {
+    std::uint64_t offset;
+    std::uint64_t length;
+    std::uint64_t parent;
+  };
+
+  // The smallest index entry: the three numbers of a ChunkEntry and a path
+  // length.
+  static constexpr std::size_t MIN_INDEX_ENTRY = 3 * sizeof(std::uint64_t) + sizeof(std::uint32_t);
+
+  // A place in a decoded chunk where another chunk should be attached.
+  struct ChunkLink {
+    TreeNode* parent;
+    std::size_t slot;
+    std::size_t chunk;
+  };
+
+  template <typename U>
+  static void appendPod(std::string& out, const U& value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(U));
+  }
+
+  template <typename U>
+  static const char* readPod(const char* cur, const char* end, U& value) {
+    if (static_cast<std::size_t>(end - cur) < sizeof(U)) {
+      throw std::runtime_error("Tree chunk file is truncated");
+    }
+    std::memcpy(&value, cur, sizeof(U));
+    return cur + sizeof(U);
+  }
+
+  // Find the roots of the chunks to cut, in preorder, starting with the
+  // tree's root.
+  static std::vector<const TreeNode*> findChunkRoots(const TreeNode* rootNodePtr, std::size_t chunkNodes);
+
+  // Encode chunk number chunk in preorder. The roots of other chunks become
+  // references, and the place each of them hangs from is recorded in
+  // entries and places.
+  static void encodeChunk(std::string& out, std::size_t chunk, const std::vector<const TreeNode*>& chunkRoots,
+    const std::unordered_map<const TreeNode*, std::size_t>& chunkNumbers,
+    std::vector<ChunkEntry>& entries, std::vector<Path>& places);
+
+  // Decode a chunk into a new subtree of free-standing nodes (owned by no
+  // tree yet). Chunk references become null slots, recorded in links.
+  static TreeNode* decodeNodes(const std::string& bytes, std::vector<ChunkLink>* links);
+
+  // Read and decode chunk number chunk, checking that the chunks it refers
+  // to really hang from it.
+  TreeNode* loadChunk(std::size_t chunk, std::vector<ChunkLink>& links);
+
+  // Delete a subtree of free-standing nodes.
+  static void deleteNodes(TreeNode* subtreeRoot);
+
+  // Make a free-standing subtree the contents of out. This uses up the
+  // subtree's nodes.
+  static void adoptAsTree(GenericTree<T>& out, TreeNode* subtreeRoot);
+
+  std::string readBytes(std::uint64_t offset, std::uint64_t length);
+
+  std::string filePath;
+  int fd;
+  std::size_t minChunkNodes;
+  std::vector<ChunkEntry> chunks;
+  // Every chunk but the root's, by the chunk it hangs from and the path
+  // leading to it from that chunk's root.
+  std::map<std::pair<std::size_t, Path>, std::size_t> chunkByPlace;
+  std::atomic<std::uint64_t> bytesRead;
+};
+
+template <typename T, typename Codec>
+constexpr std::size_t TreeChunkFile<T, Codec>::DEFAULT_CHUNK_NODES;
+template <typename T, typename Codec>
+constexpr char TreeChunkFile<T, Codec>::MAGIC[9];
+template <typename T, typename Codec>
+constexpr std::uint8_t TreeChunkFile<T, Codec>::NULL_SLOT;
+template <typename T, typename Codec>
+constexpr std::uint8_t TreeChunkFile<T, Codec>::NODE;
+template <typename T, typename Codec>
+constexpr std::uint8_t TreeChunkFile<T, Codec>::CHUNK_REFERENCE;
+template <typename T, typename Codec>
+constexpr std::uint64_t TreeChunkFile<T, Codec>::NO_PARENT;
+template <typename T, typename Codec>
+constexpr std::size_t TreeChunkFile<T, Codec>::WRITE_BATCH;
+template <typename T, typename Codec>
+constexpr std::size_t TreeChunkFile<T, Codec>::MIN_INDEX_ENTRY;
+
+template <typename T, typename Codec>
+std::vector<const typename TreeChunkFile<T, Codec>::TreeNode*> TreeChunkFile<T, Codec>::findChunkRoots(
+  const TreeNode* rootNodePtr, std::size_t chunkNodes) {
+
+  std::vector<const TreeNode*> chunkRoots;
+  if (!rootNodePtr) return chunkRoots;
+
+  // A postorder walk, where each frame counts the nodes below it that
+  // aren't in a chunk yet. A child with enough of them is cut off as a
+  // chunk, and otherwise they're added to its parent's count. The chunks
+  // are found in postorder, so reversing them gives the preorder of their
+  // roots, with the root's chunk first.
+  struct Frame {
+    const TreeNode* node;
+    std::size_t nextChild;
+    std::size_t uncutNodes;
+  };
+  std::vector<Frame> path{Frame{rootNodePtr, 0, 1}};
+  while (!path.empty()) {
+    Frame& cur = path.back();
+    const auto& children = cur.node->childrenPtrs;
+    if (cur.nextChild < children.size()) {
+      const TreeNode* childPtr = children[cur.nextChild++];
+      if (childPtr) path.push_back(Frame{childPtr, 0, 1});
+      continue;
+    }
+
+    Frame done = cur;
+    path.pop_back();
+    if (path.empty() || done.uncutNodes >= chunkNodes) {
+      chunkRoots.push_back(done.node);
+    }
+    else {
+      path.back().uncutNodes += done.uncutNodes;
+    }
+  }
+  std::reverse(chunkRoots.begin(), chunkRoots.end());
+  return chunkRoots;
+}
+
+template <typename T, typename Codec>
+void TreeChunkFile<T, Codec>::encodeChunk(std::string& out, std::size_t chunk,
+  const std::vector<const TreeNode*>& chunkRoots, const std::unordered_map<const TreeNode*, std::size_t>& chunkNumbers,
+  std::vector<ChunkEntry>& entries, std::vector<Path>& places) {
+
+  // Each frame is a node whose child slots are being encoded, so the frames
+  // spell out the path from the chunk's root to the current node.
+  struct Frame {
+    const TreeNode* node;
+    std::size_t nextChild;
+  };
+  std::vector<Frame> path;
+  auto encodeNode = [&](const TreeNode* node) {
+    appendPod(out, NODE);
+    Codec::encode(out, node->data);
+    appendPod(out, static_cast<std::uint32_t>(node->childrenPtrs.size()));
+    path.push_back(Frame{node, 0});
+  };
+
+  encodeNode(chunkRoots[chunk]);
+  while (!path.empty()) {
+    Frame& cur = path.back();
+    const auto& children = cur.node->childrenPtrs;
+    if (cur.nextChild == children.size()) {
+      path.pop_back();
+      continue;
+    }
+    const TreeNode* childPtr = children[cur.nextChild++];
+
+    if (!childPtr) {
+      appendPod(out, NULL_SLOT);
+      continue;
+    }
+    auto found = chunkNumbers.find(childPtr);
+    if (chunkNumbers.end() == found) {
+      encodeNode(childPtr);
+      continue;
+    }
+
+    // Only this chunk refers to the other one, so no other thread touches
+    // its entry.
+    std::size_t other = found->second;
+    appendPod(out, CHUNK_REFERENCE);
+    appendPod(out, static_cast<std::uint64_t>(other));
+    entries[other].parent = chunk;
+    for (const Frame& frame : path) {
+      places[other].push_back(static_cast<std::uint32_t>(frame.nextChild - 1));
+    }
+  }
+}
+
+template <typename T, typename Codec>
+void TreeChunkFile<T, Codec>::write(const std::string& path, const GenericTree<T>& tree, std::size_t chunkNodes,
+  TreeThreadPool& pool) {
+
+  if (0 == chunkNodes) {
+    throw std::runtime_error("TreeChunkFile needs chunks of at least 1 node");
+  }
+
+  // The chunks are encoded on several threads, and loading isn't
+  // thread-safe, so load every placeholder up front.
+  tree.materializeAll();
+
+  const std::vector<const TreeNode*> chunkRoots = findChunkRoots(tree.getRootPtr(), chunkNodes);
+  std::unordered_map<const TreeNode*, std::size_t> chunkNumbers;
+  for (std::size_t i = 1; i < chunkRoots.size(); i++) {
+    chunkNumbers[chunkRoots[i]] = i;
+  }
+  std::vector<ChunkEntry> entries(chunkRoots.size(), ChunkEntry{0, 0, NO_PARENT});
+  std::vector<Path> places(chunkRoots.size());
+
+  Header header;
+  std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+  header.chunkNodes = chunkNodes;
+  header.chunkCount = chunkRoots.size();
+  header.indexOffset = 0;
+  header.indexLength = 0;
+
+  // Write to a temporary file next to the target, under a unique name so
+  // that two writers can't clobber each other's, and rename it into place
+  // at the end. The temporary file is removed again if anything fails.
+  std::string tempPath = path + ".XXXXXX";
+  int tempFd = mkstemp(&tempPath[0]);
+  if (tempFd < 0) {
+    throw std::runtime_error("Could not create a temporary file for " + path + ": " + std::strerror(errno));
+  }
+  bool modeSet = (0 == fchmod(tempFd, 0644));
+  close(tempFd);
+
+  try {
+    std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+    if (!modeSet || !file) {
+      throw std::runtime_error("Could not create " + tempPath);
+    }
+
+    // The header goes in last, once the index's place is known.
+    file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+    std::uint64_t nextOffset = sizeof(Header);
+
+    // Encode a batch of chunks in parallel, write them out, and move on to
+    // the next batch, reusing the buffers.
+    std::vector<std::string> batch;
+    for (std::size_t first = 0; first < chunkRoots.size(); first += WRITE_BATCH) {
+      std::size_t count = std::min(WRITE_BATCH, chunkRoots.size() - first);
+      batch.resize(count);
+      pool.parallelFor(count, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+          batch[i].clear();
+          encodeChunk(batch[i], first + i, chunkRoots, chunkNumbers, entries, places);
+        }
+      }, 1);
+      for (std::size_t i = 0; i < count; i++) {
+        entries[first + i].offset = nextOffset;
+        entries[first + i].length = batch[i].size();
+        file.write(batch[i].data(), batch[i].size());
+        nextOffset += batch[i].size();
+      }
+    }
+
+    std::string index;
+    for (std::size_t i = 0; i < entries.size(); i++) {
+      appendPod(index, entries[i].offset);
+      appendPod(index, entries[i].length);
+      appendPod(index, entries[i].parent);
+      appendPod(index, static_cast<std::uint32_t>(places[i].size()));
+      for (std::uint32_t step : places[i]) {
+        appendPod(index, step);
+      }
+    }
+    file.write(index.data(), index.size());
+
+    header.indexOffset = nextOffset;
+    header.indexLength = index.size();
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+    if (!file.flush()) {
+      throw std::runtime_error("Could not write " + tempPath);
+    }
+    file.close();
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+      throw std::runtime_error("Could not publish " + path + ": " + std::strerror(errno));
+    }
+  }
+  catch (...) {
+    unlink(tempPath.c_str());
+    throw;
+  }
+}
+
+template <typename T, typename Codec>
+TreeChunkFile<T, Codec>::TreeChunkFile(const std::string& path) : filePath(path), bytesRead(0) {
+
+  fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Could not open " + path + ": " + std::strerror(errno));
+  }
+
+  try {
+    struct stat fileInfo;
+    if (fstat(fd, &fileInfo) != 0) {
+      throw std::runtime_error("Could not read " + path + ": " + std::strerror(errno));
+    }
+    const std::uint64_t fileSize = static_cast<std::uint64_t>(fileInfo.st_size);
+
+    std::string headerBytes = readBytes(0, sizeof(Header));
+    Header header;
+    std::memcpy(&header, headerBytes.data(), sizeof(Header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0) {
+      throw std::runtime_error("Not a tree chunk file: " + path);
+    }
+
+    // Check every size against the file before using it, so that a damaged
+    // header can't make us allocate or read past the end. The index is the
+    // last thing in the file.
+    const std::string damaged = "Tree chunk file is damaged: " + path;
+    if (header.indexOffset < sizeof(Header) || header.indexOffset > fileSize ||
+        header.indexLength != fileSize - header.indexOffset ||
+        header.chunkCount > header.indexLength / MIN_INDEX_ENTRY) {
+      throw std::runtime_error(damaged);
+    }
+    minChunkNodes = static_cast<std::size_t>(header.chunkNodes);
+
+    std::string index = readBytes(header.indexOffset, header.indexLength);
+    const char* cur = index.data();
+    const char* end = cur + index.size();
+    chunks.resize(static_cast<std::size_t>(header.chunkCount));
+    for (std::size_t i = 0; i < chunks.size(); i++) {
+      ChunkEntry& chunk = chunks[i];
+      std::uint32_t placeLength = 0;
+      cur = readPod(cur, end, chunk.offset);
+      cur = readPod(cur, end, chunk.length);
+      cur = readPod(cur, end, chunk.parent);
+      cur = readPod(cur, end, placeLength);
+      // The root's chunk hangs from nothing, and every other chunk hangs
+      // somewhere below an earlier one.
+      bool placeOk = (0 == i) ? (NO_PARENT == chunk.parent && 0 == placeLength)
+                              : (chunk.parent < i && placeLength > 0);
+      if (chunk.offset < sizeof(Header) || chunk.offset > header.indexOffset ||
+          chunk.length > header.indexOffset - chunk.offset || !placeOk ||
+          placeLength > static_cast<std::size_t>(end - cur) / sizeof(std::uint32_t)) {
+        throw std::runtime_error(damaged);
+      }
+      if (0 == i) continue;
+
+      Path place(placeLength);
+      for (std::uint32_t& step : place) {
+        cur = readPod(cur, end, step);
+      }
+      chunkByPlace[std::make_pair(static_cast<std::size_t>(chunk.parent), std::move(place))] = i;
+    }
+  }
+  catch (...) {
+    close(fd);
+    throw;
+  }
+}
+
+template <typename T, typename Codec>
+std::string TreeChunkFile<T, Codec>::readBytes(std::uint64_t offset, std::uint64_t length) {
+  std::string bytes(length, '\0');
+  std::size_t done = 0;
+  while (done < length) {
+    ssize_t got = pread(fd, &bytes[done], length - done, static_cast<off_t>(offset + done));
+    if (got < 0 && EINTR == errno) continue;
+    if (got <= 0) {
+      throw std::runtime_error("Tree chunk file is truncated: " + filePath);
+    }
+    done += static_cast<std::size_t>(got);
+  }
+  bytesRead += length;
+  return bytes;
+}
+
+template <typename T, typename Codec>
+typename TreeChunkFile<T, Codec>::TreeNode* TreeChunkFile<T, Codec>::decodeNodes(const std::string& bytes,
+  std::vector<ChunkLink>* links) {
+
+  const char* cur = bytes.data();
+  const char* end = cur + bytes.size();
+  TreeNode* subtreeRoot = nullptr;
+
+  // Each frame is a node still waiting for some of its child slots.
+  struct PendingParent {
+    TreeNode* node;
+    std::uint32_t remaining;
+  };
+  std::stack<PendingParent> parents;
+
+  try {
+    do {
+      TreeNode* parent = parents.empty() ? nullptr : parents.top().node;
+      if (!parents.empty() && 0 == --parents.top().remaining) {
+        parents.pop();
+      }
+
+      std::uint8_t kind = 0;
+      cur = readPod(cur, end, kind);
+      TreeNode* node = nullptr;
+      if (NODE == kind) {
+        T data;
+        cur = Codec::decode(cur, end, data);
+        std::uint32_t childCount = 0;
+        cur = readPod(cur, end, childCount);
+        // Every child slot takes at least one byte, so a damaged count is
+        // caught here rather than by reserving room for billions of them.
+        if (childCount > static_cast<std::size_t>(end - cur)) {
+          throw std::runtime_error("Tree chunk has more child slots than it has room for");
+        }
+        node = new TreeNode(std::move(data));
+        node->parentPtr = parent;
+        node->childrenPtrs.reserve(childCount);
+        if (childCount > 0) {
+          parents.push(PendingParent{node, childCount});
+        }
+      }
+      else if (CHUNK_REFERENCE == kind && links && parent) {
+        std::uint64_t chunk = 0;
+        cur = readPod(cur, end, chunk);
+        links->push_back(ChunkLink{parent, parent->childrenPtrs.size(), static_cast<std::size_t>(chunk)});
+      }
+      else if (NULL_SLOT != kind || !parent) {
+        throw std::runtime_error("Tree chunk has an entry of an unexpected kind");
+      }
+
+      if (parent) {
+        parent->childrenPtrs.push_back(node);
+      }
+      else {
+        subtreeRoot = node;
+      }
+    } while (!parents.empty());
+  }
+  catch (...) {
+    deleteNodes(subtreeRoot);
+    throw;
+  }
+
+  return subtreeRoot;
+}
+
+template <typename T, typename Codec>
+void TreeChunkFile<T, Codec>::deleteNodes(TreeNode* subtreeRoot) {
+  std::vector<TreeNode*> nodesToDelete{subtreeRoot};
+  while (!nodesToDelete.empty()) {
+    TreeNode* cur = nodesToDelete.back();
+    nodesToDelete.pop_back();
+    if (!cur) continue;
+    nodesToDelete.insert(nodesToDelete.end(), cur->childrenPtrs.begin(), cur->childrenPtrs.end());
+    delete cur;
+  }
+}
+
+template <typename T, typename Codec>
+void TreeChunkFile<T, Codec>::adoptAsTree(GenericTree<T>& out, TreeNode* subtreeRoot) {
+  // The tree has to allocate its own root, so the data is moved into that,
+  // and the children are handed over to it.
+  out.clear();
+  TreeNode* rootNodePtr = out.createRoot(T());
+  rootNodePtr->data = std::move(subtreeRoot->data);
+  rootNodePtr->childrenPtrs.swap(subtreeRoot->childrenPtrs);
+  for (TreeNode* childPtr : rootNodePtr->childrenPtrs) {
+    if (childPtr) childPtr->parentPtr = rootNodePtr;
+  }
+  delete subtreeRoot;
+  out.markStructureChanged();
+}
+
+template <typename T, typename Codec>
+typename TreeChunkFile<T, Codec>::TreeNode* TreeChunkFile<T, Codec>::loadChunk(std::size_t chunk,
+  std::vector<ChunkLink>& links) {
+
+  const ChunkEntry& entry = chunks[chunk];
+  std::size_t firstLink = links.size();
+  TreeNode* chunkRoot = decodeNodes(readBytes(entry.offset, entry.length), &links);
+  for (std::size_t i = firstLink; i < links.size(); i++) {
+    if (links[i].chunk >= chunks.size() || chunks[links[i].chunk].parent != chunk) {
+      deleteNodes(chunkRoot);
+      throw std::runtime_error("Tree chunk file refers to a chunk that doesn't hang there: " + filePath);
+    }
+  }
+  return chunkRoot;
+}
+
+template <typename T, typename Codec>
+void TreeChunkFile<T, Codec>::loadSubtree(const Path& path, GenericTree<T>& out, TreeThreadPool& pool) {
+
+  bytesRead = 0;
+  if (chunks.empty()) {
+    if (!path.empty()) {
+      throw std::runtime_error("Tried to load a subtree at a path with no node");
+    }
+    out.clear();
+    return;
+  }
+
+  // Find the chunk holding the node, by following the chunks that hang
+  // along the path. Two chunks hanging from the same chunk can't be on one
+  // path, so the only candidate is the last place that sorts before the
+  // rest of the path.
+  std::size_t chunk = 0;
+  std::size_t step = 0;
+  while (step < path.size()) {
+    auto found = chunkByPlace.upper_bound(std::make_pair(chunk, Path(path.begin() + step, path.end())));
+    if (chunkByPlace.begin() == found) break;
+    --found;
+    const Path& place = found->first.second;
+    if (found->first.first != chunk || place.size() > path.size() - step ||
+        !std::equal(place.begin(), place.end(), path.begin() + step)) {
+      break;
+    }
+    chunk = found->second;
+    step += place.size();
+  }
+
+  std::vector<ChunkLink> links;
+  TreeNode* chunkRoot = loadChunk(chunk, links);
+  TreeNode* target = chunkRoot;
+  for (std::size_t i = step; target && i < path.size(); i++) {
+    target = (path[i] < target->childrenPtrs.size()) ? target->childrenPtrs[path[i]] : nullptr;
+  }
+  if (!target) {
+    deleteNodes(chunkRoot);
+    throw std::runtime_error("Tried to load a subtree at a path with no node");
+  }
+
+  if (target != chunkRoot) {
+    // Keep only the chunks that hang below the target, cut the target out,
+    // and throw away the rest of its chunk.
+    std::unordered_set<const TreeNode*> keep;
+    std::vector<const TreeNode*> pending{target};
+    while (!pending.empty()) {
+      const TreeNode* cur = pending.back();
+      pending.pop_back();
+      keep.insert(cur);
+      for (const TreeNode* childPtr : cur->childrenPtrs) {
+        if (childPtr) pending.push_back(childPtr);
+      }
+    }
+    std::vector<ChunkLink> keptLinks;
+    for (const ChunkLink& link : links) {
+      if (keep.count(link.parent)) keptLinks.push_back(link);
+    }
+    links.swap(keptLinks);
+
+    std::replace(target->parentPtr->childrenPtrs.begin(), target->parentPtr->childrenPtrs.end(),
+      target, static_cast<TreeNode*>(nullptr));
+    target->parentPtr = nullptr;
+    deleteNodes(chunkRoot);
+  }
+
+  // Load the chunks below a generation at a time, decoding each generation
+  // in parallel and then linking it in.
+  while (!links.empty()) {
+    std::vector<TreeNode*> chunkRoots(links.size(), nullptr);
+    std::vector< std::vector<ChunkLink> > nestedLinks(links.size());
+    try {
+      pool.parallelFor(links.size(), [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+          chunkRoots[i] = loadChunk(links[i].chunk, nestedLinks[i]);
+        }
+      }, 1);
+    }
+    catch (...) {
+      for (TreeNode* nestedRoot : chunkRoots) {
+        deleteNodes(nestedRoot);
+      }
+      deleteNodes(target);
+      throw;
+    }
+
+    std::vector<ChunkLink> nextLinks;
+    for (std::size_t i = 0; i < links.size(); i++) {
+      chunkRoots[i]->parentPtr = links[i].parent;
+      links[i].parent->childrenPtrs[links[i].slot] = chunkRoots[i];
+      nextLinks.insert(nextLinks.end(), nestedLinks[i].begin(), nestedLinks[i].end());
+    }
+    links.swap(nextLinks);
+  }
+  adoptAsTree(out, target);
+}
@@ -0,0 +1,163 @@
+
+#pragma once
+
+#include <cstddef> // for std::size_t
+#include <limits> // for std::numeric_limits
+#include <ostream> // for std::ostream
+#include <stack> // for std::stack
+#include <string> // for std::string
+
+#include "GenericTree.h"
+#include "TreeFormat.h"
+
+// -------------------------------------------------------------------
+// Exporting a GenericTree as a graph
+// -------------------------------------------------------------------
+
+// These exporters write a tree in formats that graph tools understand. They
+// all number the nodes in preorder as they go, starting from 0 at the root
+// of the exported subtree. Because the walk itself hands out the numbers,
+// each node's number is simply carried along with it on the exploration
+// stack, and no lookup table from nodes to numbers is ever needed.
+//
+// The output is collected in a large character buffer and handed to the
+// stream in big pieces. Null child slots are not exported.
+
+// TreeExportOptions: Which part of the tree to export.
+template <typename T>
+struct TreeExportOptions {
+  // Export only the subtree rooted here (null means the whole tree).
+  const typename GenericTree<T>::TreeNode* startNode = nullptr;
+  // Leave out nodes deeper than this, counting the start node as depth 0.
+  std::size_t maxDepth = std::numeric_limits<std::size_t>::max();
+};
+
+// appendEscapedTreeData: Appends an item's display text with backslashes,
+// double quotes, tabs and newlines escaped, so that it stays on one line and
+// can sit inside a quoted string.
+template <typename T>
+void appendEscapedTreeData(std::string& out, const T& data) {
+  thread_local std::string text;
+  text.clear();
+  appendTreeData(text, data);
+  for (char c : text) {
+    switch (c) {
+      case '\\': out += "\\\\"; break;
+      case '"': out += "\\\""; break;
+      case '\n': out += "\\n"; break;
+      case '\t': out += "\\t"; break;
+      default: out += c; break;
+    }
+  }
+}
+
+// forEachExportedNode: The preorder walk shared by the exporters. It calls
+// visit(node, id, parentId) for every exported node, where the root of the
+// export gets parentId == NO_PARENT.
+template <typename T, typename Visit>
+void forEachExportedNode(const GenericTree<T>& tree, const TreeExportOptions<T>& options, Visit visit) {
+
+  using TreeNode = typename GenericTree<T>::TreeNode;
+  constexpr std::size_t NO_PARENT = std::numeric_limits<std::size_t>::max();
+
+  const TreeNode* startNode = options.startNode ? options.startNode : tree.getRootPtr();
+  if (!startNode) return;
+
+  struct PendingNode {
+    const TreeNode* node;
+    std::size_t parentId;
+    std::size_t depth;
+  };
+  std::stack<PendingNode> nodesToExplore;
+  nodesToExplore.push(PendingNode{startNode, NO_PARENT, 0});
+  std::size_t nextId = 0;
+
+  while (!nodesToExplore.empty()) {
+    PendingNode cur = nodesToExplore.top();
+    nodesToExplore.pop();
+
+    std::size_t id = nextId++;
+    visit(cur.node, id, cur.parentId);
+
+    if (cur.depth >= options.maxDepth) continue;
+
+    const auto& children = tree.childrenOf(cur.node);
+    for (auto it = children.rbegin(); it != children.rend(); it++) {
+      if (*it) {
+        nodesToExplore.push(PendingNode{*it, id, cur.depth + 1});
+      }
+    }
+  }
+}
+
+// exportDot: Writes the tree in the Graphviz DOT language, as a directed
+// graph with an edge from each parent to each of its children.
+template <typename T>
+std::ostream& exportDot(const GenericTree<T>& tree, std::ostream& os,
+  const TreeExportOptions<T>& options = TreeExportOptions<T>()) {
+
+  using TreeNode = typename GenericTree<T>::TreeNode;
+  constexpr std::size_t FLUSH_SIZE = 1 << 20;
+  constexpr std::size_t NO_PARENT = std::numeric_limits<std::size_t>::max();
+
+  std::string buffer = "digraph tree {\n";
+
+  forEachExportedNode(tree, options, [&](const TreeNode* node, std::size_t id, std::size_t parentId) {
+    buffer += "  n";
+    appendTreeData(buffer, id);
+    buffer += " [label=\"";
+    appendEscapedTreeData(buffer, node->data);
+    buffer += "\"];\n";
+    if (NO_PARENT != parentId) {
+      buffer += "  n";
+      appendTreeData(buffer, parentId);
+      buffer += " -> n";
+      appendTreeData(buffer, id);
+      buffer += ";\n";
+    }
+    if (buffer.size() >= FLUSH_SIZE) {
+      os.write(buffer.data(), buffer.size());
+      buffer.clear();
+    }
+  });
+
+  buffer += "}\n";
+  os.write(buffer.data(), buffer.size());
+  return os;
+}
+
+// exportEdgeList: Writes one tab-separated line per node:
+//   id <TAB> parentId <TAB> label
+// The root of the export has parentId -1. Each line other than the root's
+// is one parent-to-child edge of the tree.
+template <typename T>
+std::ostream& exportEdgeList(const GenericTree<T>& tree, std::ostream& os,
+  const TreeExportOptions<T>& options = TreeExportOptions<T>()) {
+
+  using TreeNode = typename GenericTree<T>::TreeNode;
+  constexpr std::size_t FLUSH_SIZE = 1 << 20;
+  constexpr std::size_t NO_PARENT = std::numeric_limits<std::size_t>::max();
+
+  std::string buffer;
+
+  forEachExportedNode(tree, options, [&](const TreeNode* node, std::size_t id, std::size_t parentId) {
+    appendTreeData(buffer, id);
+    buffer += '\t';
+    if (NO_PARENT == parentId) {
+      buffer += "-1";
+    }
+    else {
+      appendTreeData(buffer, parentId);
+    }
+    buffer += '\t';
+    appendEscapedTreeData(buffer, node->data);
+    buffer += '\n';
+    if (buffer.size() >= FLUSH_SIZE) {
+      os.write(buffer.data(), buffer.size());
+      buffer.clear();
+    }
+  });
+
+  os.write(buffer.data(), buffer.size());
+  return os;
+}
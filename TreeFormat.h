@@ -0,0 +1,118 @@
+
+#pragma once
+
+#include <cstring> // for std::strlen
+#include <ostream> // for std::ostream
+#include <sstream> // for std::ostringstream
+#include <string> // for std::string
+#include <type_traits> // for std::enable_if, std::is_integral
+
+// -------------------------------------------------------------------
+// Formatting tree data as text
+// -------------------------------------------------------------------
+
+// TreeFormatter: Says how to display one data item of type T as text, by
+// appending characters to a buffer. All of the tree printers and exporters
+// go through this, instead of writing "os << node->data" for every node.
+//
+// The general version below falls back on the type's stream operator<<, so
+// any type that could be printed before still works. Faster versions are
+// provided for integers and strings, and you can add your own for other
+// types by specializing the template, for example:
+//
+//   template <>
+//   struct TreeFormatter<MyType> {
+//     static void append(std::string& out, const MyType& value) { ... }
+//   };
+//
+// Whatever a specialization appends should match what operator<< would
+// have written, so that the printed trees look the same either way.
+template <typename T, typename Enable = void>
+struct TreeFormatter {
+  static void append(std::string& out, const T& value) {
+    // Reuse one string stream per thread instead of constructing a new one
+    // (with its locale setup) for every single item.
+    thread_local std::ostringstream formatted;
+    formatted.str(std::string());
+    formatted.clear();
+    formatted << value;
+    out += formatted.str();
+  }
+};
+
+// Integers: convert the digits directly. The character types are left out
+// on purpose, because streams display those as characters, not numbers.
+template <typename T>
+struct TreeFormatter<T, typename std::enable_if<std::is_integral<T>::value
+  && !std::is_same<T, char>::value && !std::is_same<T, signed char>::value
+  && !std::is_same<T, unsigned char>::value && !std::is_same<T, bool>::value
+  && !std::is_same<T, wchar_t>::value && !std::is_same<T, char16_t>::value
+  && !std::is_same<T, char32_t>::value>::type> {
+
+  static void append(std::string& out, T value) {
+    using Unsigned = typename std::make_unsigned<T>::type;
+
+    // Enough room for the digits of any 64-bit value, plus a minus sign.
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    char* cur = end;
+
+    // Work with the magnitude as an unsigned number, so that the most
+    // negative value doesn't overflow when we negate it.
+    bool negative = value < 0;
+    Unsigned magnitude = static_cast<Unsigned>(value);
+    if (negative) {
+      magnitude = static_cast<Unsigned>(0) - magnitude;
+    }
+
+    do {
+      *--cur = static_cast<char>('0' + magnitude % 10);
+      magnitude /= 10;
+    } while (magnitude);
+
+    if (negative) {
+      *--cur = '-';
+    }
+    out.append(cur, end);
+  }
+};
+
+// Booleans display as 1 or 0, the same as an unmodified stream does.
+template <>
+struct TreeFormatter<bool> {
+  static void append(std::string& out, bool value) {
+    out += value ? '1' : '0';
+  }
+};
+
+// Strings: copy the characters straight into the buffer.
+template <>
+struct TreeFormatter<std::string> {
+  static void append(std::string& out, const std::string& value) {
+    out += value;
+  }
+};
+
+template <>
+struct TreeFormatter<const char*> {
+  static void append(std::string& out, const char* value) {
+    out.append(value, std::strlen(value));
+  }
+};
+
+// appendTreeData: Appends the display text for one data item to a buffer.
+template <typename T>
+void appendTreeData(std::string& out, const T& data) {
+  TreeFormatter<T>::append(out, data);
+}
+
+// writeTreeData: Writes the display text for one data item to a stream.
+// This is for places that only show a single item at a time, like the
+// debugging messages.
+template <typename T>
+std::ostream& writeTreeData(std::ostream& os, const T& data) {
+  thread_local std::string text;
+  text.clear();
+  TreeFormatter<T>::append(text, data);
+  return os.write(text.data(), text.size());
+}
@@ -0,0 +1,124 @@
+
+#pragma once
+
+#include <cstddef> // for std::size_t
+#include <limits> // for std::numeric_limits
+#include <stack> // for std::stack
+#include <unordered_map> // for std::unordered_map
+#include <vector> // for std::vector
+
+#include "GenericTree.h"
+
+// TreeLayout: A flattened snapshot of a GenericTree's structure.
+//
+// Every (non-null) node gets an index according to its preorder position,
+// so the root is index 0 and the nodes of any subtree occupy one contiguous
+// range of indices: a node at index i owns the range
+// [i, i + subtreeSizes[i]). Several of the other tree indices are built on
+// top of this, since it gives them subtree sizes, depths and parents in
+// plain arrays instead of by chasing pointers.
+//
+// The layout is only a snapshot. If the tree's structure changes afterward,
+// call rebuild() again before using it.
+template <typename T>
+class TreeLayout {
+public:
+  using TreeNode = typename GenericTree<T>::TreeNode;
+
+  // The parent index recorded for the root, and the result of indexOf for a
+  // node that isn't in the layout.
+  static constexpr std::size_t NO_INDEX = std::numeric_limits<std::size_t>::max();
+
+  // The nodes in preorder.
+  std::vector<TreeNode*> nodes;
+  // The preorder index of each node's parent (NO_INDEX for the root).
+  std::vector<std::size_t> parents;
+  // The depth of each node (the root has depth 0).
+  std::vector<std::size_t> depths;
+  // The number of nodes in each node's subtree, counting the node itself.
+  std::vector<std::size_t> subtreeSizes;
+  // The number of null child slots anywhere in each node's subtree.
+  std::vector<std::size_t> subtreeNullSlots;
+
+  // Default constructor: An empty layout.
+  TreeLayout() {}
+
+  // Constructor: Builds the layout for the given tree.
+  explicit TreeLayout(GenericTree<T>& tree) {
+    rebuild(tree);
+  }
+
+  // Rebuild the layout from scratch in one traversal of the tree.
+  void rebuild(GenericTree<T>& tree);
+
+  // The number of nodes in the layout.
+  std::size_t size() const {
+    return nodes.size();
+  }
+
+  // Look up a node's preorder index, or NO_INDEX if it isn't in the layout.
+  std::size_t indexOf(const TreeNode* node) const {
+    auto found = nodeIndex.find(node);
+    return (nodeIndex.end() == found) ? NO_INDEX : found->second;
+  }
+
+private:
+  std::unordered_map<const TreeNode*, std::size_t> nodeIndex;
+};
+
+template <typename T>
+constexpr std::size_t TreeLayout<T>::NO_INDEX;
+
+template <typename T>
+void TreeLayout<T>::rebuild(GenericTree<T>& tree) {
+
+  nodes.clear();
+  parents.clear();
+  depths.clear();
+  subtreeSizes.clear();
+  subtreeNullSlots.clear();
+  nodeIndex.clear();
+
+  TreeNode* rootNodePtr = tree.getRootPtr();
+  if (!rootNodePtr) return;
+
+  // Preorder walk with an explicit stack. Each entry remembers the index of
+  // its parent, which was already assigned when the parent was visited.
+  struct PendingNode {
+    TreeNode* node;
+    std::size_t parent;
+    std::size_t depth;
+  };
+  std::stack<PendingNode> nodesToExplore;
+  nodesToExplore.push(PendingNode{rootNodePtr, NO_INDEX, 0});
+
+  while (!nodesToExplore.empty()) {
+    PendingNode cur = nodesToExplore.top();
+    nodesToExplore.pop();
+
+    std::size_t index = nodes.size();
+    nodes.push_back(cur.node);
+    parents.push_back(cur.parent);
+    depths.push_back(cur.depth);
+    subtreeSizes.push_back(1);
+    subtreeNullSlots.push_back(0);
+    nodeIndex[cur.node] = index;
+
+    const auto& children = tree.childrenOf(cur.node);
+    for (auto it = children.rbegin(); it != children.rend(); it++) {
+      if (*it) {
+        nodesToExplore.push(PendingNode{*it, index, cur.depth + 1});
+      }
+      else {
+        subtreeNullSlots[index]++;
+      }
+    }
+  }
+
+  // In preorder every node comes after its parent, so a single backward
+  // pass can add each finished subtree into its parent's totals.
+  for (std::size_t i = nodes.size() - 1; i > 0; i--) {
+    subtreeSizes[parents[i]] += subtreeSizes[i];
+    subtreeNullSlots[parents[i]] += subtreeNullSlots[i];
+  }
+}
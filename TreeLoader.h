@@ -0,0 +1,550 @@
+
+#pragma once
+
+#include <algorithm> // for std::max
+#include <atomic> // for std::atomic
+#include <cerrno> // for errno
+#include <chrono> // for std::chrono::steady_clock
+#include <condition_variable> // for std::condition_variable
+#include <cstdint> // for std::uint64_t
+#include <cstdlib> // for std::strtod
+#include <cstring> // for std::memchr, std::strerror
+#include <exception> // for std::exception_ptr
+#include <iomanip> // for std::setprecision
+#include <limits> // for std::numeric_limits
+#include <map> // for std::map
+#include <mutex> // for std::mutex, std::unique_lock
+#include <ostream> // for std::ostream
+#include <sstream> // for std::istringstream
+#include <stdexcept> // for std::runtime_error
+#include <string> // for std::string
+#include <thread> // for std::thread
+#include <type_traits> // for std::enable_if, std::is_integral, std::is_signed
+#include <utility> // for std::move
+#include <vector> // for std::vector
+
+#include <fcntl.h> // for open
+#include <unistd.h> // for close, read
+
+#include "BoundedQueue.h"
+#include "GenericTree.h"
+#include "TreeFormat.h"
+
+// -------------------------------------------------------------------
+// Loading a tree from text with a multi-threaded pipeline
+// -------------------------------------------------------------------
+
+// The text format has one line per node, in preorder, giving the node's
+// depth, a single space, and then its data:
+//
+//   0 4
+//   1 8
+//   2 16
+//   3 42
+//   2 23
+//   1 15
+//
+// Each node is a child of the closest line above it that is one level
+// shallower. writeTreeText produces this format. Null child slots aren't
+// represented, and data whose text contains a line break can't be stored.
+
+// TreeTextParser: How to read one data item back from the text after the
+// depth. Returns false if the text isn't a valid item. The general version
+// uses the type's stream operator>>, and faster versions are provided for
+// integers, floating point numbers and strings (which take the whole rest
+// of the line). Specialize it for your own types like TreeFormatter.
+template <typename T, typename Enable = void>
+struct TreeTextParser {
+  static bool parse(const char* begin, const char* end, T& value) {
+    std::istringstream text(std::string(begin, end));
+    return static_cast<bool>(text >> value);
+  }
+};
+
+template <typename T>
+struct TreeTextParser<T, typename std::enable_if<std::is_integral<T>::value
+  && !std::is_same<T, char>::value && !std::is_same<T, signed char>::value
+  && !std::is_same<T, unsigned char>::value && !std::is_same<T, bool>::value>::type> {
+
+  static bool parse(const char* begin, const char* end, T& value) {
+    bool negative = (begin < end && '-' == *begin);
+    if (negative && !std::is_signed<T>::value) return false;
+    if (negative) begin++;
+    if (begin == end) return false;
+    // Each step is checked against T's range before it's taken, so a
+    // number that doesn't fit is rejected instead of overflowing.
+    using Limits = std::numeric_limits<T>;
+    T result = 0;
+    for (; begin < end; begin++) {
+      if (*begin < '0' || *begin > '9') return false;
+      T digit = static_cast<T>(*begin - '0');
+      if (negative) {
+        if (result < (Limits::min() + digit) / 10) return false;
+        result = static_cast<T>(result * 10 - digit);
+      }
+      else {
+        if (result > (Limits::max() - digit) / 10) return false;
+        result = static_cast<T>(result * 10 + digit);
+      }
+    }
+    value = result;
+    return true;
+  }
+};
+
+template <typename T>
+struct TreeTextParser<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+  static bool parse(const char* begin, const char* end, T& value) {
+    std::string text(begin, end);
+    char* parsedEnd = nullptr;
+    value = static_cast<T>(std::strtod(text.c_str(), &parsedEnd));
+    return !text.empty() && parsedEnd == text.c_str() + text.size();
+  }
+};
+
+template <>
+struct TreeTextParser<std::string> {
+  static bool parse(const char* begin, const char* end, std::string& value) {
+    value.assign(begin, end);
+    return true;
+  }
+};
+
+// writeTreeText: Writes a tree in the text format above, loading any
+// placeholders it comes across.
+template <typename T>
+std::ostream& writeTreeText(std::ostream& os, const GenericTree<T>& tree) {
+  using TreeNode = typename GenericTree<T>::TreeNode;
+  if (!tree.getRootPtr()) return os;
+
+  std::string buffer;
+  std::vector< std::pair<const TreeNode*, std::size_t> > nodesToExplore;
+  nodesToExplore.push_back(std::make_pair(tree.getRootPtr(), 0));
+  while (!nodesToExplore.empty()) {
+    const TreeNode* cur = nodesToExplore.back().first;
+    std::size_t depth = nodesToExplore.back().second;
+    nodesToExplore.pop_back();
+
+    appendTreeData(buffer, depth);
+    buffer += ' ';
+    appendTreeData(buffer, cur->data);
+    buffer += '\n';
+    if (buffer.size() >= (1 << 20)) {
+      os.write(buffer.data(), buffer.size());
+      buffer.clear();
+    }
+
+    const std::vector<TreeNode*>& children = tree.childrenOf(cur);
+    for (auto it = children.rbegin(); it != children.rend(); it++) {
+      if (*it) nodesToExplore.push_back(std::make_pair(*it, depth + 1));
+    }
+  }
+  return os.write(buffer.data(), buffer.size());
+}
+
+// Settings for loadTreeText.
+struct TreeLoadOptions {
+  // How many bytes the reader asks for at a time.
+  std::size_t blockSize = 4 << 20;
+  // How many threads parse blocks (0 means one per core, leaving one for
+  // the reader and one for the linker when there are enough cores).
+  std::size_t parserThreads = 0;
+  // How many blocks can wait between two stages. This is also how far
+  // ahead of the linker the parsers may get.
+  std::size_t queueCapacity = 16;
+};
+
+// How one stage of the pipeline spent its time. "busy" is time spent doing
+// the stage's own work, and "waiting" is time spent blocked on a queue
+// (waiting for input, or for room to pass output along). The stage whose
+// threads are busy the largest share of the time is the bottleneck.
+struct TreeLoadStageStats {
+  std::size_t threads = 0;
+  std::uint64_t bytes = 0;
+  std::uint64_t items = 0;
+  double busySeconds = 0;
+  double waitSeconds = 0;
+};
+
+struct TreeLoadStats {
+  TreeLoadStageStats read;
+  TreeLoadStageStats parse;
+  TreeLoadStageStats link;
+  std::uint64_t nodes = 0;
+  double totalSeconds = 0;
+};
+
+// Displays the throughput of every stage, one stage per line.
+inline std::ostream& operator<<(std::ostream& os, const TreeLoadStats& stats) {
+  auto showStage = [&os, &stats](const char* name, const TreeLoadStageStats& stage) {
+    double megabytes = static_cast<double>(stage.bytes) / (1 << 20);
+    // Per thread busy time, so the stages compare fairly.
+    double busy = stage.busySeconds / std::max<std::size_t>(1, stage.threads);
+    double wait = stage.waitSeconds / std::max<std::size_t>(1, stage.threads);
+    os << name << ": " << stage.threads << " thread(s), " << stage.items << " items, "
+      << (busy > 0 ? megabytes / busy : 0.0) << " MB/s while busy, "
+      << (stats.totalSeconds > 0 ? 100.0 * busy / stats.totalSeconds : 0.0) << "% busy, "
+      << wait << "s waiting" << std::endl;
+  };
+  std::ios::fmtflags oldFlags = os.flags();
+  std::streamsize oldPrecision = os.precision();
+  os << std::fixed << std::setprecision(1);
+  showStage("read ", stats.read);
+  showStage("parse", stats.parse);
+  showStage("link ", stats.link);
+  os << "total: " << stats.nodes << " nodes in " << std::setprecision(3) << stats.totalSeconds << "s" << std::endl;
+  os.flags(oldFlags);
+  os.precision(oldPrecision);
+  return os;
+}
+
+// loadTreeText: Replaces the contents of tree with the tree stored in the
+// text file at path, and returns how long each stage took.
+//
+// Loading runs as a three-stage pipeline connected by BoundedQueues, so
+// reading, parsing and building the tree all overlap:
+//   read: one thread reads the file in large blocks, cutting each block
+//     at its last line break (the partial line carries over to the next).
+//   parse: several threads turn blocks of text into arrays of depths and
+//     data items, independently of each other.
+//   link: the calling thread takes the parsed blocks back in file order and
+//     links the nodes into the tree, keeping the path of ancestors from the
+//     root to the latest node. A parser that gets queueCapacity blocks
+//     ahead of the linker waits, so that only that many blocks can be
+//     waiting for their turn.
+// Throws std::runtime_error, naming the line, if the text is malformed.
+template <typename T>
+TreeLoadStats loadTreeText(const std::string& path, GenericTree<T>& tree,
+  const TreeLoadOptions& options = TreeLoadOptions());
+
+// The pieces of loadTreeText. These are in a struct so that the template
+// function above can share them.
+template <typename T>
+struct TreeTextPipeline {
+  using Clock = std::chrono::steady_clock;
+
+  struct TextBlock {
+    std::size_t sequence = 0;
+    std::string text;
+  };
+
+  struct ParsedBlock {
+    std::size_t sequence = 0;
+    std::size_t lineCount = 0;
+    std::vector<std::size_t> depths;
+    std::vector<T> values;
+    // The blank lines in the block (counting from 0), which hold no node.
+    std::vector<std::size_t> blankLines;
+    // The first bad line in the block (counting from 0), if any.
+    bool failed = false;
+    std::size_t failedLine = 0;
+    std::string failure;
+  };
+
+  // Holds back parsed blocks that are too far ahead of the linker. Blocks
+  // can finish parsing out of order, and the linker has to keep the early
+  // ones until the blocks before them arrive; without a limit, one slow
+  // parser would let that pile grow without bound. The linker can't just
+  // stop taking blocks instead, because the one it needs might be stuck
+  // behind the others in the queue.
+  struct ReorderWindow {
+    std::mutex mutex;
+    std::condition_variable moved;
+    std::size_t nextToLink = 0;
+    std::size_t size;
+    bool stopped = false;
+
+    explicit ReorderWindow(std::size_t size) : size(std::max<std::size_t>(1, size)) {}
+
+    // Wait until the block with this sequence number is close enough to
+    // be handed over. Returns false if the pipeline is being shut down.
+    bool waitForTurn(std::size_t sequence) {
+      std::unique_lock<std::mutex> lock(mutex);
+      moved.wait(lock, [&]() { return stopped || sequence < nextToLink + size; });
+      return !stopped;
+    }
+
+    void advance(std::size_t next) {
+      std::unique_lock<std::mutex> lock(mutex);
+      nextToLink = next;
+      moved.notify_all();
+    }
+
+    void stop() {
+      std::unique_lock<std::mutex> lock(mutex);
+      stopped = true;
+      moved.notify_all();
+    }
+  };
+
+  static double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  // The line (counting from 0) in the block that held its node-th node.
+  static std::size_t lineOfNode(const ParsedBlock& parsed, std::size_t node) {
+    std::size_t line = node;
+    for (std::size_t blank : parsed.blankLines) {
+      if (blank > line) break;
+      line++;
+    }
+    return line;
+  }
+
+  static void parseBlock(const TextBlock& block, ParsedBlock& parsed) {
+    parsed.sequence = block.sequence;
+    const char* cur = block.text.data();
+    const char* end = cur + block.text.size();
+
+    while (cur < end) {
+      const char* lineEnd = static_cast<const char*>(std::memchr(cur, '\n', end - cur));
+      if (!lineEnd) lineEnd = end;
+      const char* contentEnd = (lineEnd > cur && '\r' == lineEnd[-1]) ? lineEnd - 1 : lineEnd;
+
+      if (contentEnd == cur) {
+        parsed.blankLines.push_back(parsed.lineCount);
+      }
+      else if (!parsed.failed) {
+        std::size_t depth = 0;
+        bool depthTooLarge = false;
+        const char* digit = cur;
+        for (; digit < contentEnd && *digit >= '0' && *digit <= '9'; digit++) {
+          std::size_t next = static_cast<std::size_t>(*digit - '0');
+          if (depth > (std::numeric_limits<std::size_t>::max() - next) / 10) {
+            depthTooLarge = true;
+          }
+          depth = depth * 10 + next;
+        }
+        T value;
+        if (depthTooLarge) {
+          parsed.failed = true;
+          parsed.failedLine = parsed.lineCount;
+          parsed.failure = "the depth is too large";
+        }
+        else if (digit == cur || digit == contentEnd || ' ' != *digit
+          || !TreeTextParser<T>::parse(digit + 1, contentEnd, value)) {
+          parsed.failed = true;
+          parsed.failedLine = parsed.lineCount;
+          parsed.failure = "expected a depth, a space and a data item";
+        }
+        else {
+          parsed.depths.push_back(depth);
+          parsed.values.push_back(std::move(value));
+        }
+      }
+      parsed.lineCount++;
+      cur = lineEnd + 1;
+    }
+  }
+};
+
+template <typename T>
+TreeLoadStats loadTreeText(const std::string& path, GenericTree<T>& tree, const TreeLoadOptions& options) {
+  using Pipeline = TreeTextPipeline<T>;
+  using TextBlock = typename Pipeline::TextBlock;
+  using ParsedBlock = typename Pipeline::ParsedBlock;
+  using Clock = std::chrono::steady_clock;
+  using TreeNode = typename GenericTree<T>::TreeNode;
+
+  Clock::time_point loadStart = Clock::now();
+  TreeLoadStats stats;
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Could not open " + path + ": " + std::strerror(errno));
+  }
+
+  std::size_t parserCount = options.parserThreads;
+  if (0 == parserCount) {
+    std::size_t cores = std::thread::hardware_concurrency();
+    parserCount = (cores > 3) ? cores - 2 : 1;
+  }
+  const std::size_t blockSize = std::max<std::size_t>(4096, options.blockSize);
+
+  BoundedQueue<TextBlock> textQueue(options.queueCapacity);
+  BoundedQueue<ParsedBlock> parsedQueue(options.queueCapacity);
+  typename Pipeline::ReorderWindow window(options.queueCapacity);
+  std::exception_ptr readError;
+
+  // Stage 1: read.
+  std::thread reader([&]() {
+    TreeLoadStageStats& stage = stats.read;
+    try {
+      std::string carry;
+      std::size_t sequence = 0;
+      while (true) {
+        Clock::time_point start = Clock::now();
+        TextBlock block;
+        block.sequence = sequence;
+        block.text.swap(carry);
+        std::size_t kept = block.text.size();
+        block.text.resize(kept + blockSize);
+        ssize_t got;
+        do {
+          got = ::read(fd, &block.text[kept], blockSize);
+        } while (got < 0 && EINTR == errno);
+        if (got < 0) {
+          throw std::runtime_error("Could not read " + path + ": " + std::strerror(errno));
+        }
+        block.text.resize(kept + static_cast<std::size_t>(got));
+        stage.bytes += static_cast<std::uint64_t>(got);
+        bool atEnd = (0 == got);
+
+        // Hold back the partial line at the end for the next block.
+        if (!atEnd) {
+          std::size_t lastBreak = block.text.rfind('\n');
+          std::size_t cut = (std::string::npos == lastBreak) ? 0 : lastBreak + 1;
+          carry.assign(block.text, cut, std::string::npos);
+          block.text.resize(cut);
+        }
+        stage.busySeconds += Pipeline::secondsSince(start);
+
+        if (!block.text.empty()) {
+          start = Clock::now();
+          bool pushed = textQueue.push(block);
+          stage.waitSeconds += Pipeline::secondsSince(start);
+          if (!pushed) break;
+          stage.items++;
+          sequence++;
+        }
+        if (atEnd) break;
+      }
+    }
+    catch (...) {
+      readError = std::current_exception();
+    }
+    textQueue.close();
+  });
+
+  // Stage 2: parse.
+  std::vector<TreeLoadStageStats> parserStats(parserCount);
+  std::atomic<std::size_t> parsersRunning(parserCount);
+  std::vector<std::thread> parsers;
+  for (std::size_t p = 0; p < parserCount; p++) {
+    parsers.emplace_back([&, p]() {
+      TreeLoadStageStats& stage = parserStats[p];
+      TextBlock block;
+      while (true) {
+        Clock::time_point start = Clock::now();
+        bool got = textQueue.pop(block);
+        stage.waitSeconds += Pipeline::secondsSince(start);
+        if (!got) break;
+
+        start = Clock::now();
+        ParsedBlock parsed;
+        Pipeline::parseBlock(block, parsed);
+        stage.bytes += block.text.size();
+        stage.items++;
+        stage.busySeconds += Pipeline::secondsSince(start);
+
+        start = Clock::now();
+        bool pushed = window.waitForTurn(parsed.sequence) && parsedQueue.push(parsed);
+        stage.waitSeconds += Pipeline::secondsSince(start);
+        if (!pushed) break;
+      }
+      // The last parser to finish ends the stream for the linker.
+      if (1 == parsersRunning.fetch_sub(1)) {
+        parsedQueue.close();
+      }
+    });
+  }
+
+  // Stage 3: link, on this thread. Blocks may arrive out of order, so the
+  // early ones wait in a map until their turn. The window keeps the map to
+  // at most queueCapacity blocks.
+  std::exception_ptr linkError;
+  try {
+    TreeLoadStageStats& stage = stats.link;
+    stage.threads = 1;
+    tree.clear();
+    std::vector<TreeNode*> ancestors;
+    std::map<std::size_t, ParsedBlock> waiting;
+    std::size_t nextSequence = 0;
+    std::size_t linesBefore = 0;
+    ParsedBlock parsed;
+
+    while (true) {
+      Clock::time_point start = Clock::now();
+      bool got = parsedQueue.pop(parsed);
+      stage.waitSeconds += Pipeline::secondsSince(start);
+      if (!got) break;
+
+      start = Clock::now();
+      std::size_t sequence = parsed.sequence;
+      waiting[sequence] = std::move(parsed);
+      std::size_t firstSequence = nextSequence;
+
+      for (auto next = waiting.find(nextSequence); waiting.end() != next; next = waiting.find(nextSequence)) {
+        ParsedBlock& ready = next->second;
+        if (ready.failed) {
+          throw std::runtime_error("Line " + std::to_string(linesBefore + ready.failedLine + 1)
+            + " of " + path + ": " + ready.failure);
+        }
+
+        for (std::size_t i = 0; i < ready.depths.size(); i++) {
+          std::size_t depth = ready.depths[i];
+          auto depthError = [&](const std::string& what) {
+            return std::runtime_error("Line " + std::to_string(linesBefore + Pipeline::lineOfNode(ready, i) + 1)
+              + " of " + path + ": " + what);
+          };
+          if (ancestors.empty()) {
+            if (0 != depth) {
+              throw depthError("the first node must have depth 0");
+            }
+            ancestors.push_back(tree.createRoot(ready.values[i]));
+            continue;
+          }
+          if (0 == depth) {
+            throw depthError("only the first node can have depth 0");
+          }
+          if (depth > ancestors.size()) {
+            throw depthError("a node at depth " + std::to_string(depth) + " has no parent at depth "
+              + std::to_string(depth - 1));
+          }
+          ancestors.resize(depth);
+          ancestors.push_back(ancestors.back()->addChild(std::move(ready.values[i])));
+        }
+
+        stage.items += ready.depths.size();
+        linesBefore += ready.lineCount;
+        waiting.erase(next);
+        nextSequence++;
+      }
+      if (nextSequence != firstSequence) {
+        window.advance(nextSequence);
+      }
+      stage.busySeconds += Pipeline::secondsSince(start);
+    }
+    stats.nodes = stats.link.items;
+  }
+  catch (...) {
+    linkError = std::current_exception();
+    textQueue.cancel();
+    parsedQueue.cancel();
+    window.stop();
+  }
+
+  reader.join();
+  for (auto& parser : parsers) {
+    parser.join();
+  }
+  ::close(fd);
+
+  if (readError || linkError) {
+    tree.clear();
+    std::rethrow_exception(readError ? readError : linkError);
+  }
+
+  tree.markStructureChanged();
+  stats.read.threads = 1;
+  stats.parse.threads = parserCount;
+  for (const auto& stage : parserStats) {
+    stats.parse.bytes += stage.bytes;
+    stats.parse.items += stage.items;
+    stats.parse.busySeconds += stage.busySeconds;
+    stats.parse.waitSeconds += stage.waitSeconds;
+  }
+  stats.link.bytes = stats.parse.bytes;
+  stats.totalSeconds = Pipeline::secondsSince(loadStart);
+  return stats;
+}
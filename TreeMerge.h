@@ -0,0 +1,167 @@
+
+#pragma once
+
+#include <cstddef> // for std::size_t
+#include <exception> // for std::exception_ptr, std::current_exception, std::rethrow_exception
+#include <functional> // for std::hash, std::equal_to
+#include <stdexcept> // for std::runtime_error
+#include <unordered_map> // for std::unordered_map
+#include <vector> // for std::vector
+
+#include "GenericTree.h"
+
+// mergeInto: Merge the tree src into dst, taking the union of the two
+// hierarchies. The roots are unified (dst keeps its own root data, or
+// gets a copy of src's if it's empty), and then, level by level, each
+// child of a unified src node is unified with the child of the matching
+// dst node that has equal data. A src child with no match is moved over
+// whole, becoming the rightmost child of the dst node. For example,
+// merging the tree on the right into the one on the left
+//
+//   /            /
+//   |_ usr       |_ usr
+//   |  |_ bin    |  |_ lib
+//   |_ etc       |_ var
+//
+// gives / with children usr (with children bin and lib), etc and var.
+//
+// Nothing is copied: unmatched subtrees are spliced over by relinking a
+// pointer, however large they are, and unified src nodes are simply
+// destroyed. So the work is proportional to the children of the nodes that
+// match, not to the size of either tree. Children are matched through a
+// hash table on their data (hashed with Hash, compared with Equal), except
+// that small child lists are just compared pairwise, which is faster.
+//
+// If one parent has several children with equal data, the first of them
+// is the one that gets matched. Two src siblings with equal data both end
+// up unified into the same dst child. Null child slots in dst stay where
+// they are.
+//
+// Placeholders in src are loaded (with src's child loader) as the merge
+// reaches them, and so are any that were moved over, since their keys
+// would mean nothing to dst's loader; see GenericTree::absorbRemainsOf.
+//
+// If a loader throws, the merge stops there and the error is passed on,
+// with dst keeping whatever was merged into it so far.
+//
+// src is left empty, and dst's structure version is bumped. Pointers to
+// dst's nodes stay valid, and so do pointers to src's nodes that were moved
+// over. Returns the number of subtrees that were moved over.
+template <typename T, typename Hash = std::hash<T>, typename Equal = std::equal_to<T> >
+std::size_t mergeInto(GenericTree<T>& dst, GenericTree<T>& src, Hash hash = Hash(), Equal equal = Equal()) {
+  using TreeNode = typename GenericTree<T>::TreeNode;
+
+  if (&dst == &src) {
+    throw std::runtime_error("Tried to merge a tree into itself");
+  }
+  if (!src.getRootPtr()) return 0;
+  if (!dst.getRootPtr()) {
+    dst.createRoot(src.getRootPtr()->data);
+  }
+
+  // Below this many child pairs to compare, a plain double loop beats
+  // building a hash table.
+  constexpr std::size_t PAIRWISE_LIMIT = 64;
+
+  // Children are looked up by a pointer to their data, so that the data
+  // itself isn't copied into the table.
+  struct DataHash {
+    Hash hash;
+    std::size_t operator()(const T* data) const { return hash(*data); }
+  };
+  struct DataEqual {
+    Equal equal;
+    bool operator()(const T* a, const T* b) const { return equal(*a, *b); }
+  };
+  struct Match {
+    TreeNode* node;
+    bool cameFromSrc;
+  };
+  std::unordered_map<const T*, Match, DataHash, DataEqual> childrenByData(16, DataHash{hash}, DataEqual{equal});
+
+  // A pair of nodes to unify. A node moved over from src still has its lazy
+  // loading state in src until the end, so it's loaded through src; the
+  // same goes for its descendants.
+  struct MergePair {
+    TreeNode* into;
+    TreeNode* from;
+    bool intoCameFromSrc;
+  };
+  std::vector<MergePair> pairsToMerge{MergePair{dst.getRootPtr(), src.getRootPtr(), false}};
+  std::size_t movedCount = 0;
+
+  // If a loader throws partway, subtrees already spliced into dst may live
+  // in src's node blocks, so dst still has to take the blocks over before
+  // the error is passed on.
+  try {
+    // The pairs are handled in the order they're found, level by level, so
+    // that moved children land in the same order as they appear in src.
+    for (std::size_t next = 0; next < pairsToMerge.size(); next++) {
+      MergePair pair = pairsToMerge[next];
+
+      const std::vector<TreeNode*>& fromChildren = src.childrenOf(pair.from);
+      if (fromChildren.empty()) continue;
+      const std::vector<TreeNode*>& intoChildren = (pair.intoCameFromSrc ? src : dst).childrenOf(pair.into);
+
+      // Find where a child of "from" should go: the matching child of
+      // "into", or null if there isn't one. Children spliced over below can
+      // be matched too, by later siblings with equal data, and they came
+      // from src.
+      std::size_t originalCount = intoChildren.size();
+      bool usePairwise = (originalCount + fromChildren.size()) * fromChildren.size() <= PAIRWISE_LIMIT;
+      if (!usePairwise) {
+        childrenByData.clear();
+        for (TreeNode* childPtr : intoChildren) {
+          // emplace keeps the first of several equal children.
+          if (childPtr) childrenByData.emplace(&childPtr->data, Match{childPtr, pair.intoCameFromSrc});
+        }
+      }
+      auto findMatch = [&](const TreeNode* child) -> Match {
+        if (usePairwise) {
+          const std::vector<TreeNode*>& candidates = pair.into->childrenPtrs;
+          for (std::size_t i = 0; i < candidates.size(); i++) {
+            if (candidates[i] && equal(candidates[i]->data, child->data)) {
+              return Match{candidates[i], pair.intoCameFromSrc || i >= originalCount};
+            }
+          }
+          return Match{nullptr, false};
+        }
+        auto found = childrenByData.find(&child->data);
+        return (found == childrenByData.end()) ? Match{nullptr, false} : found->second;
+      };
+
+      for (TreeNode*& childPtr : pair.from->childrenPtrs) {
+        if (!childPtr) continue;
+        Match match = findMatch(childPtr);
+        if (match.node) {
+          pairsToMerge.push_back(MergePair{match.node, childPtr, match.cameFromSrc});
+          continue;
+        }
+
+        // Splice the whole subtree over, and leave a null slot behind in
+        // src so that clearing src doesn't delete it.
+        childPtr->parentPtr = pair.into;
+        pair.into->childrenPtrs.push_back(childPtr);
+        if (!usePairwise) {
+          childrenByData.emplace(&childPtr->data, Match{childPtr, true});
+        }
+        childPtr = nullptr;
+        movedCount++;
+      }
+    }
+  }
+  catch (...) {
+    std::exception_ptr loadError = std::current_exception();
+    try {
+      dst.absorbRemainsOf(src);
+    }
+    catch (...) {
+      // The first error is the one to report; absorbRemainsOf has still
+      // finished moving everything over.
+    }
+    std::rethrow_exception(loadError);
+  }
+
+  dst.absorbRemainsOf(src);
+  return movedCount;
+}
@@ -0,0 +1,312 @@
+
+#pragma once
+
+#include <algorithm> // for std::min
+#include <cstddef> // for std::size_t
+#include <limits> // for std::numeric_limits
+#include <ostream> // for std::ostream
+#include <stack> // for std::stack
+#include <string> // for std::string
+#include <vector> // for std::vector
+
+#include "GenericTree.h"
+#include "TreeLayout.h"
+#include "TreeThreadPool.h"
+
+// -------------------------------------------------------------------
+// Additional ways to print a GenericTree
+// -------------------------------------------------------------------
+
+// These functions produce the same vertical text format as
+// GenericTree::Print (see the notes on renderTreeLines in GenericTree.h).
+
+// printParallel: Prints the tree exactly like GenericTree::Print does, but
+// renders large subtrees concurrently on the thread pool.
+//
+// The text for a subtree only depends on the margin it inherits from its
+// ancestors, so once we know that margin, each subtree can be rendered into
+// its own buffer independently. We walk the top few levels of the tree
+// serially, hand off every subtree below a chosen split depth as a separate
+// task, and then write all of the pieces out in their original order. The
+// output is byte-for-byte identical to Print.
+template <typename T>
+std::ostream& printParallel(const GenericTree<T>& tree, std::ostream& os,
+  TreeThreadPool& pool = TreeThreadPool::shared()) {
+
+  using TreeNode = typename GenericTree<T>::TreeNode;
+
+  const TreeNode* rootNodePtr = tree.getRootPtr();
+
+  // The empty tree and the debugging display don't benefit from this.
+  if (!rootNodePtr || tree.showDebugMessages) {
+    return tree.Print(os);
+  }
+
+  // Load any placeholders now, since the pieces are rendered in parallel.
+  tree.materializeAll();
+
+  // Pick the split depth: the first level that has enough nodes to keep
+  // every thread busy. We stop looking after a bounded number of levels, so
+  // that a long thin tree doesn't get walked twice.
+  constexpr std::size_t MAX_SPLIT_DEPTH = 32;
+  const std::size_t wantedTasks = (pool.size() + 1) * 8;
+  std::size_t splitDepth = 0;
+  {
+    std::vector<const TreeNode*> level(1, rootNodePtr);
+    while (level.size() < wantedTasks && splitDepth < MAX_SPLIT_DEPTH) {
+      std::vector<const TreeNode*> nextLevel;
+      for (const TreeNode* node : level) {
+        for (const TreeNode* child : node->childrenPtrs) {
+          if (child) nextLevel.push_back(child);
+        }
+      }
+      if (nextLevel.empty()) break;
+      level.swap(nextLevel);
+      splitDepth++;
+    }
+    if (level.size() < 2) {
+      // There's nothing worth splitting up.
+      return tree.Print(os);
+    }
+  }
+
+  // One subtree that will be rendered by a worker. Its text goes into the
+  // output piece with the given index.
+  struct SubtreeTask {
+    const TreeNode* node;
+    std::string linePrefix;
+    bool isLast;
+    std::size_t pieceIndex;
+  };
+
+  // The output in order: pieces of text rendered here for the top levels,
+  // interleaved with the (initially empty) pieces that tasks will fill in.
+  std::vector<std::string> pieces(1);
+  std::vector<SubtreeTask> tasks;
+
+  // Walk the levels above the split depth serially, just like
+  // renderTreeLines does, but cut off each subtree at the split depth.
+  struct PendingNode {
+    const TreeNode* node;
+    std::size_t depth;
+    std::size_t prefixLength;
+    bool isLast;
+  };
+  std::string prefix;
+  std::stack<PendingNode> nodesToExplore;
+  nodesToExplore.push(PendingNode{rootNodePtr, 0, 0, true});
+
+  while (!nodesToExplore.empty()) {
+    PendingNode cur = nodesToExplore.top();
+    nodesToExplore.pop();
+    prefix.resize(cur.prefixLength);
+
+    if (cur.node && cur.depth == splitDepth) {
+      tasks.push_back(SubtreeTask{cur.node, prefix, cur.isLast, pieces.size()});
+      pieces.emplace_back();
+      pieces.emplace_back();
+      continue;
+    }
+
+    bool isRoot = (0 == cur.depth);
+    appendTreeNodeLines(pieces.back(), prefix, isRoot, cur.node ? &cur.node->data : nullptr);
+
+    if (!cur.node) continue;
+
+    const auto& children = cur.node->childrenPtrs;
+    if (children.empty()) continue;
+    if (!isRoot) {
+      prefix += cur.isLast ? "   " : "|  ";
+    }
+    for (std::size_t i = children.size(); i > 0; i--) {
+      nodesToExplore.push(PendingNode{children[i-1], cur.depth + 1, prefix.size(), i == children.size()});
+    }
+  }
+
+  // Render the tasks in batches, writing each batch out (in order) before
+  // starting the next one. This keeps the amount of text held in memory at
+  // once proportional to the batch, not to the whole tree.
+  const std::size_t batchSize = wantedTasks;
+  std::size_t piecesWritten = 0;
+
+  for (std::size_t batchBegin = 0; batchBegin < tasks.size(); batchBegin += batchSize) {
+    std::size_t batchEnd = std::min(tasks.size(), batchBegin + batchSize);
+
+    pool.parallelFor(batchEnd - batchBegin, [&](std::size_t begin, std::size_t end) {
+      for (std::size_t i = batchBegin + begin; i < batchBegin + end; i++) {
+        const SubtreeTask& task = tasks[i];
+        renderTreeLines(pieces[task.pieceIndex], task.node, task.linePrefix, false, task.isLast, nullptr);
+      }
+    }, 1);
+
+    std::size_t writeEnd = (batchEnd == tasks.size()) ? pieces.size() : tasks[batchEnd].pieceIndex;
+    for (; piecesWritten < writeEnd; piecesWritten++) {
+      os.write(pieces[piecesWritten].data(), pieces[piecesWritten].size());
+      std::string().swap(pieces[piecesWritten]);
+    }
+  }
+
+  for (; piecesWritten < pieces.size(); piecesWritten++) {
+    os.write(pieces[piecesWritten].data(), pieces[piecesWritten].size());
+  }
+
+  return os;
+}
+
+// TreePrintOptions: Limits on how much of a tree printLimited displays.
+// The defaults display everything, just like Print.
+template <typename T>
+struct TreePrintOptions {
+  // Nodes deeper than this (counting the starting node as depth 0) are
+  // summarized instead of displayed.
+  std::size_t maxDepth = std::numeric_limits<std::size_t>::max();
+  // At most this many children are displayed under any one node; the rest
+  // are summarized with a single "... N more" line.
+  std::size_t maxChildren = std::numeric_limits<std::size_t>::max();
+  // Display only the subtree rooted here (null means the whole tree).
+  const typename GenericTree<T>::TreeNode* startNode = nullptr;
+  // Display only the output lines numbered [firstLine, firstLine+lineCount),
+  // counting from 0.
+  std::size_t firstLine = 0;
+  std::size_t lineCount = std::numeric_limits<std::size_t>::max();
+  // Optional cached subtree sizes. When this is given, and the depth and
+  // child limits aren't in use, whole subtrees that end before firstLine
+  // are skipped without being walked at all. It must be up to date.
+  const TreeLayout<T>* layout = nullptr;
+};
+
+// printLimited: Prints part of a tree in the same format as Print, under
+// the limits given in the options. Each node that has children cut off by
+// the depth or child limits gets a "... N more" line in place of them,
+// where N is the number of child slots that were left out.
+template <typename T>
+std::ostream& printLimited(const GenericTree<T>& tree, std::ostream& os,
+  const TreePrintOptions<T>& options) {
+
+  using TreeNode = typename GenericTree<T>::TreeNode;
+
+  constexpr std::size_t FLUSH_SIZE = 1 << 20;
+  constexpr std::size_t NO_LIMIT = std::numeric_limits<std::size_t>::max();
+
+  const TreeNode* startNode = options.startNode ? options.startNode : tree.getRootPtr();
+  if (!startNode) {
+    return os << "[empty tree]" << std::endl;
+  }
+
+  // The window of line numbers to display. (Careful not to overflow when
+  // the line count is unlimited.)
+  const std::size_t firstLine = options.firstLine;
+  const std::size_t endLine = (options.lineCount > NO_LIMIT - firstLine)
+    ? NO_LIMIT : firstLine + options.lineCount;
+
+  // Cached sizes only tell us how many lines a subtree takes up when nothing
+  // inside it gets summarized.
+  const bool canSkipBySize = options.layout
+    && NO_LIMIT == options.maxDepth && NO_LIMIT == options.maxChildren;
+
+  std::string buffer;
+  std::string prefix;
+  std::size_t lineNumber = 0;
+
+  // Append one complete output line if it falls inside the window.
+  auto emitLine = [&](const std::string& linePrefix, const char* stem, const std::string& text) {
+    if (lineNumber >= firstLine && lineNumber < endLine) {
+      buffer += linePrefix;
+      buffer += stem;
+      buffer += text;
+      buffer += '\n';
+    }
+    lineNumber++;
+  };
+
+  // Entries on the stack are either nodes (which may be null slots), or
+  // summary lines standing in for children that were left out.
+  struct PendingNode {
+    const TreeNode* node;
+    std::size_t depth;
+    std::size_t prefixLength;
+    bool isLast;
+    std::size_t omittedCount; // nonzero for a summary line
+  };
+  std::stack<PendingNode> nodesToExplore;
+  nodesToExplore.push(PendingNode{startNode, 0, 0, true, 0});
+
+  std::string text;
+
+  while (!nodesToExplore.empty() && lineNumber < endLine) {
+    PendingNode cur = nodesToExplore.top();
+    nodesToExplore.pop();
+    prefix.resize(cur.prefixLength);
+
+    const bool isRoot = (0 == cur.depth);
+
+    if (canSkipBySize && cur.node && !isRoot) {
+      // Every node below the display root takes two lines, and so does
+      // every null slot.
+      std::size_t index = options.layout->indexOf(cur.node);
+      if (TreeLayout<T>::NO_INDEX != index) {
+        std::size_t subtreeLines = 2 * (options.layout->subtreeSizes[index]
+          + options.layout->subtreeNullSlots[index]);
+        if (lineNumber + subtreeLines <= firstLine) {
+          lineNumber += subtreeLines;
+          continue;
+        }
+      }
+    }
+
+    text.clear();
+    if (cur.omittedCount) {
+      text += "... ";
+      text += std::to_string(cur.omittedCount);
+      text += " more";
+    }
+    else if (cur.node) {
+      appendTreeData(text, cur.node->data);
+    }
+    else {
+      text += "[null]";
+    }
+
+    if (isRoot) {
+      emitLine(prefix, "", text);
+    }
+    else {
+      emitLine(prefix, "|", std::string());
+      emitLine(prefix, "|_ ", text);
+    }
+
+    if (buffer.size() >= FLUSH_SIZE) {
+      os.write(buffer.data(), buffer.size());
+      buffer.clear();
+    }
+
+    if (!cur.node || cur.omittedCount) continue;
+
+    const auto& children = tree.childrenOf(cur.node);
+    if (children.empty()) continue;
+
+    if (!isRoot) {
+      prefix += cur.isLast ? "   " : "|  ";
+    }
+
+    // Decide how many children to show, and how many to summarize.
+    std::size_t shownCount = std::min(children.size(), options.maxChildren);
+    if (cur.depth >= options.maxDepth) {
+      shownCount = 0;
+    }
+    std::size_t omittedCount = children.size() - shownCount;
+
+    // Push in reverse display order: the summary line goes below the
+    // children that are shown.
+    if (omittedCount) {
+      nodesToExplore.push(PendingNode{nullptr, cur.depth + 1, prefix.size(), true, omittedCount});
+    }
+    for (std::size_t i = shownCount; i > 0; i--) {
+      bool isLast = (i == shownCount) && (0 == omittedCount);
+      nodesToExplore.push(PendingNode{children[i-1], cur.depth + 1, prefix.size(), isLast, 0});
+    }
+  }
+
+  os.write(buffer.data(), buffer.size());
+  return os;
+}
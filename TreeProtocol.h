@@ -0,0 +1,107 @@
+
+#pragma once
+
+#include <cstddef> // for std::size_t
+#include <cstdint> // for std::uint16_t, std::uint32_t
+#include <cstring> // for std::memcpy
+#include <string> // for std::string
+
+// -------------------------------------------------------------------
+// Binary protocol for the local tree query server
+// -------------------------------------------------------------------
+
+// The tree server (tree_server.cpp) and its load generator
+// (tree_loadgen.cpp) talk over a Unix domain socket using small binary
+// frames. Both ends are on the same host, so every integer is sent in the
+// host's native byte order, without any conversion.
+//
+// A client may send many requests in a row without waiting for replies
+// (pipelining). The server answers the requests from one connection in the
+// order they were sent, and every response carries the requestId of the
+// request it answers.
+//
+// Nodes are identified by their preorder number in the tree (the root is 0),
+// which is the same numbering that TreeLayout uses.
+
+namespace TreeProtocol {
+
+// The operations a client can ask for.
+enum Opcode : std::uint16_t {
+  // Reply with an empty payload. (Useful for measuring overhead.)
+  OP_PING = 1,
+  // Reply with the node count of the tree, as one uint32.
+  OP_INFO = 2,
+  // Reply with the data of the subtree rooted at nodeId in level order.
+  // The argument is the maximum number of items to return.
+  OP_LEVELS = 3,
+  // Reply with the data of the subtree rooted at nodeId in preorder.
+  // The argument is the maximum number of items to return.
+  OP_SUBTREE = 4,
+  // Reply with one byte: 1 if nodeId is an ancestor of (or the same node
+  // as) the node given by the argument, or 0 otherwise.
+  OP_IS_ANCESTOR = 5,
+  // Replace the tree with the given treeId. The payload holds a node count
+  // n, then n int32 data values in level order, then n uint32 child counts.
+  OP_LOAD = 6
+};
+
+// Status codes in responses.
+enum Status : std::uint16_t {
+  STATUS_OK = 0,
+  STATUS_NO_SUCH_TREE = 1,
+  STATUS_NO_SUCH_NODE = 2,
+  STATUS_BAD_REQUEST = 3
+};
+
+// Every request starts with this header, followed by payloadLength bytes.
+struct RequestHeader {
+  std::uint32_t payloadLength;
+  std::uint32_t requestId;
+  std::uint16_t opcode;
+  std::uint16_t treeId;
+  std::uint32_t nodeId;
+  std::uint32_t argument;
+};
+
+// Every response starts with this header, followed by payloadLength bytes.
+// List replies (OP_LEVELS and OP_SUBTREE) hold a sequence of int32 values.
+struct ResponseHeader {
+  std::uint32_t payloadLength;
+  std::uint32_t requestId;
+  std::uint16_t status;
+  std::uint16_t reserved;
+};
+
+// Frames larger than this are rejected, so that a broken client can't make
+// the server buffer unlimited amounts of data.
+constexpr std::uint32_t MAX_PAYLOAD = 64u << 20;
+
+// Append a fixed-size header or value to a byte buffer.
+template <typename Plain>
+void appendBytes(std::string& buffer, const Plain& value) {
+  buffer.append(reinterpret_cast<const char*>(&value), sizeof(Plain));
+}
+
+// Append a complete request frame to a byte buffer.
+inline void appendRequest(std::string& buffer, const RequestHeader& header,
+  const char* payload = nullptr) {
+  appendBytes(buffer, header);
+  if (header.payloadLength) {
+    buffer.append(payload, header.payloadLength);
+  }
+}
+
+// Try to read one complete frame from the start of data[0..size). On
+// success, copies out the header, points payload at the frame's payload,
+// and returns the total frame size. Returns 0 if more bytes are needed.
+template <typename Header>
+std::size_t parseFrame(const char* data, std::size_t size, Header& header, const char*& payload) {
+  if (size < sizeof(Header)) return 0;
+  std::memcpy(&header, data, sizeof(Header));
+  std::size_t frameSize = sizeof(Header) + header.payloadLength;
+  if (size < frameSize) return 0;
+  payload = data + sizeof(Header);
+  return frameSize;
+}
+
+} // namespace TreeProtocol
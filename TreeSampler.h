@@ -0,0 +1,194 @@
+
+#pragma once
+
+#include <algorithm> // for std::upper_bound
+#include <cstddef> // for std::size_t
+#include <functional> // for std::function
+#include <random> // for std::uniform_int_distribution, std::uniform_real_distribution
+#include <stdexcept> // for std::runtime_error
+#include <vector> // for std::vector
+
+#include "GenericTree.h"
+#include "TreeLayout.h"
+
+// TreeSampler: Draws random nodes from a tree, either uniformly or in
+// proportion to a weight computed from each node's data, optionally
+// restricted to one subtree.
+//
+// Drawing by descending from the root (picking each child in proportion to
+// its cached subtree size) would take O(depth) steps per draw. Since a
+// TreeLayout numbers the nodes in preorder, every subtree is already one
+// contiguous range of indices, so a uniform draw is just a random index in
+// that range, in O(1). A weighted draw is a binary search in the prefix sums
+// of the weights over the same range, in O(log n). Batches of draws reuse
+// the same arrays, so no traversal happens per batch.
+//
+// The layout is rebuilt lazily when the tree's structureVersion() changes.
+// The weights are computed from the data when setWeights is called (and
+// again after a rebuild), so call refreshWeights() after changing node data
+// that the weights depend on.
+template <typename T>
+class TreeSampler {
+public:
+  using TreeNode = typename GenericTree<T>::TreeNode;
+
+  explicit TreeSampler(GenericTree<T>& tree) : tree(tree), builtVersion(0), isBuilt(false) {}
+
+  // Draw one node uniformly from the whole tree, or from the subtree rooted
+  // at subtreeRoot if given. Returns nullptr if the tree is empty.
+  template <typename URNG>
+  TreeNode* sample(URNG& random, const TreeNode* subtreeRoot = nullptr) {
+    refresh();
+    if (0 == layout.size()) return nullptr;
+    std::size_t begin = rangeBegin(subtreeRoot);
+    std::uniform_int_distribution<std::size_t> pick(begin, begin + layout.subtreeSizes[begin] - 1);
+    return layout.nodes[pick(random)];
+  }
+
+  // Draw count nodes uniformly, with replacement.
+  template <typename URNG>
+  std::vector<TreeNode*> sampleMany(std::size_t count, URNG& random, const TreeNode* subtreeRoot = nullptr);
+
+  // Set the function that gives each node's weight from its data, and
+  // compute all of the weights. Weights must not be negative.
+  void setWeights(std::function<double(const T&)> weightOf) {
+    weightFunction = weightOf;
+    refresh();
+    refreshWeights();
+  }
+
+  // Recompute the weights from the current node data.
+  void refreshWeights();
+
+  // Draw one node with probability proportional to its weight, from the
+  // whole tree or from the subtree rooted at subtreeRoot. Returns nullptr if
+  // every weight in range is zero.
+  template <typename URNG>
+  TreeNode* sampleWeighted(URNG& random, const TreeNode* subtreeRoot = nullptr) {
+    refresh();
+    if (0 == layout.size()) return nullptr;
+    return drawWeighted(random, rangeBegin(subtreeRoot));
+  }
+
+  // Draw count nodes in proportion to their weights, with replacement.
+  template <typename URNG>
+  std::vector<TreeNode*> sampleWeightedMany(std::size_t count, URNG& random, const TreeNode* subtreeRoot = nullptr);
+
+  // Rebuild now if the tree has changed since the sampler was built.
+  void refresh() {
+    if (!isBuilt || builtVersion != tree.structureVersion()) {
+      layout.rebuild(tree);
+      builtVersion = tree.structureVersion();
+      isBuilt = true;
+      if (weightFunction) {
+        refreshWeights();
+      }
+    }
+  }
+
+private:
+
+  // The preorder index where the range to draw from starts.
+  std::size_t rangeBegin(const TreeNode* subtreeRoot) const {
+    if (!subtreeRoot) return 0;
+    std::size_t index = layout.indexOf(subtreeRoot);
+    if (TreeLayout<T>::NO_INDEX == index) {
+      throw std::runtime_error("TreeSampler was given a node that isn't in its tree");
+    }
+    return index;
+  }
+
+  template <typename URNG>
+  TreeNode* drawWeighted(URNG& random, std::size_t begin);
+
+  GenericTree<T>& tree;
+  std::size_t builtVersion;
+  bool isBuilt;
+  TreeLayout<T> layout;
+  std::function<double(const T&)> weightFunction;
+  // prefixWeights[i] is the total weight of the nodes at preorder indices
+  // [0, i), so a range's total is a difference of two entries.
+  std::vector<double> prefixWeights;
+};
+
+template <typename T>
+void TreeSampler<T>::refreshWeights() {
+  if (!weightFunction) {
+    throw std::runtime_error("TreeSampler needs setWeights before drawing weighted samples");
+  }
+  prefixWeights.assign(layout.size() + 1, 0.0);
+  for (std::size_t i = 0; i < layout.size(); i++) {
+    double weight = weightFunction(layout.nodes[i]->data);
+    if (weight < 0) {
+      throw std::runtime_error("TreeSampler was given a negative weight");
+    }
+    prefixWeights[i+1] = prefixWeights[i] + weight;
+  }
+}
+
+template <typename T>
+template <typename URNG>
+std::vector<typename TreeSampler<T>::TreeNode*> TreeSampler<T>::sampleMany(std::size_t count,
+  URNG& random, const TreeNode* subtreeRoot) {
+
+  refresh();
+  std::vector<TreeNode*> results;
+  if (0 == layout.size()) return results;
+  results.reserve(count);
+
+  std::size_t begin = rangeBegin(subtreeRoot);
+  std::uniform_int_distribution<std::size_t> pick(begin, begin + layout.subtreeSizes[begin] - 1);
+  for (std::size_t i = 0; i < count; i++) {
+    results.push_back(layout.nodes[pick(random)]);
+  }
+  return results;
+}
+
+template <typename T>
+template <typename URNG>
+std::vector<typename TreeSampler<T>::TreeNode*> TreeSampler<T>::sampleWeightedMany(std::size_t count,
+  URNG& random, const TreeNode* subtreeRoot) {
+
+  refresh();
+  std::vector<TreeNode*> results;
+  if (0 == layout.size()) return results;
+  results.reserve(count);
+
+  std::size_t begin = rangeBegin(subtreeRoot);
+  for (std::size_t i = 0; i < count; i++) {
+    TreeNode* drawn = drawWeighted(random, begin);
+    if (!drawn) break;
+    results.push_back(drawn);
+  }
+  return results;
+}
+
+template <typename T>
+template <typename URNG>
+typename TreeSampler<T>::TreeNode* TreeSampler<T>::drawWeighted(URNG& random, std::size_t begin) {
+
+  if (prefixWeights.size() != layout.size() + 1) {
+    refreshWeights();
+  }
+
+  std::size_t end = begin + layout.subtreeSizes[begin];
+  double low = prefixWeights[begin];
+  double high = prefixWeights[end];
+  if (!(high > low)) return nullptr;
+
+  // Node i covers the interval [prefixWeights[i], prefixWeights[i+1]), so
+  // the node hit by the target is the one just before the first prefix
+  // that's greater than it. Zero-weight nodes cover nothing and are never
+  // hit.
+  double target = std::uniform_real_distribution<double>(low, high)(random);
+  auto after = std::upper_bound(prefixWeights.begin() + begin + 1, prefixWeights.begin() + end + 1, target);
+  std::size_t index = static_cast<std::size_t>(after - prefixWeights.begin()) - 1;
+
+  // Rounding can put the target right at the top of the range. Step back to
+  // the last node that actually has weight.
+  if (index >= end) index = end - 1;
+  while (index > begin && !(prefixWeights[index+1] > prefixWeights[index])) {
+    index--;
+  }
+  return layout.nodes[index];
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm> // for std::min
+#include <cstddef> // for std::size_t
+#include <cstdint> // for std::uint16_t, std::uint32_t
+#include <cstring> // for std::memcpy
+#include <map> // for std::map
+#include <memory> // for std::shared_ptr, std::make_shared
+#include <mutex> // for std::unique_lock
+#include <queue> // for std::queue
+#include <shared_mutex> // for std::shared_timed_mutex, std::shared_lock
+#include <stdexcept> // for std::runtime_error
+#include <string> // for std::string
+#include <utility> // for std::move
+#include <vector> // for std::vector
+
+#include "GenericTree.h"
+#include "TreeLayout.h"
+#include "TreeProtocol.h"
+
+// The part of the tree server (tree_server.cpp) that answers requests,
+// separate from the sockets and threads so that it can be tested directly:
+// handleRequest takes one request frame and appends the response frame.
+
+// -------------------------------------------------------------------
+// The trees being served
+// -------------------------------------------------------------------
+
+// One loaded tree, along with the preorder layout that maps node numbers to
+// nodes. Once an entry is published it is never modified, so any number of
+// worker threads can query it at the same time without locking. Loading a
+// tree again publishes a whole new entry in its place.
+struct TreeEntry {
+  GenericTree<int> tree;
+  TreeLayout<int> layout;
+};
+
+class TreeRegistry {
+public:
+  std::shared_ptr<const TreeEntry> find(std::uint16_t treeId) {
+    std::shared_lock<std::shared_timed_mutex> lock(registryMutex);
+    auto found = trees.find(treeId);
+    return (trees.end() == found) ? nullptr : found->second;
+  }
+
+  void publish(std::uint16_t treeId, std::shared_ptr<const TreeEntry> entry) {
+    std::unique_lock<std::shared_timed_mutex> lock(registryMutex);
+    trees[treeId] = std::move(entry);
+  }
+
+private:
+  std::shared_timed_mutex registryMutex;
+  std::map< std::uint16_t, std::shared_ptr<const TreeEntry> > trees;
+};
+
+// -------------------------------------------------------------------
+// Answering requests
+// -------------------------------------------------------------------
+
+// Append a complete response frame to out.
+inline void appendResponse(std::string& out, std::uint32_t requestId, std::uint16_t status,
+  const std::string& payload = std::string()) {
+  TreeProtocol::ResponseHeader header{static_cast<std::uint32_t>(payload.size()), requestId, status, 0};
+  TreeProtocol::appendBytes(out, header);
+  out += payload;
+}
+
+// handleLoad: Answers an OP_LOAD request, publishing the new tree if the
+// payload describes one.
+inline void handleLoad(TreeRegistry& registry, const TreeProtocol::RequestHeader& request, const char* payload,
+  std::string& out) {
+  using namespace TreeProtocol;
+
+  std::uint32_t count = 0;
+  if (request.payloadLength < sizeof(count)) {
+    appendResponse(out, request.requestId, STATUS_BAD_REQUEST);
+    return;
+  }
+  std::memcpy(&count, payload, sizeof(count));
+  if (request.payloadLength != sizeof(count) + std::size_t(count) * (sizeof(int) + sizeof(std::uint32_t))) {
+    appendResponse(out, request.requestId, STATUS_BAD_REQUEST);
+    return;
+  }
+
+  std::vector<int> values(count);
+  std::vector<std::uint32_t> degrees(count);
+  const char* cur = payload + sizeof(count);
+  std::memcpy(values.data(), cur, count * sizeof(int));
+  std::memcpy(degrees.data(), cur + count * sizeof(int), count * sizeof(std::uint32_t));
+
+  auto entry = std::make_shared<TreeEntry>();
+  try {
+    entry->tree.fromLevelOrder(values, degrees);
+  }
+  catch (const std::runtime_error&) {
+    appendResponse(out, request.requestId, STATUS_BAD_REQUEST);
+    return;
+  }
+  entry->layout.rebuild(entry->tree);
+  registry.publish(request.treeId, entry);
+  appendResponse(out, request.requestId, STATUS_OK);
+}
+
+// handleRequest: Answers one request, appending the response frame to out.
+// payload points at the request's payloadLength bytes. Any number of threads
+// may answer requests at the same time.
+inline void handleRequest(TreeRegistry& registry, const TreeProtocol::RequestHeader& request, const char* payload,
+  std::string& out) {
+  using namespace TreeProtocol;
+
+  if (OP_PING == request.opcode) {
+    appendResponse(out, request.requestId, STATUS_OK);
+    return;
+  }
+  if (OP_LOAD == request.opcode) {
+    handleLoad(registry, request, payload, out);
+    return;
+  }
+
+  std::shared_ptr<const TreeEntry> entry = registry.find(request.treeId);
+  if (!entry) {
+    appendResponse(out, request.requestId, STATUS_NO_SUCH_TREE);
+    return;
+  }
+  const TreeLayout<int>& layout = entry->layout;
+
+  if (OP_INFO == request.opcode) {
+    std::string reply;
+    appendBytes(reply, static_cast<std::uint32_t>(layout.size()));
+    appendResponse(out, request.requestId, STATUS_OK, reply);
+    return;
+  }
+
+  if (request.nodeId >= layout.size()) {
+    appendResponse(out, request.requestId, STATUS_NO_SUCH_NODE);
+    return;
+  }
+  const std::size_t node = request.nodeId;
+
+  std::string reply;
+  switch (request.opcode) {
+
+    case OP_SUBTREE: {
+      // In preorder, the subtree is one contiguous run of the layout.
+      std::size_t count = std::min<std::size_t>(layout.subtreeSizes[node], request.argument);
+      reply.reserve(count * sizeof(int));
+      for (std::size_t i = node; i < node + count; i++) {
+        appendBytes(reply, layout.nodes[i]->data);
+      }
+      break;
+    }
+
+    case OP_LEVELS: {
+      std::size_t limit = request.argument;
+      std::queue<const GenericTree<int>::TreeNode*> nodesToExplore;
+      nodesToExplore.push(layout.nodes[node]);
+      std::size_t count = 0;
+      while (!nodesToExplore.empty() && count < limit) {
+        auto cur = nodesToExplore.front();
+        nodesToExplore.pop();
+        appendBytes(reply, cur->data);
+        count++;
+        for (auto childPtr : cur->childrenPtrs) {
+          if (childPtr) nodesToExplore.push(childPtr);
+        }
+      }
+      break;
+    }
+
+    case OP_IS_ANCESTOR: {
+      if (request.argument >= layout.size()) {
+        appendResponse(out, request.requestId, STATUS_NO_SUCH_NODE);
+        return;
+      }
+      // An ancestor's preorder range contains all of its descendants.
+      std::size_t other = request.argument;
+      char answer = (other >= node && other < node + layout.subtreeSizes[node]) ? 1 : 0;
+      reply += answer;
+      break;
+    }
+
+    default:
+      appendResponse(out, request.requestId, STATUS_BAD_REQUEST);
+      return;
+  }
+
+  appendResponse(out, request.requestId, STATUS_OK, reply);
+}
@@ -0,0 +1,191 @@
+
+#pragma once
+
+#include <algorithm> // for std::min, std::max
+#include <atomic> // for std::atomic
+#include <condition_variable> // for std::condition_variable
+#include <cstddef> // for std::size_t
+#include <exception> // for std::exception_ptr
+#include <functional> // for std::function
+#include <memory> // for std::shared_ptr
+#include <mutex> // for std::mutex, std::unique_lock
+#include <queue> // for std::queue
+#include <thread> // for std::thread
+#include <vector> // for std::vector
+
+// TreeThreadPool: A small fixed-size pool of worker threads that the
+// parallel tree algorithms share. The workers are started once and then
+// reused, so that we don't pay for creating threads on every call.
+//
+// The main entry point is parallelFor, which splits a range of indices into
+// chunks and runs them across the workers. The calling thread also helps
+// with the work while it waits, which means it's safe to call parallelFor
+// from inside another parallelFor: even if every worker is busy, the caller
+// will eventually finish all of the chunks by itself.
+class TreeThreadPool {
+public:
+
+  // Constructor: Starts the requested number of worker threads. Passing 0
+  // uses one thread per hardware core that the system reports.
+  explicit TreeThreadPool(std::size_t threadCount = 0) : stopping(false) {
+    if (0 == threadCount) {
+      threadCount = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+    }
+    for (std::size_t i = 0; i < threadCount; i++) {
+      workers.emplace_back([this]() { workerLoop(); });
+    }
+  }
+
+  TreeThreadPool(const TreeThreadPool& other) = delete;
+  TreeThreadPool& operator=(const TreeThreadPool& other) = delete;
+
+  // Destructor: Lets the workers finish whatever is queued, then joins them.
+  ~TreeThreadPool() {
+    {
+      std::unique_lock<std::mutex> lock(queueMutex);
+      stopping = true;
+    }
+    queueReady.notify_all();
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  }
+
+  // The number of worker threads (not counting a calling thread that helps).
+  std::size_t size() const {
+    return workers.size();
+  }
+
+  // A process-wide pool that functions use by default when the caller
+  // doesn't provide one of their own.
+  static TreeThreadPool& shared() {
+    static TreeThreadPool sharedPool;
+    return sharedPool;
+  }
+
+  // parallelFor: Calls body(begin, end) for consecutive chunks of the range
+  // [0, count) and returns once every chunk has finished. Chunks are handed
+  // out dynamically, so uneven work balances itself out. If a chunk throws,
+  // the first exception is rethrown here in the calling thread.
+  template <typename Body>
+  void parallelFor(std::size_t count, Body body, std::size_t chunkSize = 0);
+
+  // submit: Queues one task to run on a worker thread and returns right
+  // away. The task is responsible for reporting its own results and errors.
+  void submit(std::function<void()> task) {
+    {
+      std::unique_lock<std::mutex> lock(queueMutex);
+      tasks.push(std::move(task));
+    }
+    queueReady.notify_one();
+  }
+
+private:
+
+  // Shared bookkeeping for one parallelFor call. Helper jobs may start
+  // running after the call has already returned (if they were queued behind
+  // other work), so they hold this state through a shared_ptr and simply
+  // find no chunks left to claim.
+  struct RangeJob {
+    std::size_t count;
+    std::size_t chunkSize;
+    std::size_t chunkCount;
+    std::atomic<std::size_t> nextChunk;
+    std::atomic<std::size_t> chunksDone;
+    std::function<void(std::size_t, std::size_t)> body;
+    std::mutex doneMutex;
+    std::condition_variable doneReady;
+    std::exception_ptr firstError;
+
+    RangeJob() : count(0), chunkSize(1), chunkCount(0), nextChunk(0), chunksDone(0) {}
+
+    // Claim and run chunks until there are none left.
+    void runChunks() {
+      while (true) {
+        std::size_t chunk = nextChunk.fetch_add(1);
+        if (chunk >= chunkCount) {
+          return;
+        }
+        std::size_t begin = chunk * chunkSize;
+        std::size_t end = std::min(count, begin + chunkSize);
+        try {
+          body(begin, end);
+        }
+        catch (...) {
+          std::unique_lock<std::mutex> lock(doneMutex);
+          if (!firstError) {
+            firstError = std::current_exception();
+          }
+        }
+        if (chunksDone.fetch_add(1) + 1 == chunkCount) {
+          std::unique_lock<std::mutex> lock(doneMutex);
+          doneReady.notify_all();
+        }
+      }
+    }
+  };
+
+  void workerLoop() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queueReady.wait(lock, [this]() { return stopping || !tasks.empty(); });
+        if (tasks.empty()) {
+          // Only reachable when stopping and nothing is left to do.
+          return;
+        }
+        task = std::move(tasks.front());
+        tasks.pop();
+      }
+      task();
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::queue< std::function<void()> > tasks;
+  std::mutex queueMutex;
+  std::condition_variable queueReady;
+  bool stopping;
+};
+
+template <typename Body>
+void TreeThreadPool::parallelFor(std::size_t count, Body body, std::size_t chunkSize) {
+
+  if (0 == count) return;
+
+  // By default, aim for several chunks per thread so that a few slow chunks
+  // don't leave the other threads idle at the end.
+  if (0 == chunkSize) {
+    std::size_t targetChunks = (size() + 1) * 4;
+    chunkSize = std::max<std::size_t>(1, (count + targetChunks - 1) / targetChunks);
+  }
+
+  auto job = std::make_shared<RangeJob>();
+  job->count = count;
+  job->chunkSize = chunkSize;
+  job->chunkCount = (count + chunkSize - 1) / chunkSize;
+  job->body = body;
+
+  // A single chunk isn't worth waking anyone up for.
+  if (1 == job->chunkCount) {
+    body(0, count);
+    return;
+  }
+
+  std::size_t helpers = std::min(size(), job->chunkCount - 1);
+  for (std::size_t i = 0; i < helpers; i++) {
+    submit([job]() { job->runChunks(); });
+  }
+
+  // The calling thread works too, then waits for any chunks still running.
+  job->runChunks();
+  {
+    std::unique_lock<std::mutex> lock(job->doneMutex);
+    job->doneReady.wait(lock, [&job]() { return job->chunksDone.load() == job->chunkCount; });
+  }
+
+  if (job->firstError) {
+    std::rethrow_exception(job->firstError);
+  }
+}
@@ -0,0 +1,347 @@
+
+#pragma once
+
+#include <algorithm> // for std::find, std::sort
+#include <cstddef> // for std::size_t
+#include <cstdint> // for std::uint64_t
+#include <limits> // for std::numeric_limits
+#include <ostream> // for std::ostream
+#include <random> // for std::mt19937_64, std::uniform_int_distribution
+#include <sstream> // for std::ostringstream
+#include <string> // for std::string
+#include <unordered_map> // for std::unordered_map
+#include <utility> // for std::pair
+#include <vector> // for std::vector
+
+#include "GenericTree.h"
+#include "TreeFormat.h"
+#include "TreeThreadPool.h"
+
+// -------------------------------------------------------------------
+// Checking a tree's structure
+// -------------------------------------------------------------------
+
+// How verify looks at the tree.
+enum class TreeVerifyMode {
+  // Every node, on the calling thread.
+  FULL,
+  // Every node, a level at a time, with big levels split across a thread
+  // pool.
+  PARALLEL,
+  // A fixed number of distinct nodes along random root-to-leaf walks, as a
+  // cheap spot check that doesn't depend on the size of the tree.
+  SAMPLED
+};
+
+// Marks an expected count that shouldn't be checked.
+constexpr std::size_t TREE_VERIFY_UNCHECKED = std::numeric_limits<std::size_t>::max();
+
+struct TreeVerifyOptions {
+  TreeVerifyMode mode = TreeVerifyMode::FULL;
+  // SAMPLED mode: how many distinct nodes to check, and the seed for
+  // picking them.
+  std::size_t sampleSize = 100000;
+  std::uint64_t seed = 1;
+  // The number of nodes and of null child slots the tree should have, if
+  // known (for example, after a bulk load). Only checked in the modes that
+  // see every node.
+  std::size_t expectedNodeCount = TREE_VERIFY_UNCHECKED;
+  std::size_t expectedNullSlots = TREE_VERIFY_UNCHECKED;
+  // How many problems to describe in the report. All of them are counted.
+  std::size_t maxProblems = 20;
+};
+
+// What verify found. The counts cover every node checked; the first few
+// problems are also described in words.
+struct TreeVerifyReport {
+  TreeVerifyMode mode = TreeVerifyMode::FULL;
+  // The number of nodes whose child lists were checked. In the full modes
+  // that is the number of nodes reachable from the root.
+  std::size_t nodesChecked = 0;
+  // The null child slots seen in those child lists.
+  std::size_t nullSlots = 0;
+  // Children whose parentPtr doesn't point back to the node listing them.
+  std::size_t brokenParentLinks = 0;
+  // Extra listings of a child that appears more than once in one list.
+  std::size_t duplicateChildren = 0;
+  // Whether the root has a parent.
+  bool rootHasParent = false;
+  // Whether the expected counts, if any were given, were right.
+  bool countsMatch = true;
+  std::vector<std::string> problems;
+
+  std::size_t problemCount() const {
+    return brokenParentLinks + duplicateChildren + (rootHasParent ? 1 : 0) + (countsMatch ? 0 : 1);
+  }
+
+  bool ok() const {
+    return 0 == problemCount();
+  }
+};
+
+// Displays a summary line, then one line per described problem.
+inline std::ostream& operator<<(std::ostream& os, const TreeVerifyReport& report) {
+  const char* modeName = (TreeVerifyMode::SAMPLED == report.mode) ? "sampled"
+    : (TreeVerifyMode::PARALLEL == report.mode) ? "parallel" : "full";
+  os << modeName << " check of " << report.nodesChecked << " nodes, " << report.nullSlots << " null slots: ";
+  if (report.ok()) {
+    return os << "OK" << std::endl;
+  }
+  os << report.problemCount() << " problem(s)" << std::endl;
+  for (const std::string& problem : report.problems) {
+    os << "  " << problem << std::endl;
+  }
+  if (report.problems.size() < report.problemCount()) {
+    os << "  (" << report.problemCount() - report.problems.size() << " more)" << std::endl;
+  }
+  return os;
+}
+
+// TreeVerifyScan: The work shared by every mode of verify, which checks one
+// node at a time. Each thread has its own.
+template <typename T>
+struct TreeVerifyScan {
+  using TreeNode = typename GenericTree<T>::TreeNode;
+
+  // Child lists up to this long are checked for duplicates pairwise;
+  // longer ones are sorted.
+  static constexpr std::size_t PAIRWISE_LIMIT = 8;
+
+  TreeVerifyReport tally;
+  const TreeNode* root;
+  std::size_t maxProblems;
+  std::vector<const TreeNode*> children;
+
+  TreeVerifyScan(const TreeNode* root, std::size_t maxProblems) : root(root), maxProblems(maxProblems) {}
+
+  void addProblem(const TreeNode* child, const TreeNode* node, const char* what) {
+    if (tally.problems.size() >= maxProblems) return;
+    std::ostringstream description;
+    description << "child ";
+    writeTreeData(description, child->data) << " of ";
+    writeTreeData(description, node->data) << " " << what;
+    tally.problems.push_back(description.str());
+  }
+
+  // Check one node's child list: count its null slots, and check that
+  // every child points back to the node and is listed only once. The
+  // children that pass are appended to next, to be checked in turn.
+  void checkNode(const TreeNode* node, std::vector<const TreeNode*>& next) {
+    tally.nodesChecked++;
+    children.clear();
+    for (const TreeNode* childPtr : node->childrenPtrs) {
+      if (!childPtr) {
+        tally.nullSlots++;
+      }
+      else if (childPtr->parentPtr != node) {
+        tally.brokenParentLinks++;
+        addProblem(childPtr, node, "has a parentPtr that doesn't point back to it");
+      }
+      else if (childPtr == root) {
+        // Only possible if the root has a parent, which makes a cycle.
+        tally.brokenParentLinks++;
+        addProblem(childPtr, node, "is the root of the tree");
+      }
+      else {
+        children.push_back(childPtr);
+      }
+    }
+
+    // Keep the first listing of each child, remembering one that repeats.
+    const TreeNode* repeated = nullptr;
+    std::size_t uniqueCount = 0;
+    if (children.size() <= PAIRWISE_LIMIT) {
+      for (std::size_t i = 0; i < children.size(); i++) {
+        if (std::find(children.begin(), children.begin() + uniqueCount, children[i]) == children.begin() + uniqueCount) {
+          children[uniqueCount++] = children[i];
+        }
+        else {
+          repeated = children[i];
+        }
+      }
+    }
+    else {
+      std::sort(children.begin(), children.end());
+      for (std::size_t i = 0; i < children.size(); i++) {
+        if (0 == uniqueCount || children[uniqueCount - 1] != children[i]) {
+          children[uniqueCount++] = children[i];
+        }
+        else {
+          repeated = children[i];
+        }
+      }
+    }
+    if (repeated) {
+      tally.duplicateChildren += children.size() - uniqueCount;
+      addProblem(repeated, node, "is listed more than once");
+    }
+    next.insert(next.end(), children.begin(), children.begin() + uniqueCount);
+  }
+
+  // Add another scan's findings to this one's.
+  void merge(const TreeVerifyScan& other) {
+    tally.nodesChecked += other.tally.nodesChecked;
+    tally.nullSlots += other.tally.nullSlots;
+    tally.brokenParentLinks += other.tally.brokenParentLinks;
+    tally.duplicateChildren += other.tally.duplicateChildren;
+    for (const std::string& problem : other.tally.problems) {
+      if (tally.problems.size() >= maxProblems) break;
+      tally.problems.push_back(problem);
+    }
+  }
+};
+
+template <typename T>
+constexpr std::size_t TreeVerifyScan<T>::PAIRWISE_LIMIT;
+
+// verify: Check that the tree is well formed, and report what was found:
+// every child's parentPtr points back to the node listing it, no child is
+// listed twice in one list, the root has no parent, and optionally the node
+// and null slot counts are as expected.
+//
+// Those local checks are enough to rule out cycles and nodes reachable
+// more than once. The walk only ever steps from a node to a child that
+// points back to it, and a node has just one parentPtr, so every node can
+// be entered from only one place (and the root from none, since stepping
+// to it is refused). So no visited set is needed, and the full check is
+// one pass over the child lists. A node that can't be reached through good links isn't
+// visited at all; the broken link that leads to it is reported instead.
+//
+// PARALLEL mode splits the pass across the pool, and SAMPLED mode checks
+// only options.sampleSize distinct nodes. The sampled walks start at the
+// root and pick a random child at each step, so nodes near the root are
+// more likely to be picked than deep ones. Each node's child list is
+// checked only once, however many walks pass through it: the children that
+// passed are kept, and a walk steps only to children whose subtrees
+// haven't been checked completely yet. Placeholders aren't loaded; only
+// the nodes in memory are checked. No other thread may change the tree
+// meanwhile.
+template <typename T>
+TreeVerifyReport verify(const GenericTree<T>& tree, const TreeVerifyOptions& options = TreeVerifyOptions(),
+  TreeThreadPool& pool = TreeThreadPool::shared()) {
+
+  using TreeNode = typename GenericTree<T>::TreeNode;
+
+  const TreeNode* rootNodePtr = tree.getRootPtr();
+  TreeVerifyScan<T> scan(rootNodePtr, options.maxProblems);
+  if (rootNodePtr && rootNodePtr->parentPtr) {
+    scan.tally.rootHasParent = true;
+    if (scan.tally.problems.size() < options.maxProblems) {
+      scan.tally.problems.push_back("the root has a parent");
+    }
+  }
+
+  if (!rootNodePtr) {
+    // Nothing to walk; the expected counts are still checked below.
+  }
+  else if (TreeVerifyMode::FULL == options.mode) {
+    std::vector<const TreeNode*> nodesToExplore{rootNodePtr};
+    while (!nodesToExplore.empty()) {
+      const TreeNode* curNode = nodesToExplore.back();
+      nodesToExplore.pop_back();
+      scan.checkNode(curNode, nodesToExplore);
+    }
+  }
+  else if (TreeVerifyMode::PARALLEL == options.mode) {
+    // Below this many nodes in a level, it's cheaper to just do the work here.
+    constexpr std::size_t SERIAL_LEVEL_LIMIT = 4096;
+    // How many frontier nodes each parallel chunk handles.
+    constexpr std::size_t CHUNK_SIZE = 1024;
+
+    std::vector<const TreeNode*> frontier{rootNodePtr};
+    std::vector<const TreeNode*> nextFrontier;
+    while (!frontier.empty()) {
+      nextFrontier.clear();
+      if (frontier.size() < SERIAL_LEVEL_LIMIT) {
+        for (const TreeNode* node : frontier) {
+          scan.checkNode(node, nextFrontier);
+        }
+        frontier.swap(nextFrontier);
+        continue;
+      }
+
+      // Each chunk checks its own nodes with its own scan. Merging the
+      // chunks in order keeps the report the same from run to run.
+      std::size_t chunkCount = (frontier.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+      std::vector< TreeVerifyScan<T> > chunkScans(chunkCount, TreeVerifyScan<T>(rootNodePtr, options.maxProblems));
+      std::vector< std::vector<const TreeNode*> > chunkChildren(chunkCount);
+      pool.parallelFor(frontier.size(), [&](std::size_t begin, std::size_t end) {
+        std::size_t chunk = begin / CHUNK_SIZE;
+        for (std::size_t i = begin; i < end; i++) {
+          chunkScans[chunk].checkNode(frontier[i], chunkChildren[chunk]);
+        }
+      }, CHUNK_SIZE);
+
+      std::size_t nextSize = 0;
+      for (const auto& found : chunkChildren) {
+        nextSize += found.size();
+      }
+      nextFrontier.reserve(nextSize);
+      for (std::size_t chunk = 0; chunk < chunkCount; chunk++) {
+        scan.merge(chunkScans[chunk]);
+        nextFrontier.insert(nextFrontier.end(), chunkChildren[chunk].begin(), chunkChildren[chunk].end());
+      }
+      frontier.swap(nextFrontier);
+    }
+  }
+  else {
+    std::mt19937_64 random(options.seed);
+    // For each node checked so far, its children that passed the check and
+    // still have unchecked nodes below them.
+    std::unordered_map< const TreeNode*, std::vector<const TreeNode*> > openChildren;
+    // The current walk: each node on it, and which of its open children
+    // the walk stepped to.
+    std::vector< std::pair<const TreeNode*, std::size_t> > path;
+    while (scan.tally.nodesChecked < options.sampleSize) {
+      const TreeNode* curNode = rootNodePtr;
+      path.clear();
+      while (true) {
+        auto found = openChildren.find(curNode);
+        if (found == openChildren.end()) {
+          // A new node: check it, then keep walking down from it.
+          found = openChildren.emplace(curNode, std::vector<const TreeNode*>()).first;
+          scan.checkNode(curNode, found->second);
+          if (scan.tally.nodesChecked >= options.sampleSize) break;
+        }
+        std::vector<const TreeNode*>& open = found->second;
+        if (open.empty()) break;
+        std::uniform_int_distribution<std::size_t> pickChild(0, open.size() - 1);
+        std::size_t picked = pickChild(random);
+        path.emplace_back(curNode, picked);
+        curNode = open[picked];
+      }
+      if (scan.tally.nodesChecked >= options.sampleSize) break;
+
+      // The walk ended at a node with nothing left to check below it. Close
+      // it off in its parent's list, and the parent too if that was its
+      // last open child, and so on up.
+      while (!path.empty()) {
+        std::vector<const TreeNode*>& open = openChildren[path.back().first];
+        open[path.back().second] = open.back();
+        open.pop_back();
+        if (!open.empty()) break;
+        path.pop_back();
+      }
+      if (path.empty()) {
+        // Everything reachable has been checked.
+        break;
+      }
+    }
+  }
+
+  TreeVerifyReport report = scan.tally;
+  report.mode = options.mode;
+  if (TreeVerifyMode::SAMPLED != options.mode) {
+    auto checkCount = [&report, &options](std::size_t expected, std::size_t actual, const char* what) {
+      if (TREE_VERIFY_UNCHECKED == expected || expected == actual) return;
+      report.countsMatch = false;
+      if (report.problems.size() < options.maxProblems) {
+        report.problems.push_back("expected " + std::to_string(expected) + " " + what + " but found " +
+          std::to_string(actual));
+      }
+    };
+    checkCount(options.expectedNodeCount, report.nodesChecked, "nodes");
+    checkCount(options.expectedNullSlots, report.nullSlots, "null slots");
+  }
+  return report;
+}
@@ -0,0 +1,488 @@
+
+// Tests for the query indices built on top of GenericTree.
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../uiuc/catch/catch.hpp"
+
+#include "../BottomUpEvaluator.h"
+#include "../GenericTree.h"
+#include "../HeavyLightIndex.h"
+#include "../LevelAncestorIndex.h"
+#include "../LevelOrder.h"
+#include "../SubtreeSumIndex.h"
+#include "../TopKIndex.h"
+#include "../TreeSampler.h"
+
+using IntNode = GenericTree<int>::TreeNode;
+
+// Builds a random tree where each new node picks a random earlier node as
+// its parent, and returns all of the nodes in creation order. Every node's
+// data is a small number derived from its creation order.
+static std::vector<IntNode*> buildRandomTree(GenericTree<int>& tree, std::size_t nodeCount, unsigned seed) {
+  tree.clear();
+  std::mt19937 random(seed);
+  std::vector<IntNode*> nodes;
+  nodes.push_back(tree.createRoot(1));
+  for (std::size_t i = 1; i < nodeCount; i++) {
+    std::uniform_int_distribution<std::size_t> pickParent(0, i - 1);
+    nodes.push_back(nodes[pickParent(random)]->addChild(static_cast<int>(i % 17) - 5));
+  }
+  return nodes;
+}
+
+// The slow way to combine a path: collect one node's ancestors, then climb
+// from the other node until we meet them.
+template <typename Combine>
+static int naivePathQuery(IntNode* a, IntNode* b, Combine combine) {
+  std::set<IntNode*> ancestorsOfA;
+  for (IntNode* cur = a; cur; cur = cur->parentPtr) {
+    ancestorsOfA.insert(cur);
+  }
+  IntNode* meet = b;
+  int result = combine.identity();
+  while (!ancestorsOfA.count(meet)) {
+    result = combine(result, meet->data);
+    meet = meet->parentPtr;
+  }
+  for (IntNode* cur = a; cur != meet; cur = cur->parentPtr) {
+    result = combine(result, cur->data);
+  }
+  return combine(result, meet->data);
+}
+
+TEST_CASE("HeavyLightIndex path queries match walking the path", "[weight=1]") {
+  GenericTree<int> tree;
+  auto nodes = buildRandomTree(tree, 500, 7);
+  std::mt19937 random(99);
+  std::uniform_int_distribution<std::size_t> pickNode(0, nodes.size() - 1);
+
+  HeavyLightIndex<int> sums(tree);
+  HeavyLightIndex<int, PathMax<int> > maxes(tree);
+
+  std::vector< std::pair<const IntNode*, const IntNode*> > paths;
+  for (int i = 0; i < 200; i++) {
+    IntNode* a = nodes[pickNode(random)];
+    IntNode* b = nodes[pickNode(random)];
+    REQUIRE(naivePathQuery(a, b, PathSum<int>()) == sums.pathQuery(a, b));
+    REQUIRE(naivePathQuery(a, b, PathMax<int>()) == maxes.pathQuery(a, b));
+    paths.push_back(std::make_pair(a, b));
+  }
+
+  // Point updates are reflected in later queries, including batched ones.
+  for (int i = 0; i < 50; i++) {
+    sums.update(nodes[pickNode(random)], i * 3);
+  }
+  TreeThreadPool pool(2);
+  std::vector<int> batched = sums.pathQueries(paths, pool);
+  for (std::size_t i = 0; i < paths.size(); i++) {
+    IntNode* a = const_cast<IntNode*>(paths[i].first);
+    IntNode* b = const_cast<IntNode*>(paths[i].second);
+    REQUIRE(naivePathQuery(a, b, PathSum<int>()) == batched[i]);
+  }
+  REQUIRE(tree.getRootPtr()->data == sums.rootPathQuery(tree.getRootPtr()));
+
+  // Structure changes are picked up on the next query.
+  tree.deleteSubtree(nodes.back());
+  nodes.pop_back();
+  IntNode* leaf = nodes[pickNode(random) % nodes.size()]->addChild(1000);
+  REQUIRE(naivePathQuery(leaf, tree.getRootPtr(), PathSum<int>()) == sums.pathQuery(leaf, tree.getRootPtr()));
+  REQUIRE(naivePathQuery(leaf, tree.getRootPtr(), PathMax<int>()) == maxes.rootPathQuery(leaf));
+}
+
+TEST_CASE("LevelAncestorIndex finds k-th ancestors and rebuilds lazily", "[weight=1]") {
+  GenericTree<int> tree;
+  auto nodes = buildRandomTree(tree, 400, 11);
+  LevelAncestorIndex<int> ancestors(tree);
+
+  for (IntNode* node : nodes) {
+    std::size_t k = 0;
+    for (IntNode* cur = node; cur; cur = cur->parentPtr, k++) {
+      REQUIRE(cur == ancestors.kthAncestor(node, k));
+    }
+    REQUIRE(nullptr == ancestors.kthAncestor(node, k));
+    REQUIRE(k - 1 == ancestors.depthOf(node));
+    REQUIRE(tree.getRootPtr() == ancestors.ancestorAtDepth(node, 0));
+  }
+
+  // Hang a long chain under one leaf, then tell the tree it changed.
+  IntNode* bottom = nodes.back();
+  std::size_t oldDepth = ancestors.depthOf(bottom);
+  for (int i = 0; i < 50; i++) {
+    bottom = bottom->addChild(i);
+  }
+  tree.markStructureChanged();
+  REQUIRE(oldDepth + 50 == ancestors.depthOf(bottom));
+  REQUIRE(nodes.back() == ancestors.kthAncestor(bottom, 50));
+
+  // Deleting through the tree is noticed automatically.
+  IntNode* middle = ancestors.kthAncestor(bottom, 25);
+  tree.deleteSubtree(middle->childrenPtrs.at(0));
+  REQUIRE(nodes.back() == ancestors.kthAncestor(middle, 25));
+  REQUIRE_THROWS(ancestors.depthOf(bottom));
+}
+
+// The slow way to total a subtree.
+static long long naiveSubtreeSum(const GenericTree<long long>::TreeNode* node) {
+  long long sum = node->data;
+  for (auto childPtr : node->childrenPtrs) {
+    if (childPtr) sum += naiveSubtreeSum(childPtr);
+  }
+  return sum;
+}
+
+TEST_CASE("SubtreeSumIndex keeps subtree totals under updates", "[weight=1]") {
+  using LongNode = GenericTree<long long>::TreeNode;
+  GenericTree<long long> tree(0);
+  std::mt19937 random(5);
+  std::vector<LongNode*> nodes(1, tree.getRootPtr());
+  for (std::size_t i = 1; i < 300; i++) {
+    std::uniform_int_distribution<std::size_t> pickParent(0, i - 1);
+    nodes.push_back(nodes[pickParent(random)]->addChild(static_cast<long long>(i)));
+  }
+  std::uniform_int_distribution<std::size_t> pickNode(0, nodes.size() - 1);
+
+  SubtreeSumIndex<long long> sums(tree);
+  auto checkAll = [&]() {
+    for (LongNode* node : nodes) {
+      REQUIRE(naiveSubtreeSum(node) == sums.subtreeSum(node));
+    }
+  };
+  checkAll();
+
+  for (int i = 0; i < 40; i++) {
+    sums.add(nodes[pickNode(random)], 1000);
+    sums.set(nodes[pickNode(random)], -i);
+  }
+  checkAll();
+
+  SECTION("Small and large batches") {
+    std::vector< std::pair<LongNode*, long long> > small, large;
+    for (int i = 0; i < 5; i++) small.push_back(std::make_pair(nodes[pickNode(random)], 7LL));
+    for (int i = 0; i < 250; i++) large.push_back(std::make_pair(nodes[pickNode(random)], i * 2LL));
+    sums.applyUpdates(small);
+    checkAll();
+    sums.applyUpdates(large);
+    checkAll();
+  }
+
+  SECTION("A node from another tree changes nothing") {
+    GenericTree<long long> other(5);
+    REQUIRE_THROWS_AS(sums.add(other.getRootPtr(), 1), std::runtime_error);
+    REQUIRE(5 == other.getRootPtr()->data);
+    std::vector< std::pair<LongNode*, long long> > small{{nodes[3], 1}, {other.getRootPtr(), 2}};
+    std::vector< std::pair<LongNode*, long long> > large(250, std::make_pair(nodes[4], 3LL));
+    large.push_back(std::make_pair(other.getRootPtr(), 4LL));
+    long long before3 = nodes[3]->data;
+    long long before4 = nodes[4]->data;
+    REQUIRE_THROWS_AS(sums.applyUpdates(small), std::runtime_error);
+    REQUIRE_THROWS_AS(sums.applyUpdates(large), std::runtime_error);
+    REQUIRE(before3 == nodes[3]->data);
+    REQUIRE(before4 == nodes[4]->data);
+    REQUIRE(5 == other.getRootPtr()->data);
+    checkAll();
+  }
+
+  SECTION("Structural changes through the tree are picked up") {
+    tree.deleteSubtree(nodes[1]);
+    REQUIRE(naiveSubtreeSum(tree.getRootPtr()) == sums.subtreeSum(tree.getRootPtr()));
+  }
+}
+
+TEST_CASE("BottomUpEvaluator computes child-to-parent values serially and in parallel", "[weight=1]") {
+  GenericTree<int> tree;
+  auto nodes = buildRandomTree(tree, 3000, 21);
+  BottomUpEvaluator<int> evaluator(tree);
+  TreeThreadPool pool(4);
+
+  using Children = BottomUpEvaluator<int>::ChildResults<long long>;
+  auto subtreeSum = [](const IntNode& node, const Children& children) {
+    long long sum = node.data;
+    for (long long childSum : children) sum += childSum;
+    return sum;
+  };
+
+  std::vector<long long> serial = evaluator.evaluate<long long>(subtreeSum);
+  std::vector<long long> parallel = evaluator.evaluateParallel<long long>(subtreeSum, pool);
+  REQUIRE(serial == parallel);
+  for (IntNode* node : nodes) {
+    long long expected = 0;
+    std::vector<IntNode*> pending{node};
+    while (!pending.empty()) {
+      IntNode* cur = pending.back();
+      pending.pop_back();
+      expected += cur->data;
+      for (IntNode* child : cur->childrenPtrs) {
+        if (child) pending.push_back(child);
+      }
+    }
+    REQUIRE(expected == serial[evaluator.indexOf(node)]);
+  }
+
+  SECTION("A very deep chain needs no recursion") {
+    tree.clear();
+    IntNode* cur = tree.createRoot(0);
+    for (int i = 1; i < 100000; i++) {
+      cur = cur->addChild(i);
+    }
+    tree.markStructureChanged();
+    auto height = [](const IntNode&, const BottomUpEvaluator<int>::ChildResults<int>& children) {
+      int result = 0;
+      for (int childHeight : children) result = std::max(result, childHeight + 1);
+      return result;
+    };
+    REQUIRE(99999 == evaluator.evaluate<int>(height)[evaluator.indexOf(tree.getRootPtr())]);
+    REQUIRE(99999 == evaluator.evaluateParallel<int>(height, pool)[evaluator.indexOf(tree.getRootPtr())]);
+    REQUIRE(0 == evaluator.evaluateParallel<int>(height, pool)[evaluator.indexOf(cur)]);
+  }
+}
+
+TEST_CASE("traverseLevelsDetailed records depth, parent and child counts", "[weight=1]") {
+  GenericTree<int> tree;
+  auto nodes = buildRandomTree(tree, 400, 33);
+  nodes[0]->childrenPtrs.push_back(nullptr);
+
+  LevelOrderArrays<int> levels = traverseLevelsDetailed(tree);
+  REQUIRE(nodes.size() == levels.size());
+  REQUIRE(levels.size() == levels.payloads.size());
+  REQUIRE(LevelOrderArrays<int>::NO_PARENT == levels.parents[0]);
+
+  std::size_t childTotal = 0;
+  for (std::size_t i = 0; i < levels.size(); i++) {
+    const IntNode* node = levels.nodes[i];
+    REQUIRE(&node->data == levels.payloads[i]);
+    if (i > 0) {
+      REQUIRE(levels.nodes[levels.parents[i]] == node->parentPtr);
+      REQUIRE(levels.depths[levels.parents[i]] + 1 == levels.depths[i]);
+      REQUIRE(levels.depths[i - 1] <= levels.depths[i]);
+    }
+    std::size_t nonNull = 0;
+    for (const IntNode* child : node->childrenPtrs) {
+      if (child) nonNull++;
+    }
+    REQUIRE(nonNull == levels.childCounts[i]);
+    childTotal += levels.childCounts[i];
+  }
+  REQUIRE(levels.size() - 1 == childTotal);
+
+  SECTION("Payloads can be skipped and the arrays reused") {
+    traverseLevelsDetailed(tree, levels, false);
+    REQUIRE(levels.payloads.empty());
+    REQUIRE(nodes.size() == levels.depths.size());
+    tree.clear();
+    traverseLevelsDetailed(tree, levels);
+    REQUIRE(0 == levels.size());
+  }
+}
+
+TEST_CASE("TreeSampler draws nodes uniformly or by weight", "[weight=1]") {
+  GenericTree<int> tree;
+  auto nodes = buildRandomTree(tree, 200, 5);
+  TreeSampler<int> sampler(tree);
+  std::mt19937 random(17);
+
+  // Uniform draws hit every node about equally often.
+  std::map<IntNode*, int> counts;
+  for (IntNode* node : sampler.sampleMany(200 * 200, random)) {
+    counts[node]++;
+  }
+  REQUIRE(nodes.size() == counts.size());
+  for (const auto& entry : counts) {
+    REQUIRE(entry.second > 100);
+    REQUIRE(entry.second < 300);
+  }
+
+  SECTION("Draws can be limited to a subtree") {
+    IntNode* subtreeRoot = nodes[3];
+    std::set<IntNode*> inSubtree;
+    std::vector<IntNode*> pending{subtreeRoot};
+    while (!pending.empty()) {
+      IntNode* cur = pending.back();
+      pending.pop_back();
+      inSubtree.insert(cur);
+      for (IntNode* child : cur->childrenPtrs) {
+        if (child) pending.push_back(child);
+      }
+    }
+    for (IntNode* node : sampler.sampleMany(500, random, subtreeRoot)) {
+      REQUIRE(inSubtree.count(node));
+    }
+    REQUIRE(inSubtree.count(sampler.sample(random, subtreeRoot)));
+  }
+
+  SECTION("Weighted draws follow the weights") {
+    // Only positive data counts, in proportion to its value.
+    sampler.setWeights([](const int& data) { return data > 0 ? static_cast<double>(data) : 0.0; });
+    std::map<int, int> byData;
+    const int draws = 100000;
+    for (IntNode* node : sampler.sampleWeightedMany(draws, random)) {
+      byData[node->data]++;
+    }
+    REQUIRE(byData.begin()->first > 0);
+    double totalWeight = 0;
+    std::map<int, int> nodesWithData;
+    for (IntNode* node : nodes) {
+      if (node->data > 0) {
+        totalWeight += node->data;
+        nodesWithData[node->data]++;
+      }
+    }
+    for (const auto& entry : nodesWithData) {
+      double expected = draws * entry.first * entry.second / totalWeight;
+      REQUIRE(std::abs(byData[entry.first] - expected) < expected * 0.15 + 30);
+    }
+
+    // A subtree with no positive data has nothing to draw.
+    sampler.setWeights([](const int&) { return 0.0; });
+    REQUIRE(nullptr == sampler.sampleWeighted(random));
+  }
+
+  SECTION("The sampler follows structural changes") {
+    tree.deleteSubtree(nodes[1]);
+    for (int i = 0; i < 100; i++) {
+      REQUIRE(nodes[1] != sampler.sample(random));
+    }
+    tree.clear();
+    REQUIRE(nullptr == sampler.sample(random));
+  }
+}
+
+TEST_CASE("TopKIndex finds the largest values with pruning", "[weight=1]") {
+  GenericTree<int> tree;
+  auto nodes = buildRandomTree(tree, 1000, 11);
+  std::mt19937 random(3);
+  std::uniform_int_distribution<int> pickData(-100000, 100000);
+  for (IntNode* node : nodes) {
+    node->data = pickData(random);
+  }
+  TopKIndex<int> index(tree);
+
+  // The slow way: collect every value in the subtree and sort.
+  auto naiveTopK = [](IntNode* subtreeRoot, std::size_t k) {
+    std::vector<int> values;
+    std::vector<IntNode*> pending{subtreeRoot};
+    while (!pending.empty()) {
+      IntNode* cur = pending.back();
+      pending.pop_back();
+      values.push_back(cur->data);
+      for (IntNode* child : cur->childrenPtrs) {
+        if (child) pending.push_back(child);
+      }
+    }
+    std::sort(values.rbegin(), values.rend());
+    if (values.size() > k) values.resize(k);
+    return values;
+  };
+  auto dataOf = [](const std::vector<IntNode*>& found) {
+    std::vector<int> values;
+    for (IntNode* node : found) values.push_back(node->data);
+    return values;
+  };
+
+  REQUIRE(naiveTopK(tree.getRootPtr(), 100) == dataOf(index.topK(100)));
+  REQUIRE(naiveTopK(nodes[2], 10) == dataOf(index.topK(10, nodes[2])));
+  REQUIRE(naiveTopK(tree.getRootPtr(), 5000) == dataOf(index.topK(5000)));
+  REQUIRE(index.topK(0).empty());
+
+  SECTION("Maxima are kept up to date through the index's own changes") {
+    IntNode* added = index.addChild(nodes[500], 1000000);
+    REQUIRE(added == index.topK(1)[0]);
+    REQUIRE(added == index.topK(1, nodes[500])[0]);
+    index.deleteSubtree(added);
+    index.update(nodes[7], -1000000);
+    index.update(nodes[8], 999999);
+    for (int i = 0; i < 20; i++) {
+      index.deleteSubtree(nodes[919 - i]);
+      index.addChild(nodes[i], pickData(random));
+    }
+    REQUIRE(naiveTopK(tree.getRootPtr(), 50) == dataOf(index.topK(50)));
+    REQUIRE(naiveTopK(nodes[1], 50) == dataOf(index.topK(50, nodes[1])));
+
+    GenericTree<int> other(5);
+    REQUIRE_THROWS_AS(index.addChild(other.getRootPtr(), 6), std::runtime_error);
+    REQUIRE(other.getRootPtr()->childrenPtrs.empty());
+    REQUIRE_THROWS_AS(index.update(other.getRootPtr(), 6), std::runtime_error);
+  }
+
+  SECTION("Rerooting updates the maxima along the old root path") {
+    IntNode* oldRoot = tree.getRootPtr();
+    index.reroot(nodes[700]);
+    REQUIRE(nodes[700] == tree.getRootPtr());
+    REQUIRE(naiveTopK(tree.getRootPtr(), 40) == dataOf(index.topK(40)));
+    REQUIRE(naiveTopK(oldRoot, 40) == dataOf(index.topK(40, oldRoot)));
+    for (IntNode* cur = oldRoot; cur; cur = cur->parentPtr) {
+      REQUIRE(naiveTopK(cur, 3) == dataOf(index.topK(3, cur)));
+    }
+  }
+
+  SECTION("Other structural changes cause a rebuild") {
+    tree.deleteSubtree(nodes[1]);
+    REQUIRE(naiveTopK(tree.getRootPtr(), 30) == dataOf(index.topK(30)));
+  }
+}
+
+TEST_CASE("reroot reverses the links along the path to the old root", "[weight=1]") {
+  //   A            D
+  //   |_ B         |_ E
+  //   |  |_ C      |_ B
+  //   |  |_ D  =>     |_ C
+  //   |     |_ E      |_ A
+  //   |_ F               |_ F
+  GenericTree<std::string> tree;
+  auto a = tree.createRoot("A");
+  auto b = a->addChild("B");
+  b->addChild("C");
+  auto d = b->addChild("D");
+  d->addChild("E");
+  a->addChild("F");
+
+  GenericTree<std::string> expected;
+  auto expectedRoot = expected.createRoot("D");
+  expectedRoot->addChild("E");
+  auto expectedB = expectedRoot->addChild("B");
+  expectedB->addChild("C");
+  expectedB->addChild("A")->addChild("F");
+
+  LevelAncestorIndex<std::string> ancestors(tree);
+  REQUIRE(2 == ancestors.depthOf(d));
+
+  std::size_t versionBefore = tree.structureVersion();
+  tree.reroot(d);
+  REQUIRE(versionBefore != tree.structureVersion());
+  REQUIRE(d == tree.getRootPtr());
+  REQUIRE(nullptr == d->parentPtr);
+  REQUIRE(d == b->parentPtr);
+  REQUIRE(b == a->parentPtr);
+
+  std::stringstream expectedText, rerootedText;
+  expected.Print(expectedText);
+  tree.Print(rerootedText);
+  REQUIRE(expectedText.str() == rerootedText.str());
+
+  // Indices notice the new shape through the structure version.
+  REQUIRE(0 == ancestors.depthOf(d));
+  REQUIRE(3 == ancestors.depthOf(a->childrenPtrs[0]));
+
+  // Rerooting at the root changes nothing, and bad nodes are refused.
+  tree.reroot(d);
+  std::stringstream again;
+  tree.Print(again);
+  REQUIRE(expectedText.str() == again.str());
+  REQUIRE_THROWS_AS(tree.reroot(nullptr), std::runtime_error);
+  REQUIRE_THROWS_AS(tree.reroot(expectedB), std::runtime_error);
+
+  // Rerooting back gives the original links, with B's children reordered.
+  tree.reroot(a);
+  REQUIRE(a == tree.getRootPtr());
+  REQUIRE(a == b->parentPtr);
+  REQUIRE(b == d->parentPtr);
+  REQUIRE(2 == a->childrenPtrs.size());
+}
@@ -0,0 +1,405 @@
+
+// Tests for the parallel tree algorithms.
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "../uiuc/catch/catch.hpp"
+
+#include "../BoundedQueue.h"
+#include "../GenericTree.h"
+#include "../SubtreeBuilder.h"
+#include "../TreeVerify.h"
+
+// Builds a wide, fairly large tree and then deletes some of the deepest
+// nodes, so that plenty of null child slots are left behind in a level that
+// is big enough to be processed in parallel.
+static void buildChurnedTree(GenericTree<int>& tree) {
+  tree.clear();
+  auto root = tree.createRoot(0);
+  int nextValue = 1;
+  std::vector<GenericTree<int>::TreeNode*> toDelete;
+  for (int i = 0; i < 100; i++) {
+    auto child = root->addChild(nextValue++);
+    for (int j = 0; j < 90; j++) {
+      auto grandchild = child->addChild(nextValue++);
+      auto leaf = grandchild->addChild(nextValue++);
+      grandchild->addChild(nextValue++);
+      if (0 == j % 3) {
+        toDelete.push_back(leaf);
+      }
+    }
+  }
+  for (auto node : toDelete) {
+    tree.deleteSubtree(node);
+  }
+}
+
+TEST_CASE("compressParallel matches compress", "[weight=1]") {
+  GenericTree<int> serialTree;
+  GenericTree<int> parallelTree;
+  buildChurnedTree(serialTree);
+  buildChurnedTree(parallelTree);
+
+  TreeThreadPool pool(4);
+  serialTree.compress();
+  parallelTree.compressParallel(pool);
+
+  // The first grandchild lost one of its two leaves before compressing.
+  auto firstGrandchild = parallelTree.getRootPtr()->childrenPtrs.at(0)->childrenPtrs.at(0);
+  REQUIRE(1 == firstGrandchild->childrenPtrs.size());
+  REQUIRE(nullptr != firstGrandchild->childrenPtrs.at(0));
+  std::stringstream serialOut, parallelOut;
+  serialOut << serialTree;
+  parallelOut << parallelTree;
+  REQUIRE(serialOut.str() == parallelOut.str());
+}
+
+TEST_CASE("compressConcurrent matches compress while readers walk the tree", "[weight=1]") {
+  GenericTree<int> serialTree;
+  GenericTree<int> concurrentTree;
+  buildChurnedTree(serialTree);
+  buildChurnedTree(concurrentTree);
+  serialTree.compress();
+
+  // Every reader pass must find exactly the same nodes, with consistent
+  // parent links, whichever child arrays it happens to see.
+  auto walk = [&concurrentTree](std::size_t& count, long long& sum) {
+    auto section = concurrentTree.readSection();
+    count = 0;
+    sum = 0;
+    std::vector<const GenericTree<int>::TreeNode*> nodesToExplore{concurrentTree.getRootPtr()};
+    while (!nodesToExplore.empty()) {
+      auto cur = nodesToExplore.back();
+      nodesToExplore.pop_back();
+      count++;
+      sum += cur->data;
+      for (auto childPtr : cur->childrenPtrs) {
+        if (childPtr) {
+          if (childPtr->parentPtr != cur) return false;
+          nodesToExplore.push_back(childPtr);
+        }
+      }
+    }
+    return true;
+  };
+  std::size_t expectedCount = 0;
+  long long expectedSum = 0;
+  REQUIRE(walk(expectedCount, expectedSum));
+
+  std::atomic<bool> done(false);
+  std::atomic<int> badPasses(0);
+  std::atomic<int> passes(0);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 3; i++) {
+    readers.emplace_back([&]() {
+      do {
+        std::size_t count = 0;
+        long long sum = 0;
+        if (!walk(count, sum) || count != expectedCount || sum != expectedSum) badPasses++;
+        passes++;
+      } while (!done.load());
+    });
+  }
+
+  std::size_t versionBefore = concurrentTree.structureVersion();
+  concurrentTree.compressConcurrent(64);
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+
+  REQUIRE(0 == badPasses.load());
+  REQUIRE(passes.load() >= 3);
+  REQUIRE(versionBefore != concurrentTree.structureVersion());
+  std::stringstream serialOut, concurrentOut;
+  serialOut << serialTree;
+  concurrentOut << concurrentTree;
+  REQUIRE(serialOut.str() == concurrentOut.str());
+}
+
+TEST_CASE("BoundedQueue passes every item exactly once between threads", "[weight=1]") {
+  BoundedQueue<int> queue(8);
+  REQUIRE(8 == queue.maxSize());
+
+  SECTION("Single thread: first in, first out, with a fixed capacity") {
+    for (int i = 0; i < 8; i++) {
+      REQUIRE(queue.tryPush(i));
+    }
+    int extra = 8;
+    REQUIRE(!queue.tryPush(extra));
+    for (int i = 0; i < 8; i++) {
+      int item = -1;
+      REQUIRE(queue.tryPop(item));
+      REQUIRE(i == item);
+    }
+    int item = -1;
+    REQUIRE(!queue.tryPop(item));
+  }
+
+  SECTION("Several producers and consumers") {
+    const int producers = 3;
+    const int consumers = 3;
+    const int perProducer = 20000;
+    std::atomic<int> producersLeft(producers);
+    std::atomic<long long> total(0);
+    std::atomic<int> count(0);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+      threads.emplace_back([&, p]() {
+        for (int i = 1; i <= perProducer; i++) {
+          int item = p * perProducer + i;
+          queue.push(item);
+        }
+        if (1 == producersLeft.fetch_sub(1)) queue.close();
+      });
+    }
+    for (int c = 0; c < consumers; c++) {
+      threads.emplace_back([&]() {
+        int item = 0;
+        while (queue.pop(item)) {
+          total += item;
+          count++;
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    long long n = producers * perProducer;
+    REQUIRE(n == count.load());
+    REQUIRE(n * (n + 1) / 2 == total.load());
+  }
+
+  SECTION("Waiting threads go to sleep and are woken up") {
+    // The consumer is slow, so the producer fills the queue and has to
+    // sleep until there's room.
+    std::thread producer([&]() {
+      for (int i = 0; i < 40; i++) {
+        queue.push(i);
+      }
+      queue.close();
+    });
+    for (int i = 0; i < 40; i++) {
+      if (0 == i % 8) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      int item = -1;
+      REQUIRE(queue.pop(item));
+      REQUIRE(i == item);
+    }
+    producer.join();
+    int item = -1;
+    REQUIRE(!queue.pop(item));
+
+    // A consumer asleep on an empty queue gives up when it's cancelled.
+    BoundedQueue<int> empty(2);
+    bool popped = true;
+    std::thread consumer([&]() {
+      int never = 0;
+      popped = empty.pop(never);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    empty.cancel();
+    consumer.join();
+    REQUIRE(!popped);
+  }
+}
+
+TEST_CASE("SubtreeBuilders fill in parallel and attach to one tree", "[weight=1]") {
+  // Each builder makes a node with 50 children and 20 grandchildren under
+  // each, across several small node blocks.
+  auto fill = [](SubtreeBuilder<int>& builder, int part) {
+    auto subtreeRoot = builder.createRoot(part * 10000);
+    for (int i = 1; i <= 50; i++) {
+      auto child = builder.addChild(subtreeRoot, part * 10000 + i * 100);
+      for (int j = 1; j <= 20; j++) {
+        builder.addChild(child, part * 10000 + i * 100 + j);
+      }
+    }
+  };
+
+  GenericTree<int> expected;
+  auto expectedRoot = expected.createRoot(-1);
+  for (int part = 1; part <= 4; part++) {
+    auto subtreeRoot = expectedRoot->addChild(part * 10000);
+    for (int i = 1; i <= 50; i++) {
+      auto child = subtreeRoot->addChild(part * 10000 + i * 100);
+      for (int j = 1; j <= 20; j++) {
+        child->addChild(part * 10000 + i * 100 + j);
+      }
+    }
+  }
+
+  std::vector< std::unique_ptr< SubtreeBuilder<int> > > builders;
+  std::vector<std::thread> threads;
+  for (int part = 1; part <= 4; part++) {
+    builders.emplace_back(new SubtreeBuilder<int>(64));
+  }
+  for (int part = 1; part <= 4; part++) {
+    threads.emplace_back(fill, std::ref(*builders[part - 1]), part);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  REQUIRE(1 + 50 + 50 * 20 == builders[0]->size());
+
+  GenericTree<int> tree;
+  auto root = tree.createRoot(-1);
+  std::size_t versionBefore = tree.structureVersion();
+  std::vector<GenericTree<int>::TreeNode*> subtreeRoots;
+  for (auto& builder : builders) {
+    subtreeRoots.push_back(builder->attachTo(tree, root));
+    REQUIRE(nullptr == builder->getRootPtr());
+    REQUIRE(0 == builder->size());
+  }
+  builders.clear();
+  REQUIRE(versionBefore != tree.structureVersion());
+  REQUIRE(root == subtreeRoots[2]->parentPtr);
+
+  std::stringstream expectedOut, treeOut;
+  expectedOut << expected;
+  treeOut << tree;
+  REQUIRE(expectedOut.str() == treeOut.str());
+
+  // The attached nodes behave like any others.
+  tree.deleteSubtree(subtreeRoots[1]);
+  subtreeRoots[3]->addChild(7);
+  tree.compress();
+  REQUIRE(3 == root->childrenPtrs.size());
+
+  SECTION("A builder can become the root of an empty tree and be reused") {
+    SubtreeBuilder<int> builder(4);
+    fill(builder, 5);
+    REQUIRE_THROWS_AS(builder.createRoot(0), std::runtime_error);
+    GenericTree<int> other;
+    auto otherRoot = builder.attachTo(other, nullptr);
+    REQUIRE(otherRoot == other.getRootPtr());
+    REQUIRE(50 == otherRoot->childrenPtrs.size());
+
+    fill(builder, 6);
+    REQUIRE_THROWS_AS(builder.attachTo(other, nullptr), std::runtime_error);
+    builder.attachTo(other, otherRoot->childrenPtrs[0]);
+    REQUIRE(21 == otherRoot->childrenPtrs[0]->childrenPtrs.size());
+  }
+
+  SECTION("An unattached builder cleans up after itself") {
+    SubtreeBuilder<int> builder(8);
+    fill(builder, 7);
+    builder.getRootPtr()->addChild(1)->addChild(2);
+  }
+}
+
+TEST_CASE("verify finds broken links in every mode", "[weight=1]") {
+  GenericTree<int> tree;
+  buildChurnedTree(tree);
+  TreeThreadPool pool(4);
+  auto root = tree.getRootPtr();
+
+  TreeVerifyOptions options;
+  options.expectedNodeCount = 1 + 100 + 100 * 90 * 3 - 3000;
+  options.expectedNullSlots = 3000;
+  auto checkBothFullModes = [&](bool expectOk) {
+    options.mode = TreeVerifyMode::FULL;
+    TreeVerifyReport full = verify(tree, options);
+    options.mode = TreeVerifyMode::PARALLEL;
+    TreeVerifyReport parallel = verify(tree, options, pool);
+    REQUIRE(expectOk == full.ok());
+    REQUIRE(full.problemCount() == parallel.problemCount());
+    REQUIRE(full.nodesChecked == parallel.nodesChecked);
+    REQUIRE(full.nullSlots == parallel.nullSlots);
+    REQUIRE(full.problems.size() == parallel.problems.size());
+    return parallel;
+  };
+
+  TreeVerifyReport report = checkBothFullModes(true);
+  REQUIRE(options.expectedNodeCount == report.nodesChecked);
+  std::stringstream shown;
+  shown << report;
+  REQUIRE("parallel check of 24101 nodes, 3000 null slots: OK\n" == shown.str());
+
+  SECTION("Wrong expected counts") {
+    options.expectedNullSlots = 2999;
+    report = checkBothFullModes(false);
+    REQUIRE(!report.countsMatch);
+    REQUIRE(1 == report.problems.size());
+  }
+
+  SECTION("A parentPtr that points elsewhere") {
+    auto grandchild = root->childrenPtrs[5]->childrenPtrs[7];
+    grandchild->parentPtr = root;
+    options.expectedNodeCount = TREE_VERIFY_UNCHECKED;
+    report = checkBothFullModes(false);
+    REQUIRE(1 == report.brokenParentLinks);
+    // The grandchild and its two leaves couldn't be reached through good
+    // links.
+    REQUIRE(24101 - 3 == report.nodesChecked);
+    grandchild->parentPtr = root->childrenPtrs[5];
+  }
+
+  SECTION("Children listed twice, in a long and a short list") {
+    root->childrenPtrs.push_back(root->childrenPtrs[3]);
+    auto grandchild = root->childrenPtrs[0]->childrenPtrs[1];
+    grandchild->childrenPtrs.push_back(grandchild->childrenPtrs[0]);
+    report = checkBothFullModes(false);
+    REQUIRE(2 == report.duplicateChildren);
+    REQUIRE(report.countsMatch);
+
+    options.mode = TreeVerifyMode::SAMPLED;
+    options.sampleSize = 200;
+    TreeVerifyReport sampled = verify(tree, options);
+    REQUIRE(200 == sampled.nodesChecked);
+    REQUIRE(sampled.duplicateChildren > 0);
+    REQUIRE(sampled.countsMatch);
+
+    root->childrenPtrs.pop_back();
+    grandchild->childrenPtrs.pop_back();
+  }
+
+  SECTION("A cycle back to the root") {
+    auto leaf = root->childrenPtrs[9]->childrenPtrs[8]->childrenPtrs[1];
+    leaf->childrenPtrs.push_back(root);
+    root->parentPtr = leaf;
+    report = checkBothFullModes(false);
+    REQUIRE(report.rootHasParent);
+    REQUIRE(1 == report.brokenParentLinks);
+    REQUIRE(options.expectedNodeCount == report.nodesChecked);
+    leaf->childrenPtrs.pop_back();
+    root->parentPtr = nullptr;
+  }
+
+  SECTION("Sampling checks a fixed number of nodes") {
+    options.mode = TreeVerifyMode::SAMPLED;
+    options.sampleSize = 1000;
+    report = verify(tree, options);
+    REQUIRE(report.ok());
+    REQUIRE(1000 == report.nodesChecked);
+
+    GenericTree<int> single(7);
+    REQUIRE(1 == verify(single, options).nodesChecked);
+    GenericTree<int> empty;
+    REQUIRE(verify(empty, options).ok());
+
+    // A sample bigger than the tree checks each node once.
+    options.sampleSize = 30000;
+    report = verify(tree, options);
+    REQUIRE(report.ok());
+    REQUIRE(24101 == report.nodesChecked);
+    REQUIRE(3000 == report.nullSlots);
+  }
+
+  SECTION("Sampling checks a wide root's child list only once") {
+    GenericTree<int> wide(0);
+    for (int i = 1; i <= 100000; i++) {
+      wide.getRootPtr()->addChild(i);
+    }
+    options.mode = TreeVerifyMode::SAMPLED;
+    options.sampleSize = 2000;
+    report = verify(wide, options);
+    REQUIRE(report.ok());
+    REQUIRE(2000 == report.nodesChecked);
+  }
+}
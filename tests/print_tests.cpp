@@ -0,0 +1,183 @@
+
+// Tests for the tree printers and exporters.
+
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../uiuc/catch/catch.hpp"
+
+#include "../GenericTree.h"
+#include "../TreeExport.h"
+#include "../TreePrint.h"
+
+// Builds a bushy tree with a few null child slots left behind by deletions.
+static void buildPrintTree(GenericTree<int>& tree) {
+  tree.clear();
+  auto root = tree.createRoot(0);
+  int nextValue = 1;
+  std::vector<GenericTree<int>::TreeNode*> toDelete;
+  for (int i = 0; i < 12; i++) {
+    auto child = root->addChild(nextValue++);
+    for (int j = 0; j < 7; j++) {
+      auto grandchild = child->addChild(nextValue++);
+      for (int k = 0; k < j % 4; k++) {
+        grandchild->addChild(nextValue++);
+      }
+      if (3 == j) {
+        toDelete.push_back(grandchild);
+      }
+    }
+  }
+  for (auto node : toDelete) {
+    tree.deleteSubtree(node);
+  }
+}
+
+TEST_CASE("printParallel output is identical to Print", "[weight=1]") {
+  TreeThreadPool pool(3);
+
+  SECTION("Bushy tree with null slots") {
+    GenericTree<int> tree;
+    buildPrintTree(tree);
+    std::stringstream expected, actual;
+    tree.Print(expected);
+    printParallel(tree, actual, pool);
+    REQUIRE(expected.str() == actual.str());
+  }
+
+  SECTION("Small and empty trees") {
+    GenericTree<std::string> tree("A");
+    tree.getRootPtr()->addChild("B")->addChild("C");
+    std::stringstream expected, actual;
+    tree.Print(expected);
+    printParallel(tree, actual, pool);
+    REQUIRE(expected.str() == actual.str());
+
+    GenericTree<int> emptyTree;
+    std::stringstream emptyOut;
+    printParallel(emptyTree, emptyOut, pool);
+    REQUIRE("[empty tree]\n" == emptyOut.str());
+  }
+}
+
+TEST_CASE("printLimited respects depth, child and line limits", "[weight=1]") {
+  // The tree from treeFactory in GenericTreeExercises.h
+  GenericTree<int> tree(4);
+  auto root = tree.getRootPtr();
+  auto node8 = root->addChild(8);
+  node8->addChild(16)->addChild(42);
+  node8->addChild(23);
+  root->addChild(15);
+
+  SECTION("Default options match Print") {
+    std::stringstream expected, actual;
+    tree.Print(expected);
+    printLimited(tree, actual, TreePrintOptions<int>());
+    REQUIRE(expected.str() == actual.str());
+  }
+
+  SECTION("Depth limit summarizes deeper children") {
+    TreePrintOptions<int> options;
+    options.maxDepth = 1;
+    std::stringstream actual;
+    printLimited(tree, actual, options);
+    std::string expected = "4\n|\n|_ 8\n|  |\n|  |_ ... 2 more\n|\n|_ 15\n";
+    REQUIRE(expected == actual.str());
+  }
+
+  SECTION("Child limit and starting subtree") {
+    TreePrintOptions<int> options;
+    options.maxChildren = 1;
+    options.startNode = node8;
+    std::stringstream actual;
+    printLimited(tree, actual, options);
+    std::string expected = "8\n|\n|_ 16\n|  |\n|  |_ 42\n|\n|_ ... 1 more\n";
+    REQUIRE(expected == actual.str());
+  }
+
+  SECTION("Line window matches the same lines of Print, with or without sizes") {
+    GenericTree<int> bigTree;
+    buildPrintTree(bigTree);
+    std::stringstream full;
+    bigTree.Print(full);
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(full, line)) {
+      lines.push_back(line);
+    }
+
+    TreeLayout<int> layout(bigTree);
+    TreePrintOptions<int> options;
+    options.firstLine = 57;
+    options.lineCount = 40;
+    std::string expected;
+    for (std::size_t i = 57; i < 97; i++) {
+      expected += lines.at(i) + "\n";
+    }
+
+    std::stringstream walked, skipped;
+    printLimited(bigTree, walked, options);
+    options.layout = &layout;
+    printLimited(bigTree, skipped, options);
+    REQUIRE(expected == walked.str());
+    REQUIRE(expected == skipped.str());
+  }
+}
+
+TEST_CASE("TreeFormatter matches stream output", "[weight=1]") {
+  auto viaStream = [](long long value) {
+    std::stringstream ss;
+    ss << value;
+    return ss.str();
+  };
+  for (long long value : {0LL, 7LL, -7LL, 42LL, 1000000007LL,
+    std::numeric_limits<long long>::min(), std::numeric_limits<long long>::max()}) {
+    std::string text;
+    appendTreeData(text, value);
+    REQUIRE(viaStream(value) == text);
+  }
+
+  std::string text;
+  appendTreeData(text, std::numeric_limits<int>::min());
+  appendTreeData(text, std::string(" abc "));
+  appendTreeData(text, 'x');
+  appendTreeData(text, 2.5);
+  REQUIRE("-2147483648 abc x2.5" == text);
+}
+
+TEST_CASE("Graph exporters number nodes in preorder", "[weight=1]") {
+  GenericTree<std::string> tree("A");
+  auto nodeA = tree.getRootPtr();
+  auto nodeB = nodeA->addChild("B");
+  nodeB->addChild("C");
+  nodeB->addChild("say \"D\"");
+  nodeA->addChild("E");
+
+  SECTION("DOT output") {
+    std::stringstream out;
+    exportDot(tree, out);
+    std::string expected = "digraph tree {\n"
+      "  n0 [label=\"A\"];\n"
+      "  n1 [label=\"B\"];\n  n0 -> n1;\n"
+      "  n2 [label=\"C\"];\n  n1 -> n2;\n"
+      "  n3 [label=\"say \\\"D\\\"\"];\n  n1 -> n3;\n"
+      "  n4 [label=\"E\"];\n  n0 -> n4;\n"
+      "}\n";
+    REQUIRE(expected == out.str());
+  }
+
+  SECTION("Depth-limited edge list of a subtree") {
+    TreeExportOptions<std::string> options;
+    options.maxDepth = 1;
+    std::stringstream whole, sub;
+    exportEdgeList(tree, whole, options);
+    REQUIRE("0\t-1\tA\n1\t0\tB\n2\t0\tE\n" == whole.str());
+
+    options.startNode = nodeB;
+    options.maxDepth = 0;
+    exportEdgeList(tree, sub, options);
+    REQUIRE("0\t-1\tB\n" == sub.str());
+  }
+}
@@ -0,0 +1,136 @@
+
+// Tests for the tree server's binary protocol and the answers it gives.
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../uiuc/catch/catch.hpp"
+
+#include "../TreeProtocol.h"
+#include "../TreeService.h"
+
+TEST_CASE("Protocol frames round trip through a pipelined buffer", "[weight=1]") {
+  using namespace TreeProtocol;
+
+  std::string buffer;
+  std::string payload = "abcdef";
+  appendRequest(buffer, RequestHeader{0, 7, OP_PING, 0, 0, 0});
+  appendRequest(buffer, RequestHeader{static_cast<std::uint32_t>(payload.size()), 8, OP_LOAD, 3, 1, 2}, payload.data());
+
+  RequestHeader header;
+  const char* framePayload = nullptr;
+
+  SECTION("Complete frames parse in order") {
+    std::size_t first = parseFrame(buffer.data(), buffer.size(), header, framePayload);
+    REQUIRE(sizeof(RequestHeader) == first);
+    REQUIRE(7 == header.requestId);
+    std::size_t second = parseFrame(buffer.data() + first, buffer.size() - first, header, framePayload);
+    REQUIRE(buffer.size() == first + second);
+    REQUIRE(8 == header.requestId);
+    REQUIRE(3 == header.treeId);
+    REQUIRE(payload == std::string(framePayload, header.payloadLength));
+  }
+
+  SECTION("A partial frame waits for more bytes") {
+    REQUIRE(0 == parseFrame(buffer.data(), sizeof(RequestHeader) - 1, header, framePayload));
+    std::size_t first = sizeof(RequestHeader);
+    REQUIRE(0 == parseFrame(buffer.data() + first, buffer.size() - first - 1, header, framePayload));
+  }
+}
+
+TEST_CASE("handleRequest answers every kind of request", "[weight=1]") {
+  using namespace TreeProtocol;
+
+  TreeRegistry registry;
+
+  // Send one request and decode the response frame.
+  struct Reply {
+    ResponseHeader header;
+    std::string payload;
+  };
+  auto ask = [&registry](RequestHeader request, const std::string& payload = std::string()) {
+    request.payloadLength = static_cast<std::uint32_t>(payload.size());
+    std::string out;
+    handleRequest(registry, request, payload.data(), out);
+    Reply reply;
+    const char* replyPayload = nullptr;
+    REQUIRE(out.size() == parseFrame(out.data(), out.size(), reply.header, replyPayload));
+    REQUIRE(request.requestId == reply.header.requestId);
+    reply.payload.assign(replyPayload, reply.header.payloadLength);
+    return reply;
+  };
+  auto valuesOf = [](const Reply& reply) {
+    std::vector<int> values(reply.payload.size() / sizeof(int));
+    std::memcpy(values.data(), reply.payload.data(), values.size() * sizeof(int));
+    return values;
+  };
+  auto loadPayload = [](const std::vector<int>& values, const std::vector<std::uint32_t>& degrees) {
+    std::string payload;
+    appendBytes(payload, static_cast<std::uint32_t>(values.size()));
+    for (int value : values) appendBytes(payload, value);
+    for (std::uint32_t degree : degrees) appendBytes(payload, degree);
+    return payload;
+  };
+
+  // 10 has the children 20 and 30, 20 has 40 and 50, and 30 has 60. In
+  // preorder, the node numbers are 10:0, 20:1, 40:2, 50:3, 30:4, 60:5.
+  Reply loaded = ask(RequestHeader{0, 1, OP_LOAD, 2, 0, 0}, loadPayload({10, 20, 30, 40, 50, 60}, {2, 2, 1, 0, 0, 0}));
+  REQUIRE(STATUS_OK == loaded.header.status);
+
+  SECTION("Ping and info") {
+    Reply pong = ask(RequestHeader{0, 2, OP_PING, 0, 0, 0});
+    REQUIRE(STATUS_OK == pong.header.status);
+    REQUIRE(pong.payload.empty());
+    Reply info = ask(RequestHeader{0, 3, OP_INFO, 2, 0, 0});
+    REQUIRE(STATUS_OK == info.header.status);
+    std::uint32_t nodeCount = 0;
+    REQUIRE(sizeof(nodeCount) == info.payload.size());
+    std::memcpy(&nodeCount, info.payload.data(), sizeof(nodeCount));
+    REQUIRE(6 == nodeCount);
+  }
+
+  SECTION("Subtrees come back in preorder, up to the limit") {
+    REQUIRE(std::vector<int>({20, 40, 50}) == valuesOf(ask(RequestHeader{0, 4, OP_SUBTREE, 2, 1, 100})));
+    REQUIRE(std::vector<int>({20, 40}) == valuesOf(ask(RequestHeader{0, 5, OP_SUBTREE, 2, 1, 2})));
+    REQUIRE(std::vector<int>({60}) == valuesOf(ask(RequestHeader{0, 6, OP_SUBTREE, 2, 5, 100})));
+  }
+
+  SECTION("Levels come back in level order, up to the limit") {
+    REQUIRE(std::vector<int>({10, 20, 30, 40, 50, 60}) == valuesOf(ask(RequestHeader{0, 7, OP_LEVELS, 2, 0, 100})));
+    REQUIRE(std::vector<int>({10, 20, 30, 40}) == valuesOf(ask(RequestHeader{0, 8, OP_LEVELS, 2, 0, 4})));
+    REQUIRE(valuesOf(ask(RequestHeader{0, 9, OP_LEVELS, 2, 4, 0})).empty());
+  }
+
+  SECTION("Ancestor checks") {
+    REQUIRE("\x01" == ask(RequestHeader{0, 10, OP_IS_ANCESTOR, 2, 1, 3}).payload);
+    REQUIRE(std::string(1, '\0') == ask(RequestHeader{0, 11, OP_IS_ANCESTOR, 2, 1, 4}).payload);
+    REQUIRE("\x01" == ask(RequestHeader{0, 12, OP_IS_ANCESTOR, 2, 0, 5}).payload);
+    REQUIRE("\x01" == ask(RequestHeader{0, 13, OP_IS_ANCESTOR, 2, 5, 5}).payload);
+    REQUIRE(std::string(1, '\0') == ask(RequestHeader{0, 14, OP_IS_ANCESTOR, 2, 5, 4}).payload);
+    REQUIRE(STATUS_NO_SUCH_NODE == ask(RequestHeader{0, 15, OP_IS_ANCESTOR, 2, 1, 6}).header.status);
+  }
+
+  SECTION("Unknown trees and nodes, and bad requests") {
+    REQUIRE(STATUS_NO_SUCH_TREE == ask(RequestHeader{0, 16, OP_INFO, 3, 0, 0}).header.status);
+    REQUIRE(STATUS_NO_SUCH_TREE == ask(RequestHeader{0, 17, OP_SUBTREE, 3, 0, 10}).header.status);
+    REQUIRE(STATUS_NO_SUCH_NODE == ask(RequestHeader{0, 18, OP_SUBTREE, 2, 6, 10}).header.status);
+    REQUIRE(STATUS_NO_SUCH_NODE == ask(RequestHeader{0, 19, OP_LEVELS, 2, 1000, 10}).header.status);
+    Reply unknown = ask(RequestHeader{0, 20, 99, 2, 0, 0});
+    REQUIRE(STATUS_BAD_REQUEST == unknown.header.status);
+    REQUIRE(unknown.payload.empty());
+  }
+
+  SECTION("Loading checks its payload and replaces the tree") {
+    REQUIRE(STATUS_BAD_REQUEST == ask(RequestHeader{0, 21, OP_LOAD, 2, 0, 0}, "ab").header.status);
+    std::string truncated = loadPayload({1, 2}, {1, 0});
+    truncated.pop_back();
+    REQUIRE(STATUS_BAD_REQUEST == ask(RequestHeader{0, 22, OP_LOAD, 2, 0, 0}, truncated).header.status);
+    // Child counts that don't add up to a tree.
+    REQUIRE(STATUS_BAD_REQUEST == ask(RequestHeader{0, 23, OP_LOAD, 2, 0, 0}, loadPayload({1, 2}, {3, 0})).header.status);
+    REQUIRE(std::vector<int>({10, 20, 40, 50, 30, 60}) == valuesOf(ask(RequestHeader{0, 24, OP_SUBTREE, 2, 0, 100})));
+
+    REQUIRE(STATUS_OK == ask(RequestHeader{0, 25, OP_LOAD, 2, 0, 0}, loadPayload({7, 8}, {1, 0})).header.status);
+    REQUIRE(std::vector<int>({7, 8}) == valuesOf(ask(RequestHeader{0, 26, OP_SUBTREE, 2, 0, 100})));
+  }
+}
@@ -0,0 +1,853 @@
+
+// Tests for the alternative tree representations and storage formats.
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../uiuc/catch/catch.hpp"
+
+#include "../ChainCompressedTree.h"
+#include "../GenericTree.h"
+#include "../LevelOrder.h"
+#include "../SharedTree.h"
+#include "../TreeChunkFile.h"
+#include "../TreeLoader.h"
+#include "../TreeMerge.h"
+
+// Builds the tree from treeFactory in GenericTreeExercises.h, plus a null
+// child slot under 15 left behind by a deletion.
+static void buildStorageTree(GenericTree<int>& tree) {
+  tree.clear();
+  auto root = tree.createRoot(4);
+  auto node8 = root->addChild(8);
+  node8->addChild(16)->addChild(42);
+  node8->addChild(23);
+  auto node15 = root->addChild(15);
+  tree.deleteSubtree(node15->addChild(99));
+  node15->addChild(108);
+}
+
+// Data that needs more alignment than the 8 bytes SharedTree's header and
+// links would give it on their own.
+struct alignas(16) Wide {
+  int value;
+};
+
+static std::ostream& operator<<(std::ostream& os, const Wide& wide) {
+  return os << wide.value;
+}
+
+TEST_CASE("SharedTree maps a copy of a GenericTree", "[weight=1]") {
+  const std::string path = "shared_tree_test.bin";
+  GenericTree<int> source;
+  buildStorageTree(source);
+
+  {
+    SharedTree<int> writer = SharedTree<int>::create(path, source);
+    REQUIRE(7 == writer.size());
+  }
+
+  SharedTree<int> reader = SharedTree<int>::openReadOnly(path);
+
+  SECTION("Printing and traversal work the same way") {
+    std::stringstream expected, actual;
+    expected << source;
+    actual << reader;
+    REQUIRE(expected.str() == actual.str());
+    REQUIRE(std::vector<int>({4, 8, 15, 16, 23, 108, 42}) == traverseLevels(reader));
+  }
+
+  SECTION("Links point both ways") {
+    auto root = reader.getRootPtr();
+    REQUIRE(nullptr == root->parentPtr);
+    auto node15 = root->childrenPtrs[1];
+    REQUIRE(15 == node15->data);
+    REQUIRE(root == node15->parentPtr);
+    REQUIRE(nullptr == node15->childrenPtrs[0]);
+    REQUIRE(108 == node15->childrenPtrs[1]->data);
+  }
+
+  SECTION("Writers update data in place for readers") {
+    SharedTree<int> writer = SharedTree<int>::openWritable(path);
+    writer.updateData(writer.getRootPtr(), 1234);
+    REQUIRE(1234 == reader.getRootPtr()->data);
+    REQUIRE_THROWS(reader.updateData(reader.getRootPtr(), 5));
+  }
+
+  SECTION("Data that needs extra alignment is placed on its alignment") {
+    GenericTree<Wide> wideSource(Wide{1});
+    wideSource.getRootPtr()->addChild(Wide{2})->addChild(Wide{4});
+    wideSource.getRootPtr()->addChild(Wide{3});
+
+    const std::string widePath = "shared_tree_wide_test.bin";
+    SharedTree<Wide> wide = SharedTree<Wide>::create(widePath, wideSource);
+    auto root = wide.getRootPtr();
+    const SharedTree<Wide>::Node* nodes[] = {root, root->childrenPtrs[0], root->childrenPtrs[1],
+      root->childrenPtrs[0]->childrenPtrs[0]};
+    for (int i = 0; i < 4; i++) {
+      REQUIRE(i + 1 == nodes[i]->data.value);
+      REQUIRE(0 == reinterpret_cast<std::uintptr_t>(&nodes[i]->data) % alignof(Wide));
+    }
+    std::remove(widePath.c_str());
+  }
+
+  SECTION("A failed create leaves no temporary file behind") {
+    // A directory can't be renamed over, so publishing fails at the very end.
+    const std::string dirPath = "shared_tree_dir_test";
+    REQUIRE(0 == mkdir(dirPath.c_str(), 0755));
+    REQUIRE_THROWS_WITH(SharedTree<int>::create(dirPath, source), Catch::Contains("Could not publish"));
+    rmdir(dirPath.c_str());
+
+    std::size_t leftovers = 0;
+    DIR* dir = opendir(".");
+    REQUIRE(nullptr != dir);
+    while (dirent* entry = readdir(dir)) {
+      if (0 == std::string(entry->d_name).compare(0, dirPath.size() + 1, dirPath + ".")) leftovers++;
+    }
+    closedir(dir);
+    REQUIRE(0 == leftovers);
+  }
+
+  std::remove(path.c_str());
+}
+
+TEST_CASE("fromLevelOrder rebuilds a tree from level order and degrees", "[weight=1]") {
+  GenericTree<int> source;
+  buildStorageTree(source);
+  source.compress();
+
+  LevelOrderArrays<int> levels = traverseLevelsDetailed(source);
+  GenericTree<int> copy;
+  copy.fromLevelOrder(levels.payloads, levels.childCounts);
+
+  std::stringstream expected, actual;
+  source.Print(expected);
+  copy.Print(actual);
+  REQUIRE(expected.str() == actual.str());
+  REQUIRE(copy.getRootPtr()->childrenPtrs[1]->parentPtr == copy.getRootPtr());
+
+  SECTION("Block nodes mix with ordinary nodes and deletions") {
+    auto root = copy.getRootPtr();
+    root->childrenPtrs[0]->addChild(7)->addChild(9);
+    copy.deleteSubtree(root->childrenPtrs[0]);
+    copy.deleteSubtree(root->childrenPtrs[1]->childrenPtrs[0]);
+    std::stringstream shown;
+    copy.Print(shown);
+    REQUIRE("4\n|\n|_ [null]\n|\n|_ 15\n   |\n   |_ [null]\n" == shown.str());
+    copy.fromLevelOrder(std::vector<int>{1, 2, 3}, std::vector<int>{2, 0, 0});
+    REQUIRE(3 == copy.getRootPtr()->childrenPtrs[1]->data);
+  }
+
+  SECTION("Degrees that don't describe a tree are rejected") {
+    REQUIRE_THROWS_AS(copy.fromLevelOrder(std::vector<int>{1, 2, 3}, std::vector<int>{1, 0, 1}), std::runtime_error);
+    REQUIRE(nullptr == copy.getRootPtr());
+    REQUIRE_THROWS_AS(copy.fromLevelOrder(std::vector<int>{1, 2}, std::vector<int>{2, 0}), std::runtime_error);
+    REQUIRE_THROWS_AS(copy.fromLevelOrder(std::vector<int>{1, 2}, std::vector<int>{0}), std::runtime_error);
+    LevelOrderArrays<int> shapeOnly = traverseLevelsDetailed(source, false);
+    REQUIRE_THROWS_AS(copy.fromLevelOrder(shapeOnly.payloads, shapeOnly.childCounts), std::runtime_error);
+    copy.fromLevelOrder(std::vector<int>(), std::vector<int>());
+    REQUIRE(nullptr == copy.getRootPtr());
+  }
+}
+
+TEST_CASE("ChainCompressedTree collapses single-child chains", "[weight=1]") {
+  GenericTree<int> source;
+  buildStorageTree(source);
+
+  auto checkSameAsSource = [&](const ChainCompressedTree<int>& compressed) {
+    std::stringstream expected, actual;
+    source.Print(expected);
+    compressed.Print(actual);
+    REQUIRE(expected.str() == actual.str());
+    std::vector<int> expectedLevels;
+    for (const int* payload : traverseLevelsDetailed(source).payloads) {
+      expectedLevels.push_back(*payload);
+    }
+    REQUIRE(expectedLevels == traverseLevels(compressed));
+  };
+
+  ChainCompressedTree<int> compressed(source);
+  // Chains: {4}, {8}, {16, 42}, {23}, {15}, {108}.
+  REQUIRE(7 == compressed.size());
+  REQUIRE(6 == compressed.chainCount());
+  checkSameAsSource(compressed);
+
+  SECTION("Long spines become a single chain") {
+    auto cur = source.getRootPtr()->childrenPtrs[1]->childrenPtrs[1];
+    for (int i = 0; i < 5000; i++) {
+      cur = cur->addChild(i);
+    }
+    cur->addChild(-1);
+    cur->addChild(-2)->addChild(-3);
+    compressed.rebuild(source);
+    REQUIRE(7 + 5003 == compressed.size());
+    REQUIRE(8 == compressed.chainCount());
+    checkSameAsSource(compressed);
+  }
+
+  SECTION("A lone null child slot ends a chain") {
+    source.deleteSubtree(source.getRootPtr()->childrenPtrs[0]->childrenPtrs[0]->childrenPtrs[0]);
+    compressed.rebuild(source);
+    checkSameAsSource(compressed);
+    source.clear();
+    compressed.rebuild(source);
+    checkSameAsSource(compressed);
+  }
+}
+
+TEST_CASE("defragment moves the nodes into one block without changing the tree", "[weight=1]") {
+  GenericTree<std::string> tree;
+  auto root = tree.createRoot("root");
+  std::vector<GenericTree<std::string>::TreeNode*> nodes{root};
+  for (int i = 1; i < 300; i++) {
+    nodes.push_back(nodes[(i * 7) % nodes.size()]->addChild("node " + std::to_string(i)));
+  }
+  // Churn: delete some subtrees and grow new nodes elsewhere. (A node's
+  // parent always has a lower index, so deleting from the highest index
+  // down never touches an already deleted node.)
+  for (int i = 290; i > 0; i -= 60) {
+    tree.deleteSubtree(nodes[i]);
+  }
+  LevelOrderArrays<std::string> alive = traverseLevelsDetailed(tree);
+  for (std::size_t i = 0; i < alive.size(); i += 9) {
+    const_cast<GenericTree<std::string>::TreeNode*>(alive.nodes[i])->addChild("regrown " + std::to_string(i));
+  }
+  // A node we hold on to from outside the tree.
+  auto held = const_cast<GenericTree<std::string>::TreeNode*>(alive.nodes.back());
+  std::string heldData = held->data;
+
+  std::stringstream before;
+  tree.Print(before);
+  std::size_t versionBefore = tree.structureVersion();
+
+  auto checkContiguous = [&](TreeOrder order) {
+    LevelOrderArrays<std::string> levels = traverseLevelsDetailed(tree);
+    for (std::size_t i = 1; i < levels.size(); i++) {
+      REQUIRE(levels.nodes[levels.parents[i]] == levels.nodes[i]->parentPtr);
+    }
+    if (TreeOrder::BREADTH_FIRST == order) {
+      for (std::size_t i = 0; i < levels.size(); i++) {
+        REQUIRE(levels.nodes[0] + i == levels.nodes[i]);
+      }
+    }
+  };
+
+  SECTION("Breadth-first with compacted child arrays") {
+    tree.defragment(TreeOrder::BREADTH_FIRST, true, [&](const GenericTree<std::string>::TreeNode* oldNode,
+      GenericTree<std::string>::TreeNode* newNode) {
+      if (oldNode == held) held = newNode;
+    });
+    checkContiguous(TreeOrder::BREADTH_FIRST);
+    REQUIRE(heldData == held->data);
+  }
+
+  SECTION("Depth-first keeping the old child arrays") {
+    tree.defragment(TreeOrder::DEPTH_FIRST, false);
+    checkContiguous(TreeOrder::DEPTH_FIRST);
+    auto cur = tree.getRootPtr();
+    while (!cur->childrenPtrs.empty() && cur->childrenPtrs[0]) {
+      REQUIRE(cur + 1 == cur->childrenPtrs[0]);
+      cur = cur->childrenPtrs[0];
+    }
+    tree.defragment();
+  }
+
+  std::stringstream after;
+  tree.Print(after);
+  REQUIRE(before.str() == after.str());
+  REQUIRE(versionBefore != tree.structureVersion());
+
+  // The defragmented tree still supports the usual changes.
+  tree.getRootPtr()->addChild("late");
+  tree.deleteSubtree(tree.getRootPtr()->childrenPtrs[0]);
+}
+
+// Data that defragment has to copy, since moving it might throw, and whose
+// copies start failing once copiesLeft runs out.
+struct FragileData {
+  static int copiesLeft;
+  std::string value;
+
+  explicit FragileData(const std::string& value) : value(value) {}
+  FragileData(const FragileData& other) : value(other.value) {
+    if (copiesLeft-- <= 0) throw std::runtime_error("copy failed");
+  }
+  FragileData(FragileData&& other) : value(std::move(other.value)) {}
+};
+int FragileData::copiesLeft = 0;
+
+static std::ostream& operator<<(std::ostream& os, const FragileData& data) {
+  return os << data.value;
+}
+
+TEST_CASE("defragment leaves the tree as it was if it fails", "[weight=1]") {
+  using Node = GenericTree<FragileData>::TreeNode;
+  GenericTree<FragileData> tree;
+  FragileData::copiesLeft = 1000;
+  Node* root = tree.createRoot(FragileData("root"));
+  std::vector<Node*> nodes{root};
+  for (int i = 1; i < 30; i++) {
+    nodes.push_back(nodes[(i * 5) % nodes.size()]->addChild(FragileData("node " + std::to_string(i))));
+  }
+  tree.setChildLoader([](Node* node, std::uint64_t key) {
+    node->addChild(FragileData("loaded " + std::to_string(key)));
+  });
+  tree.makePlaceholder(nodes.back(), 4);
+
+  std::stringstream before;
+  tree.Print(before);
+  // Print loaded the placeholder, so make another one.
+  Node* placeholder = nodes.back()->childrenPtrs[0];
+  tree.makePlaceholder(placeholder, 5);
+
+  FragileData::copiesLeft = 10;
+  REQUIRE_THROWS_WITH(tree.defragment(), "copy failed");
+  REQUIRE(root == tree.getRootPtr());
+  for (Node* node : nodes) {
+    REQUIRE(!node->data.value.empty());
+  }
+  REQUIRE(placeholder->hasPendingChildren());
+  REQUIRE(1 == tree.lazilyLoadedCount());
+
+  FragileData::copiesLeft = 1000;
+  tree.defragment();
+  std::stringstream after;
+  tree.Print(after);
+  REQUIRE(before.str() + "      |\n      |_ loaded 5\n" == after.str());
+  REQUIRE(2 == tree.lazilyLoadedCount());
+}
+
+TEST_CASE("TreeChunkFile loads whole trees and single subtrees", "[weight=1]") {
+  const std::string path = "tree_chunk_test.bin";
+  GenericTree<std::string> source;
+  auto root = source.createRoot("root");
+  for (int i = 0; i < 6; i++) {
+    auto child = root->addChild("child " + std::to_string(i));
+    for (int j = 0; j < 5; j++) {
+      auto grandchild = child->addChild("grandchild " + std::to_string(i) + "." + std::to_string(j));
+      for (int k = 0; k < 40; k++) {
+        grandchild->addChild("leaf " + std::to_string(k));
+      }
+    }
+  }
+  source.deleteSubtree(root->childrenPtrs[2]->childrenPtrs[3]);
+  source.deleteSubtree(root->childrenPtrs[4]->childrenPtrs[1]->childrenPtrs[0]);
+
+  // What Print would show for a subtree of the source tree.
+  auto showSubtree = [](const GenericTree<std::string>::TreeNode* node) {
+    std::string shown;
+    renderTreeLines(shown, node, std::string(), true, true, nullptr);
+    return shown;
+  };
+  auto show = [](const GenericTree<std::string>& tree) {
+    std::stringstream shown;
+    tree.Print(shown);
+    return shown.str();
+  };
+
+  TreeThreadPool pool(3);
+  // Each grandchild's subtree (with 40 or 41 nodes) becomes a chunk, and
+  // the root's chunk holds the root and its children.
+  TreeChunkFile<std::string>::write(path, source, 40, pool);
+  TreeChunkFile<std::string> file(path);
+  REQUIRE(40 == file.chunkNodes());
+  REQUIRE(30 == file.chunkCount());
+
+  GenericTree<std::string> loaded;
+  file.loadTree(loaded, pool);
+  REQUIRE(show(source) == show(loaded));
+  std::uint64_t wholeTreeBytes = file.lastBytesRead();
+
+  SECTION("A subtree inside a chunk reads only that chunk") {
+    file.loadSubtree({4, 1}, loaded, pool);
+    REQUIRE(showSubtree(root->childrenPtrs[4]->childrenPtrs[1]) == show(loaded));
+    REQUIRE(file.lastBytesRead() * 20 < wholeTreeBytes);
+    file.loadSubtree({0, 4, 39}, loaded, pool);
+    REQUIRE("leaf 39\n" == show(loaded));
+  }
+
+  SECTION("A subtree that spans chunks reads only its own chunks") {
+    file.loadSubtree({3}, loaded, pool);
+    REQUIRE(showSubtree(root->childrenPtrs[3]) == show(loaded));
+    REQUIRE(file.lastBytesRead() * 4 < wholeTreeBytes);
+  }
+
+  SECTION("Missing paths are reported") {
+    REQUIRE_THROWS_AS(file.loadSubtree({2, 3}, loaded, pool), std::runtime_error);
+    REQUIRE_THROWS_AS(file.loadSubtree({9}, loaded, pool), std::runtime_error);
+    REQUIRE_THROWS_AS(file.loadSubtree({4, 1, 0}, loaded, pool), std::runtime_error);
+    REQUIRE_THROWS_AS(file.loadSubtree({0, 0, 0, 0}, loaded, pool), std::runtime_error);
+  }
+
+  SECTION("Empty trees and plain data types work too") {
+    GenericTree<int> empty, numbers(7), loadedNumbers;
+    TreeChunkFile<int>::write(path, empty, 1, pool);
+    TreeChunkFile<int>(path).loadTree(loadedNumbers, pool);
+    REQUIRE(nullptr == loadedNumbers.getRootPtr());
+    numbers.getRootPtr()->addChild(8)->addChild(9);
+    TreeChunkFile<int>::write(path, numbers, 1, pool);
+    TreeChunkFile<int> numbersFile(path);
+    REQUIRE(3 == numbersFile.chunkCount());
+    numbersFile.loadTree(loadedNumbers, pool);
+    std::stringstream expected, actual;
+    numbers.Print(expected);
+    loadedNumbers.Print(actual);
+    REQUIRE(expected.str() == actual.str());
+    numbersFile.loadSubtree({0, 0}, loadedNumbers, pool);
+    REQUIRE(9 == loadedNumbers.getRootPtr()->data);
+  }
+
+  SECTION("Wide and deep trees are cut into a few large chunks") {
+    GenericTree<int> wide(0), deep(0), loadedNumbers;
+    for (int i = 0; i < 10000; i++) {
+      wide.getRootPtr()->addChild(i);
+    }
+    TreeChunkFile<int>::write(path, wide, 64, pool);
+    REQUIRE(1 == TreeChunkFile<int>(path).chunkCount());
+
+    auto node = deep.getRootPtr();
+    for (int i = 1; i < 1000; i++) {
+      node = node->addChild(i);
+    }
+    TreeChunkFile<int>::write(path, deep, 100, pool);
+    TreeChunkFile<int> deepFile(path);
+    REQUIRE(10 == deepFile.chunkCount());
+    deepFile.loadTree(loadedNumbers, pool);
+    REQUIRE(999 == traverseLevelsDetailed(loadedNumbers).depths.back());
+    std::uint64_t deepBytes = deepFile.lastBytesRead();
+
+    // The node at depth 950 is 50 nodes into the last chunk.
+    deepFile.loadSubtree(TreeChunkFile<int>::Path(950, 0), loadedNumbers, pool);
+    REQUIRE(950 == loadedNumbers.getRootPtr()->data);
+    REQUIRE(50 == traverseLevelsDetailed(loadedNumbers).size());
+    REQUIRE(deepFile.lastBytesRead() * 5 < deepBytes);
+    REQUIRE_THROWS_AS(deepFile.loadSubtree(TreeChunkFile<int>::Path(1000, 0), loadedNumbers, pool),
+      std::runtime_error);
+  }
+
+  SECTION("Damaged files are rejected") {
+    {
+      std::ofstream damaged(path, std::ios::binary | std::ios::trunc);
+      damaged << "TREECHK2" << std::string(32, '\0');
+    }
+    REQUIRE_THROWS_AS(TreeChunkFile<int>(path), std::runtime_error);
+    {
+      std::ofstream damaged(path, std::ios::binary | std::ios::trunc);
+      damaged << "TREECHK2" << std::string(32, '\xff');
+    }
+    REQUIRE_THROWS_AS(TreeChunkFile<int>(path), std::runtime_error);
+
+    // The root's child count, which comes after the 40-byte header, the
+    // entry kind and the data, claims billions of children.
+    GenericTree<int> numbers(7), loadedNumbers;
+    numbers.getRootPtr()->addChild(8);
+    TreeChunkFile<int>::write(path, numbers, 1000, pool);
+    {
+      std::fstream damaged(path, std::ios::binary | std::ios::in | std::ios::out);
+      damaged.seekp(40 + 1 + sizeof(int));
+      damaged << std::string(4, '\xff');
+    }
+    TreeChunkFile<int> damagedFile(path);
+    REQUIRE_THROWS_AS(damagedFile.loadTree(loadedNumbers, pool), std::runtime_error);
+  }
+
+  SECTION("A failed write reports the error") {
+    REQUIRE_THROWS_AS(TreeChunkFile<std::string>::write("no_such_directory/tree.bin", source, 40, pool),
+      std::runtime_error);
+  }
+
+  std::remove(path.c_str());
+}
+
+TEST_CASE("loadTreeText reads trees back through the loading pipeline", "[weight=1]") {
+  const std::string path = "tree_text_test.txt";
+  GenericTree<std::string> source;
+  auto root = source.createRoot("root");
+  std::vector<GenericTree<std::string>::TreeNode*> nodes{root};
+  for (int i = 1; i < 20000; i++) {
+    nodes.push_back(nodes[(i * 31) % nodes.size()]->addChild("node number " + std::to_string(i)));
+  }
+  {
+    std::ofstream file(path);
+    writeTreeText(file, source);
+  }
+
+  // Small blocks, so that the text is split across many of them (and lines
+  // across block boundaries).
+  TreeLoadOptions options;
+  options.blockSize = 4096;
+  options.parserThreads = 3;
+  options.queueCapacity = 4;
+
+  GenericTree<std::string> loaded;
+  TreeLoadStats stats = loadTreeText(path, loaded, options);
+  std::stringstream expected, actual;
+  source.Print(expected);
+  loaded.Print(actual);
+  REQUIRE(expected.str() == actual.str());
+  REQUIRE(20000 == stats.nodes);
+  REQUIRE(stats.read.bytes == stats.parse.bytes);
+  REQUIRE(stats.read.items > 10);
+  std::stringstream report;
+  report << stats;
+  REQUIRE(std::string::npos != report.str().find("parse: 3 thread(s)"));
+
+  SECTION("Malformed text is reported with its line number") {
+    GenericTree<int> numbers;
+    {
+      std::ofstream file(path);
+      file << "0 4\n1 8\n2 16\n\n1 x15\n";
+    }
+    REQUIRE_THROWS_WITH(loadTreeText(path, numbers, options), Catch::Contains("Line 5"));
+    {
+      std::ofstream file(path);
+      file << "0 4\n\n1 8\n\n\n3 16\n";
+    }
+    REQUIRE_THROWS_WITH(loadTreeText(path, numbers, options),
+      Catch::Contains("Line 6") && Catch::Contains("no parent at depth 2"));
+    REQUIRE(nullptr == numbers.getRootPtr());
+    {
+      std::ofstream file(path);
+      file << "0 4\n1 8\n0 5\n";
+    }
+    REQUIRE_THROWS_WITH(loadTreeText(path, numbers, options),
+      Catch::Contains("Line 3") && Catch::Contains("only the first node can have depth 0"));
+    {
+      std::ofstream file(path);
+      file << "\n2 4\n";
+    }
+    REQUIRE_THROWS_WITH(loadTreeText(path, numbers, options), Catch::Contains("Line 2"));
+    // Numbers that don't fit are rejected rather than wrapped around.
+    {
+      std::ofstream file(path);
+      file << "0 4\n1 99999999999\n";
+    }
+    REQUIRE_THROWS_WITH(loadTreeText(path, numbers, options), Catch::Contains("Line 2"));
+    {
+      std::ofstream file(path);
+      file << "0 4\n1 -2147483649\n";
+    }
+    REQUIRE_THROWS_WITH(loadTreeText(path, numbers, options), Catch::Contains("Line 2"));
+    {
+      std::ofstream file(path);
+      file << "0 4\n18446744073709551617 5\n";
+    }
+    REQUIRE_THROWS_WITH(loadTreeText(path, numbers, options),
+      Catch::Contains("Line 2") && Catch::Contains("the depth is too large"));
+    {
+      std::ofstream file(path);
+      file << "0 -2147483648\n1 2147483647\n";
+    }
+    loadTreeText(path, numbers, options);
+    REQUIRE(-2147483647 - 1 == numbers.getRootPtr()->data);
+    REQUIRE(2147483647 == numbers.getRootPtr()->childrenPtrs[0]->data);
+    {
+      std::ofstream file(path);
+      file << "0 4\n1 8\n2 16\n3 42\n2 23\n1 15\n2 108";
+    }
+    loadTreeText(path, numbers, options);
+    std::stringstream shown;
+    numbers.Print(shown);
+    REQUIRE("4\n|\n|_ 8\n|  |\n|  |_ 16\n|  |  |\n|  |  |_ 42\n|  |\n|  |_ 23\n|\n|_ 15\n   |\n   |_ 108\n" == shown.str());
+  }
+
+  std::remove(path.c_str());
+}
+
+TEST_CASE("Placeholder nodes load their children on first use", "[weight=1]") {
+  // Each node's data is its key, and the node with key k has the children
+  // 2k and 2k + 1, up to key 63: a complete binary tree, built on demand.
+  GenericTree<int> lazy;
+  int loads = 0;
+  lazy.setChildLoader([&](GenericTree<int>::TreeNode* node, std::uint64_t key) {
+    loads++;
+    for (std::uint64_t childKey = 2 * key; childKey <= 2 * key + 1; childKey++) {
+      auto child = node->addChild(static_cast<int>(childKey));
+      if (childKey < 32) lazy.makePlaceholder(child, childKey);
+    }
+  });
+  lazy.makePlaceholder(lazy.createRoot(1), 1);
+
+  GenericTree<int> eager;
+  std::vector<GenericTree<int>::TreeNode*> eagerNodes{nullptr, eager.createRoot(1)};
+  for (int key = 2; key < 64; key++) {
+    eagerNodes.push_back(eagerNodes[key / 2]->addChild(key));
+  }
+  std::stringstream expected;
+  eager.Print(expected);
+
+  auto root = lazy.getRootPtr();
+  REQUIRE(root->hasPendingChildren());
+  REQUIRE(root->childrenPtrs.empty());
+  REQUIRE(2 == lazy.childrenOf(root).size());
+  REQUIRE(1 == loads);
+  auto node3 = lazy.childrenOf(root)[1];
+  REQUIRE(node3->childrenPtrs.empty());
+  REQUIRE(6 == lazy.childrenOf(node3)[0]->data);
+  REQUIRE(2 == loads);
+
+  std::stringstream shown;
+  lazy.Print(shown);
+  REQUIRE(expected.str() == shown.str());
+  REQUIRE(31 == loads);
+  REQUIRE(31 == lazy.lazilyLoadedCount());
+
+  SECTION("Cold subtrees can be evicted and loaded again") {
+    // Touch one deep path so that it's the most recently used.
+    auto cur = root;
+    while (!lazy.childrenOf(cur).empty()) {
+      cur = lazy.childrenOf(cur)[0];
+    }
+    REQUIRE(lazy.evictColdSubtrees(5) > 0);
+    REQUIRE(lazy.lazilyLoadedCount() <= 5);
+    REQUIRE(root->childrenPtrs[0]->childrenPtrs[0]->childrenPtrs[0]->childrenPtrs[0] == cur->parentPtr);
+
+    std::stringstream again;
+    lazy.Print(again);
+    REQUIRE(expected.str() == again.str());
+
+    lazy.evict(root);
+    REQUIRE(root->hasPendingChildren());
+    REQUIRE(0 == lazy.lazilyLoadedCount());
+    lazy.defragment();
+    std::stringstream afterDefragment;
+    lazy.Print(afterDefragment);
+    REQUIRE(expected.str() == afterDefragment.str());
+  }
+
+  SECTION("Several threads can walk the tree once everything is loaded") {
+    lazy.materializeAll();
+    std::vector<std::size_t> counts(4, 0);
+    std::vector<std::thread> walkers;
+    for (std::size_t t = 0; t < counts.size(); t++) {
+      walkers.emplace_back([&lazy, &counts, t]() {
+        std::vector<const GenericTree<int>::TreeNode*> pending{lazy.getRootPtr()};
+        while (!pending.empty()) {
+          const GenericTree<int>::TreeNode* cur = pending.back();
+          pending.pop_back();
+          counts[t]++;
+          for (const GenericTree<int>::TreeNode* childPtr : lazy.childrenOf(cur)) {
+            if (childPtr) pending.push_back(childPtr);
+          }
+        }
+      });
+    }
+    for (std::thread& walker : walkers) {
+      walker.join();
+    }
+    for (std::size_t count : counts) {
+      REQUIRE(63 == count);
+    }
+    REQUIRE(31 == loads);
+  }
+
+  SECTION("Writers load placeholders instead of writing them as leaves") {
+    const std::string path = "placeholder_write_test.bin";
+    auto showAfter = [&](std::function<void(std::ostream&)> write) {
+      lazy.evict(root);
+      REQUIRE(root->hasPendingChildren());
+      std::stringstream shown;
+      write(shown);
+      return shown.str();
+    };
+
+    REQUIRE(expected.str() == showAfter([&](std::ostream& shown) {
+      {
+        std::ofstream file(path);
+        writeTreeText(file, lazy);
+      }
+      GenericTree<int> loaded;
+      loadTreeText(path, loaded);
+      loaded.Print(shown);
+    }));
+    REQUIRE(expected.str() == showAfter([&](std::ostream& shown) {
+      shown << SharedTree<int>::create(path, lazy);
+    }));
+    REQUIRE(expected.str() == showAfter([&](std::ostream& shown) {
+      TreeThreadPool pool(2);
+      TreeChunkFile<int>::write(path, lazy, 2, pool);
+      GenericTree<int> loaded;
+      TreeChunkFile<int>(path).loadTree(loaded, pool);
+      loaded.Print(shown);
+    }));
+    REQUIRE(expected.str() == showAfter([&](std::ostream& shown) {
+      ChainCompressedTree<int>(lazy).Print(shown);
+    }));
+    std::remove(path.c_str());
+  }
+
+  SECTION("A failed load leaves the placeholder in place") {
+    lazy.deleteSubtree(root->childrenPtrs[0]);
+    lazy.evict(root->childrenPtrs[1]);
+    lazy.setChildLoader([](GenericTree<int>::TreeNode* node, std::uint64_t) {
+      node->addChild(0);
+      throw std::runtime_error("storage unavailable");
+    });
+    REQUIRE_THROWS_AS(lazy.childrenOf(root->childrenPtrs[1]), std::runtime_error);
+    REQUIRE(root->childrenPtrs[1]->hasPendingChildren());
+    REQUIRE(root->childrenPtrs[1]->childrenPtrs.empty());
+  }
+}
+
+TEST_CASE("mergeInto unifies children with equal data and moves the rest over", "[weight=1]") {
+  using Node = GenericTree<std::string>::TreeNode;
+
+  GenericTree<std::string> dst;
+  auto dstRoot = dst.createRoot("/");
+  auto usr = dstRoot->addChild("usr");
+  usr->addChild("bin");
+  dst.deleteSubtree(dstRoot->addChild("tmp"));
+  dstRoot->addChild("etc");
+  // Enough children to match through the hash table rather than pairwise.
+  auto lib = usr->addChild("lib");
+  for (int i = 0; i < 40; i += 2) {
+    lib->addChild("lib" + std::to_string(i));
+  }
+
+  // The src tree lives in a node block, so its moved nodes must outlive it.
+  GenericTree<std::string> src;
+  src.fromLevelOrder(std::vector<std::string>{"/", "usr", "var", "usr", "lib", "share", "log", "man"},
+    std::vector<int>{3, 2, 1, 1, 0, 0, 0, 0});
+  Node* srcLib = src.getRootPtr()->childrenPtrs[0]->childrenPtrs[0];
+  for (int i = 0; i < 40; i += 3) {
+    srcLib->addChild("lib" + std::to_string(i))->addChild("from src");
+  }
+  Node* var = src.getRootPtr()->childrenPtrs[1];
+  src.markStructureChanged();
+
+  std::size_t versionBefore = dst.structureVersion();
+  std::size_t moved = mergeInto(dst, src);
+
+  GenericTree<std::string> expected;
+  auto expectedRoot = expected.createRoot("/");
+  auto expectedUsr = expectedRoot->addChild("usr");
+  expectedUsr->addChild("bin");
+  expected.deleteSubtree(expectedRoot->addChild("tmp"));
+  expectedRoot->addChild("etc");
+  auto expectedLib = expectedUsr->addChild("lib");
+  for (int i = 0; i < 40; i += 2) {
+    auto child = expectedLib->addChild("lib" + std::to_string(i));
+    if (0 == i % 3) child->addChild("from src");
+  }
+  for (int i = 0; i < 40; i += 3) {
+    if (0 != i % 2) expectedLib->addChild("lib" + std::to_string(i))->addChild("from src");
+  }
+  expectedUsr->addChild("share");
+  expectedUsr->addChild("man");
+  expectedRoot->addChild("var")->addChild("log");
+
+  std::stringstream expectedText, mergedText;
+  expected.Print(expectedText);
+  dst.Print(mergedText);
+  REQUIRE(expectedText.str() == mergedText.str());
+
+  // share, man, var, the odd lib children and the "from src" nodes under
+  // the even ones were moved over whole.
+  REQUIRE(3 + 7 + 7 == moved);
+  REQUIRE(var == dstRoot->childrenPtrs[3]);
+  REQUIRE(dstRoot == var->parentPtr);
+  REQUIRE(nullptr == src.getRootPtr());
+  REQUIRE(versionBefore != dst.structureVersion());
+
+  SECTION("Merging into an empty tree copies only the root") {
+    GenericTree<std::string> empty;
+    REQUIRE(3 == mergeInto(empty, dst));
+    // The null slot stays behind; everything else moves.
+    expected.compress();
+    std::stringstream expectedCompressed, copied;
+    expected.Print(expectedCompressed);
+    empty.Print(copied);
+    REQUIRE(expectedCompressed.str() == copied.str());
+    REQUIRE(usr == empty.getRootPtr()->childrenPtrs[0]);
+    REQUIRE(var == empty.getRootPtr()->childrenPtrs[2]);
+  }
+
+  SECTION("A tree can't be merged into itself") {
+    REQUIRE_THROWS_AS(mergeInto(dst, dst), std::runtime_error);
+  }
+
+  SECTION("Moved placeholders are loaded with src's loader") {
+    // In the lazy tree, key k loads the children "k.0" and "k.1", and the
+    // ones with keys below 4 are placeholders in turn.
+    GenericTree<std::string> lazy;
+    lazy.setChildLoader([&](Node* node, std::uint64_t key) {
+      for (std::uint64_t childKey = 2 * key; childKey <= 2 * key + 1; childKey++) {
+        auto child = node->addChild(std::to_string(key) + "." + std::to_string(childKey % 2));
+        if (childKey < 4) lazy.makePlaceholder(child, childKey);
+      }
+    });
+    auto lazyRoot = lazy.createRoot("/");
+    lazy.makePlaceholder(lazyRoot->addChild("opt"), 1);
+    lazy.makePlaceholder(lazyRoot->addChild("usr"), 3);
+
+    int wrongLoads = 0;
+    dst.setChildLoader([&](Node*, std::uint64_t) { wrongLoads++; });
+    // opt, and the two loaded children of usr.
+    REQUIRE(3 == mergeInto(dst, lazy));
+    REQUIRE(0 == wrongLoads);
+    REQUIRE(0 == dst.lazilyLoadedCount());
+
+    auto opt = dstRoot->childrenPtrs.back();
+    REQUIRE("opt" == opt->data);
+    REQUIRE(!opt->hasPendingChildren());
+    REQUIRE("1.0" == opt->childrenPtrs[0]->data);
+    REQUIRE("2.1" == opt->childrenPtrs[0]->childrenPtrs[1]->data);
+    REQUIRE("3.0" == opt->childrenPtrs[1]->childrenPtrs[0]->data);
+    // usr was unified, so its loaded children were merged in one by one.
+    REQUIRE("3.1" == usr->childrenPtrs.back()->data);
+  }
+
+  SECTION("A moved placeholder whose loader fails stays a placeholder") {
+    // The loader adds a child and then fails.
+    GenericTree<std::string> lazy;
+    lazy.setChildLoader([](Node* node, std::uint64_t key) {
+      node->addChild("loaded " + std::to_string(key));
+      throw std::runtime_error("disk error");
+    });
+    Node* opt = lazy.createRoot("/")->addChild("opt");
+    lazy.makePlaceholder(opt, 7);
+
+    REQUIRE_THROWS_WITH(mergeInto(dst, lazy), "disk error");
+    REQUIRE(nullptr == lazy.getRootPtr());
+    REQUIRE(opt == dstRoot->childrenPtrs.back());
+    REQUIRE(opt->hasPendingChildren());
+    REQUIRE(opt->childrenPtrs.empty());
+
+    // The placeholder's key moved over with it.
+    dst.setChildLoader([](Node* node, std::uint64_t key) {
+      node->addChild("dst loaded " + std::to_string(key));
+    });
+    REQUIRE("dst loaded 7" == dst.childrenOf(opt)[0]->data);
+  }
+
+  SECTION("A merge that fails partway still keeps the moved block nodes alive") {
+    std::size_t usrChildren = usr->childrenPtrs.size();
+    {
+      GenericTree<std::string> blocks;
+      blocks.fromLevelOrder(std::vector<std::string>{"/", "srv", "usr"}, std::vector<int>{2, 0, 0});
+      blocks.setChildLoader([](Node* node, std::uint64_t) {
+        node->addChild("partial");
+        throw std::runtime_error("disk error");
+      });
+      // srv is moved over before the unified usr fails to load.
+      blocks.makePlaceholder(blocks.getRootPtr()->childrenPtrs[1], 1);
+      REQUIRE_THROWS_WITH(mergeInto(dst, blocks), "disk error");
+      REQUIRE(nullptr == blocks.getRootPtr());
+    }
+    Node* srv = dstRoot->childrenPtrs.back();
+    REQUIRE("srv" == srv->data);
+    REQUIRE(dstRoot == srv->parentPtr);
+    REQUIRE(usrChildren == usr->childrenPtrs.size());
+    dst.deleteSubtree(srv);
+  }
+}
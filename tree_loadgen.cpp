@@ -0,0 +1,281 @@
+/**
+ * @file tree_loadgen.cpp
+ * A load generator for tree_server. It opens several connections, keeps a
+ * fixed number of pipelined requests outstanding on each one, and reports
+ * the overall throughput along with latency percentiles.
+ *
+ * Usage: tree_loadgen <socket path> [--connections N] [--pipeline N]
+ *          [--requests N] [--op ping|ancestor|subtree|levels] [--max-items N]
+ *          [--tree N]
+ *
+ * --requests is the number of requests sent on each connection.
+**/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "TreeProtocol.h"
+
+using namespace TreeProtocol;
+using Clock = std::chrono::steady_clock;
+
+struct LoadOptions {
+  std::string socketPath;
+  std::size_t connections = 4;
+  std::size_t pipeline = 32;
+  std::size_t requests = 100000;
+  std::uint16_t opcode = OP_IS_ANCESTOR;
+  std::uint32_t maxItems = 64;
+  std::uint16_t treeId = 0;
+};
+
+// A blocking client connection to the server.
+class Client {
+public:
+  explicit Client(const std::string& socketPath) {
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+      throw std::runtime_error("Could not connect to " + socketPath + ": " + std::strerror(errno));
+    }
+  }
+
+  Client(const Client& other) = delete;
+  Client& operator=(const Client& other) = delete;
+
+  ~Client() {
+    close(fd);
+  }
+
+  void sendAll(const std::string& bytes) {
+    std::size_t written = 0;
+    while (written < bytes.size()) {
+      ssize_t sent = send(fd, bytes.data() + written, bytes.size() - written, MSG_NOSIGNAL);
+      if (sent < 0 && EINTR == errno) continue;
+      if (sent <= 0) throw std::runtime_error("Lost the connection while sending");
+      written += static_cast<std::size_t>(sent);
+    }
+  }
+
+  // Wait for at least one complete response, then call onResponse for every
+  // complete response that has arrived.
+  template <typename OnResponse>
+  void receive(OnResponse onResponse) {
+    bool gotOne = false;
+    while (!gotOne) {
+      char chunk[64 * 1024];
+      ssize_t got = read(fd, chunk, sizeof(chunk));
+      if (got < 0 && EINTR == errno) continue;
+      if (got <= 0) throw std::runtime_error("Lost the connection while receiving");
+      inBuffer.append(chunk, static_cast<std::size_t>(got));
+
+      std::size_t consumed = 0;
+      ResponseHeader header;
+      const char* payload = nullptr;
+      while (std::size_t frameSize = parseFrame(inBuffer.data() + consumed, inBuffer.size() - consumed, header, payload)) {
+        onResponse(header, payload);
+        consumed += frameSize;
+        gotOne = true;
+      }
+      inBuffer.erase(0, consumed);
+    }
+  }
+
+private:
+  int fd;
+  std::string inBuffer;
+};
+
+// Ask the server how many nodes the tree has.
+static std::uint32_t queryNodeCount(const LoadOptions& options) {
+  Client client(options.socketPath);
+  std::string request;
+  appendRequest(request, RequestHeader{0, 0, OP_INFO, options.treeId, 0, 0});
+  client.sendAll(request);
+  std::uint32_t nodeCount = 0;
+  std::uint16_t status = STATUS_OK;
+  client.receive([&](const ResponseHeader& header, const char* payload) {
+    status = header.status;
+    if (header.payloadLength >= sizeof(nodeCount)) {
+      std::memcpy(&nodeCount, payload, sizeof(nodeCount));
+    }
+  });
+  if (STATUS_OK != status) {
+    throw std::runtime_error("The server has no tree with that id");
+  }
+  return nodeCount;
+}
+
+// Run one connection's share of the load, recording each latency in
+// nanoseconds.
+static void runConnection(const LoadOptions& options, std::uint32_t nodeCount, unsigned seed,
+  std::vector<std::uint64_t>& latencies, std::size_t& errors) {
+
+  Client client(options.socketPath);
+  std::mt19937 random(seed);
+  std::uniform_int_distribution<std::uint32_t> pickNode(0, nodeCount - 1);
+
+  std::vector<Clock::time_point> sentAt(options.requests);
+  latencies.reserve(options.requests);
+  std::size_t sent = 0;
+  std::size_t received = 0;
+  std::string batch;
+
+  while (received < options.requests) {
+    // Top the pipeline back up, sending all of the new requests at once.
+    batch.clear();
+    Clock::time_point now = Clock::now();
+    while (sent < options.requests && sent - received < options.pipeline) {
+      std::uint32_t argument = (OP_IS_ANCESTOR == options.opcode) ? pickNode(random) : options.maxItems;
+      RequestHeader header{0, static_cast<std::uint32_t>(sent), options.opcode,
+        options.treeId, pickNode(random), argument};
+      appendRequest(batch, header);
+      sentAt[sent] = now;
+      sent++;
+    }
+    if (!batch.empty()) {
+      client.sendAll(batch);
+    }
+
+    client.receive([&](const ResponseHeader& header, const char* payload) {
+      Clock::time_point arrived = Clock::now();
+      if (header.requestId < sentAt.size()) {
+        latencies.push_back(static_cast<std::uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(arrived - sentAt[header.requestId]).count()));
+      }
+      if (STATUS_OK != header.status) {
+        errors++;
+      }
+      received++;
+    });
+  }
+}
+
+int main(int argc, char* argv[]) {
+
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <socket path> [--connections N] [--pipeline N]"
+      << " [--requests N] [--op ping|ancestor|subtree|levels] [--max-items N] [--tree N]" << std::endl;
+    return 1;
+  }
+
+  LoadOptions options;
+  options.socketPath = argv[1];
+  for (int i = 2; i < argc; i += 2) {
+    std::string option = argv[i];
+    if (i + 1 == argc) {
+      std::cerr << "Missing a value for " << option << std::endl;
+      return 1;
+    }
+    std::string value = argv[i+1];
+    if ("--connections" == option) options.connections = std::strtoull(value.c_str(), nullptr, 10);
+    else if ("--pipeline" == option) options.pipeline = std::strtoull(value.c_str(), nullptr, 10);
+    else if ("--requests" == option) options.requests = std::strtoull(value.c_str(), nullptr, 10);
+    else if ("--max-items" == option) options.maxItems = static_cast<std::uint32_t>(std::strtoul(value.c_str(), nullptr, 10));
+    else if ("--tree" == option) options.treeId = static_cast<std::uint16_t>(std::strtoul(value.c_str(), nullptr, 10));
+    else if ("--op" == option) {
+      if ("ping" == value) options.opcode = OP_PING;
+      else if ("ancestor" == value) options.opcode = OP_IS_ANCESTOR;
+      else if ("subtree" == value) options.opcode = OP_SUBTREE;
+      else if ("levels" == value) options.opcode = OP_LEVELS;
+      else {
+        std::cerr << "Unknown operation: " << value << std::endl;
+        return 1;
+      }
+    }
+    else {
+      std::cerr << "Unknown option: " << option << std::endl;
+      return 1;
+    }
+  }
+  options.connections = std::max<std::size_t>(1, options.connections);
+  options.pipeline = std::max<std::size_t>(1, options.pipeline);
+  if (0 == options.requests) {
+    std::cerr << "--requests must be at least 1" << std::endl;
+    return 1;
+  }
+
+  try {
+    std::uint32_t nodeCount = queryNodeCount(options);
+    if (0 == nodeCount) {
+      std::cerr << "The tree is empty" << std::endl;
+      return 1;
+    }
+
+    std::vector< std::vector<std::uint64_t> > latencies(options.connections);
+    std::vector<std::size_t> errors(options.connections, 0);
+    std::vector<std::string> failures(options.connections);
+    std::vector<std::thread> threads;
+
+    Clock::time_point start = Clock::now();
+    for (std::size_t i = 0; i < options.connections; i++) {
+      threads.emplace_back([&, i]() {
+        // An exception can't be allowed to leave the thread, so a connection
+        // that fails counts its unanswered requests as errors instead.
+        try {
+          runConnection(options, nodeCount, static_cast<unsigned>(i + 1), latencies[i], errors[i]);
+        }
+        catch (const std::exception& error) {
+          failures[i] = error.what();
+          errors[i] += options.requests - std::min(options.requests, latencies[i].size());
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    std::size_t failedConnections = 0;
+    for (std::size_t i = 0; i < options.connections; i++) {
+      if (failures[i].empty()) continue;
+      std::cerr << "Connection " << i << " failed: " << failures[i] << std::endl;
+      failedConnections++;
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<std::uint64_t> all;
+    std::size_t totalErrors = 0;
+    for (std::size_t i = 0; i < options.connections; i++) {
+      all.insert(all.end(), latencies[i].begin(), latencies[i].end());
+      totalErrors += errors[i];
+    }
+    std::sort(all.begin(), all.end());
+
+    auto percentile = [&all](double p) {
+      if (all.empty()) return 0.0;
+      std::size_t index = static_cast<std::size_t>(p * static_cast<double>(all.size() - 1));
+      return static_cast<double>(all[index]) / 1000.0;
+    };
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "requests:    " << all.size() << " (" << totalErrors << " errors)" << std::endl;
+    std::cout << "throughput:  " << static_cast<double>(all.size()) / seconds << " requests/s" << std::endl;
+    std::cout << "latency (us): p50 " << percentile(0.50) << "  p90 " << percentile(0.90)
+      << "  p99 " << percentile(0.99) << "  p99.9 " << percentile(0.999)
+      << "  max " << percentile(1.0) << std::endl;
+    if (failedConnections > 0) return 1;
+  }
+  catch (const std::exception& error) {
+    std::cerr << error.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
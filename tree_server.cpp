@@ -0,0 +1,418 @@
+/**
+ * @file tree_server.cpp
+ * A local query server that keeps GenericTree instances in memory and
+ * answers pipelined batches of binary requests over a Unix domain socket.
+ *
+ * Usage: tree_server <socket path> [--demo-nodes N] [--threads N]
+ *
+ * With --demo-nodes, tree 0 is filled with a random tree of N nodes (whose
+ * data values are their preorder numbers) so that there is something to
+ * query right away. Other trees can be loaded over the socket with OP_LOAD.
+ * See TreeProtocol.h for the request format.
+**/
+
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "GenericTree.h"
+#include "TreeLayout.h"
+#include "TreeProtocol.h"
+#include "TreeService.h"
+#include "TreeThreadPool.h"
+
+using namespace TreeProtocol;
+
+// -------------------------------------------------------------------
+// The demo tree
+// -------------------------------------------------------------------
+
+// makeDemoTree: A random tree where each new node picks a random earlier
+// node as its parent. Afterward, each node's data is its preorder number.
+static std::shared_ptr<TreeEntry> makeDemoTree(std::size_t nodeCount) {
+  auto entry = std::make_shared<TreeEntry>();
+  std::mt19937 random(12345);
+  std::vector<GenericTree<int>::TreeNode*> nodes;
+  nodes.reserve(nodeCount);
+  nodes.push_back(entry->tree.createRoot(0));
+  for (std::size_t i = 1; i < nodeCount; i++) {
+    std::uniform_int_distribution<std::size_t> pickParent(0, i - 1);
+    nodes.push_back(nodes[pickParent(random)]->addChild(0));
+  }
+  entry->layout.rebuild(entry->tree);
+  for (std::size_t i = 0; i < entry->layout.size(); i++) {
+    entry->layout.nodes[i]->data = static_cast<int>(i);
+  }
+  return entry;
+}
+
+// -------------------------------------------------------------------
+// Connections and the event loop
+// -------------------------------------------------------------------
+
+// One client connection. The event loop thread owns all of the I/O. While a
+// batch of requests from the connection is being answered by a worker, the
+// connection is "busy", and newly arrived requests wait in inBuffer; that
+// keeps the responses in request order.
+struct Connection {
+  int fd;
+  std::string inBuffer;
+  std::string outBuffer;
+  bool busy;
+  bool closed;
+  // The events currently being watched for on the socket.
+  std::uint32_t eventMask;
+  // Filled in by the worker that answered the current batch.
+  std::string batchResult;
+
+  explicit Connection(int fd) : fd(fd), busy(false), closed(false), eventMask(EPOLLIN) {}
+};
+
+// Backpressure: stop reading from a client while this much of its input is
+// waiting to be answered, or this much output is waiting for it to read.
+// The input limit leaves room for two of the largest frames, so a full
+// buffer always holds at least one complete request to work on.
+constexpr std::size_t MAX_PENDING_INPUT = 2 * (sizeof(RequestHeader) + MAX_PAYLOAD);
+constexpr std::size_t MAX_PENDING_OUTPUT = 64u << 20;
+
+// The most requests handed to a worker at once, so that one busy client
+// can't hold a worker (or build up a huge response) for too long.
+constexpr std::size_t MAX_BATCH_FRAMES = 256;
+
+static std::atomic<bool> stopRequested(false);
+
+static void onStopSignal(int) {
+  stopRequested = true;
+}
+
+class TreeServer {
+public:
+  TreeServer(const std::string& socketPath, TreeRegistry& registry, TreeThreadPool& pool)
+    : registry(registry), pool(pool) {
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) fail("socket");
+
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+      throw std::runtime_error("Socket path is too long: " + socketPath);
+    }
+    std::strcpy(address.sun_path, socketPath.c_str());
+    unlink(socketPath.c_str());
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) fail("bind");
+    if (listen(listenFd, 256) != 0) fail("listen");
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd < 0 || wakeFd < 0) fail("epoll/eventfd");
+    watch(listenFd, EPOLLIN, EPOLL_CTL_ADD);
+    watch(wakeFd, EPOLLIN, EPOLL_CTL_ADD);
+  }
+
+  ~TreeServer() {
+    // Workers refer back to this server, so wait for any that are still
+    // answering a batch before tearing things down.
+    while (batchesInFlight.load() > 0) {
+      std::this_thread::yield();
+    }
+    for (auto& entry : connections) {
+      close(entry.first);
+    }
+    close(listenFd);
+    close(epollFd);
+    close(wakeFd);
+  }
+
+  // Run the event loop until a stop signal arrives.
+  void run() {
+    std::vector<epoll_event> events(256);
+    while (!stopRequested) {
+      int ready = epoll_wait(epollFd, events.data(), static_cast<int>(events.size()), 500);
+      if (ready < 0) {
+        if (EINTR == errno) continue;
+        fail("epoll_wait");
+      }
+      for (int i = 0; i < ready; i++) {
+        int fd = events[i].data.fd;
+        if (fd == listenFd) {
+          acceptClients();
+        }
+        else if (fd == wakeFd) {
+          collectFinishedBatches();
+        }
+        else {
+          auto found = connections.find(fd);
+          if (connections.end() == found) continue;
+          std::shared_ptr<Connection> conn = found->second;
+          if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+            // The client is gone for good, so nobody could read the answers
+            // to whatever it still had queued up.
+            closeConnection(conn);
+            continue;
+          }
+          if (events[i].events & EPOLLIN) {
+            readFrom(conn);
+          }
+          if (!conn->closed && (events[i].events & EPOLLOUT)) {
+            flush(conn);
+          }
+        }
+      }
+    }
+  }
+
+private:
+
+  static void fail(const char* what) {
+    throw std::runtime_error(std::string(what) + " failed: " + std::strerror(errno));
+  }
+
+  void watch(int fd, std::uint32_t eventMask, int operation) {
+    epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = eventMask;
+    event.data.fd = fd;
+    if (epoll_ctl(epollFd, operation, fd, &event) != 0) fail("epoll_ctl");
+  }
+
+  void acceptClients() {
+    while (true) {
+      int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) return;
+      connections[fd] = std::make_shared<Connection>(fd);
+      watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+    }
+  }
+
+  void closeConnection(const std::shared_ptr<Connection>& conn) {
+    if (conn->closed) return;
+    conn->closed = true;
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->fd, nullptr);
+    close(conn->fd);
+    // A worker may still hold the connection; it is freed when that
+    // worker's batch is collected.
+    connections.erase(conn->fd);
+  }
+
+  void readFrom(const std::shared_ptr<Connection>& conn) {
+    char chunk[64 * 1024];
+    while (conn->inBuffer.size() < MAX_PENDING_INPUT) {
+      ssize_t got = read(conn->fd, chunk, sizeof(chunk));
+      if (got > 0) {
+        conn->inBuffer.append(chunk, static_cast<std::size_t>(got));
+        continue;
+      }
+      if (0 == got || (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno)) {
+        closeConnection(conn);
+        return;
+      }
+      if (EINTR != errno) break;
+    }
+    dispatch(conn);
+    updateInterest(conn);
+  }
+
+  // Watch for input only while the connection is under both backpressure
+  // limits, and for writability only while there's output waiting. The
+  // socket is level-triggered, so leaving EPOLLIN on would just keep
+  // waking the loop for data we don't want yet.
+  void updateInterest(const std::shared_ptr<Connection>& conn) {
+    if (conn->closed) return;
+    std::uint32_t eventMask = 0;
+    if (conn->inBuffer.size() < MAX_PENDING_INPUT && conn->outBuffer.size() <= MAX_PENDING_OUTPUT) {
+      eventMask |= EPOLLIN;
+    }
+    if (!conn->outBuffer.empty()) {
+      eventMask |= EPOLLOUT;
+    }
+    if (eventMask != conn->eventMask) {
+      conn->eventMask = eventMask;
+      watch(conn->fd, eventMask, EPOLL_CTL_MOD);
+    }
+  }
+
+  // Hand up to MAX_BATCH_FRAMES complete requests waiting on a connection to
+  // a worker, unless the connection already has a batch in progress.
+  void dispatch(const std::shared_ptr<Connection>& conn) {
+    if (conn->closed) return;
+
+    // Check the size of the next frame right away, even if it has to wait,
+    // so an oversized one is refused before we buffer any more of it.
+    RequestHeader header;
+    if (conn->inBuffer.size() >= sizeof(header)) {
+      std::memcpy(&header, conn->inBuffer.data(), sizeof(header));
+      if (header.payloadLength > MAX_PAYLOAD) {
+        closeConnection(conn);
+        return;
+      }
+    }
+    if (conn->busy || conn->outBuffer.size() > MAX_PENDING_OUTPUT) return;
+
+    std::size_t consumed = 0;
+    std::size_t frameCount = 0;
+    const char* payload = nullptr;
+    while (frameCount < MAX_BATCH_FRAMES) {
+      std::size_t frameSize = parseFrame(conn->inBuffer.data() + consumed,
+        conn->inBuffer.size() - consumed, header, payload);
+      if (0 == frameSize) break;
+      consumed += frameSize;
+      frameCount++;
+    }
+    if (conn->inBuffer.size() - consumed >= sizeof(RequestHeader)) {
+      // The next frame claims to be bigger than we allow.
+      std::memcpy(&header, conn->inBuffer.data() + consumed, sizeof(header));
+      if (header.payloadLength > MAX_PAYLOAD) {
+        closeConnection(conn);
+        return;
+      }
+    }
+    if (0 == consumed) return;
+
+    auto batch = std::make_shared<std::string>(conn->inBuffer, 0, consumed);
+    conn->inBuffer.erase(0, consumed);
+    conn->busy = true;
+    batchesInFlight++;
+    updateInterest(conn);
+
+    pool.submit([this, conn, batch]() {
+      std::string out;
+      std::size_t offset = 0;
+      RequestHeader request;
+      const char* requestPayload = nullptr;
+      while (offset < batch->size()) {
+        offset += parseFrame(batch->data() + offset, batch->size() - offset, request, requestPayload);
+        handleRequest(registry, request, requestPayload, out);
+      }
+      conn->batchResult.swap(out);
+      {
+        std::unique_lock<std::mutex> lock(finishedMutex);
+        finished.push_back(conn);
+      }
+      std::uint64_t one = 1;
+      ssize_t ignored = write(wakeFd, &one, sizeof(one));
+      (void)ignored;
+      batchesInFlight--;
+    });
+  }
+
+  void collectFinishedBatches() {
+    std::uint64_t counter;
+    ssize_t ignored = read(wakeFd, &counter, sizeof(counter));
+    (void)ignored;
+
+    std::vector< std::shared_ptr<Connection> > done;
+    {
+      std::unique_lock<std::mutex> lock(finishedMutex);
+      done.swap(finished);
+    }
+    for (auto& conn : done) {
+      conn->busy = false;
+      if (conn->closed) continue;
+      conn->outBuffer += conn->batchResult;
+      conn->batchResult.clear();
+      // Sends what it can, then dispatches the next batch.
+      flush(conn);
+    }
+  }
+
+  void flush(const std::shared_ptr<Connection>& conn) {
+    std::size_t written = 0;
+    while (written < conn->outBuffer.size()) {
+      ssize_t sent = send(conn->fd, conn->outBuffer.data() + written,
+        conn->outBuffer.size() - written, MSG_NOSIGNAL);
+      if (sent > 0) {
+        written += static_cast<std::size_t>(sent);
+        continue;
+      }
+      if (sent < 0 && EINTR == errno) continue;
+      if (sent < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)) break;
+      closeConnection(conn);
+      return;
+    }
+    conn->outBuffer.erase(0, written);
+
+    // Draining the output may lift the backpressure on dispatching and
+    // reading.
+    dispatch(conn);
+    updateInterest(conn);
+  }
+
+  TreeRegistry& registry;
+  TreeThreadPool& pool;
+  int listenFd;
+  int epollFd;
+  int wakeFd;
+  std::unordered_map< int, std::shared_ptr<Connection> > connections;
+  std::mutex finishedMutex;
+  std::vector< std::shared_ptr<Connection> > finished;
+  std::atomic<std::size_t> batchesInFlight{0};
+};
+
+int main(int argc, char* argv[]) {
+
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <socket path> [--demo-nodes N] [--threads N]" << std::endl;
+    return 1;
+  }
+
+  std::string socketPath = argv[1];
+  std::size_t demoNodes = 0;
+  std::size_t threadCount = 0;
+  for (int i = 2; i < argc; i += 2) {
+    std::string option = argv[i];
+    if (i + 1 == argc) {
+      std::cerr << "Missing a value for " << option << std::endl;
+      return 1;
+    }
+    std::size_t value = std::strtoull(argv[i+1], nullptr, 10);
+    if ("--demo-nodes" == option) demoNodes = value;
+    else if ("--threads" == option) threadCount = value;
+    else {
+      std::cerr << "Unknown option: " << option << std::endl;
+      return 1;
+    }
+  }
+
+  std::signal(SIGINT, onStopSignal);
+  std::signal(SIGTERM, onStopSignal);
+
+  TreeRegistry registry;
+  if (demoNodes > 0) {
+    registry.publish(0, makeDemoTree(demoNodes));
+    std::cout << "Loaded demo tree 0 with " << demoNodes << " nodes" << std::endl;
+  }
+
+  try {
+    TreeThreadPool pool(threadCount);
+    TreeServer server(socketPath, registry, pool);
+    std::cout << "Listening on " << socketPath << " with " << pool.size() << " worker threads" << std::endl;
+    server.run();
+  }
+  catch (const std::exception& error) {
+    std::cerr << error.what() << std::endl;
+    return 1;
+  }
+
+  unlink(socketPath.c_str());
+  return 0;
+}